@@ -3,6 +3,23 @@
 #include <string.h>
 #include "bitmap.h"
 
+static const char HEX_DIGITS[16] = "0123456789abcdef";
+
+// The value of each hex digit plus one, so that every other character maps to 0
+static const byte HEX_VALUES_PLUS_ONE[BYTE_COMBINATIONS] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,  ['5'] = 6,  ['6'] = 7,  ['7'] = 8,
+    ['8'] = 9,  ['9'] = 10, ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16};
+
+#ifdef BITMAP_X86_SIMD
+#include <immintrin.h>
+
+#define SSE2_LOAD(bytes, i) _mm_loadu_si128((const __m128i *)((bytes) + (i)))
+#define SSE2_STORE(bytes, i, value) _mm_storeu_si128((__m128i *)((bytes) + (i)), (value))
+#define AVX2_LOAD(bytes, i) _mm256_loadu_si256((const __m256i *)((bytes) + (i)))
+#define AVX2_STORE(bytes, i, value) _mm256_storeu_si256((__m256i *)((bytes) + (i)), (value))
+#endif
+
 // Initialise a bitmap containing all zeros of size `size`. Note that the full bytes are zeroed
 bitmap bitmap_init_zeros(int size) {
   if (size < 0) {
@@ -10,6 +27,9 @@ bitmap bitmap_init_zeros(int size) {
     exit(EXIT_FAILURE);
   }
 
+  // Small bitmaps (such as SHA-256 words and hashes) keep their bits inline, so need no allocation
+  if (size <= BITMAP_INLINE_BITS) return (bitmap){size, NULL, 0, {0}};
+
   int bytes_required = _full_bytes_needed(size);
   byte *map = calloc(bytes_required, sizeof *map);
   if (!map) {
@@ -17,7 +37,61 @@ bitmap bitmap_init_zeros(int size) {
     exit(EXIT_FAILURE);
   }
 
-  return (bitmap){size, map};
+  return (bitmap){size, map, 1, {0}};
+}
+
+// Get the bytes holding the bits of `bmap`, which are in its inline buffer unless it has a separate map. The
+// pointer is only valid as long as `bmap` itself, since bitmaps are passed by value
+byte *bitmap_bytes(bitmap *bmap) { return (bmap->map != NULL) ? bmap->map : bmap->inline_map; }
+
+// Initialise an empty arena that will allocate blocks of `block_capacity` bytes (or more, for a larger bitmap)
+bitmap_arena bitmap_arena_init(int block_capacity) {
+  if (block_capacity <= 0) {
+    fprintf(stderr, "Bitmap arena cannot be initialised with block capacity %d.\n", block_capacity);
+    exit(EXIT_FAILURE);
+  }
+
+  return (bitmap_arena){NULL, NULL, block_capacity};
+}
+
+// Initialise a bitmap of `size` zeros in `arena`, or on the heap as `bitmap_init_zeros` does if `arena` is NULL.
+// The bitmap stays valid until the arena is reset or freed, and `bitmap_free` does nothing to it
+bitmap bitmap_init_zeros_in(bitmap_arena *arena, int size) {
+  if (arena == NULL || size <= BITMAP_INLINE_BITS) return bitmap_init_zeros(size);
+
+  int bytes_required = _full_bytes_needed(size);
+  byte *map = _bitmap_arena_alloc(arena, bytes_required);
+  memset(map, 0, bytes_required);
+
+  return (bitmap){size, map, 0, {0}};
+}
+
+// Get a copy of `bmap` made in `arena`, or on the heap if `arena` is NULL
+bitmap bitmap_copy_in(bitmap_arena *arena, bitmap bmap) {
+  bitmap result = bitmap_init_zeros_in(arena, bmap.size);
+  bitmap_copy_into(&result, bmap);
+
+  return result;
+}
+
+// Release every bitmap made in `arena` at once. The blocks are kept, so making the same bitmaps again allocates
+// nothing
+void bitmap_arena_reset(bitmap_arena *arena) {
+  arena->current = arena->first;
+  if (arena->first != NULL) arena->first->used = 0;
+}
+
+// Free the blocks of `arena`, which releases every bitmap made in it
+void bitmap_arena_free(bitmap_arena *arena) {
+  bitmap_arena_block *block = arena->first;
+  while (block != NULL) {
+    bitmap_arena_block *next = block->next;
+    free(block);
+    block = next;
+  }
+
+  arena->first = NULL;
+  arena->current = NULL;
 }
 
 // Initialise a bitmap from a string of zeros and ones
@@ -37,6 +111,35 @@ bitmap bitmap_init_string(const char *string) {
   return result;
 }
 
+// Initialise a bitmap from a string of hex digits (in either case), four bits per digit
+bitmap bitmap_init_hex(const char *hex) {
+  bitmap result;
+  if (!bitmap_parse_hex(hex, &result)) {
+    fprintf(stderr, "The string \"%s\" is invalid for hex bitmap input.\n", hex);
+    exit(EXIT_FAILURE);
+  }
+
+  return result;
+}
+
+// Decode the hex digits in `hex` into a new bitmap at `result`, four bits per digit. Returns 0 (without
+// allocating) if `hex` contains anything other than hex digits
+int bitmap_parse_hex(const char *hex, bitmap *result) {
+  int num_digits = strlen(hex);
+  for (int i = 0; i < num_digits; i++) {
+    if (HEX_VALUES_PLUS_ONE[(byte)hex[i]] == 0) return 0;
+  }
+
+  *result = bitmap_init_zeros(num_digits * 4);
+  byte *bytes = bitmap_bytes(result);
+  for (int i = 0; i + 1 < num_digits; i += 2) {
+    bytes[i / 2] = (HEX_VALUES_PLUS_ONE[(byte)hex[i]] - 1) << 4 | (HEX_VALUES_PLUS_ONE[(byte)hex[i + 1]] - 1);
+  }
+  if (num_digits % 2 != 0) bytes[num_digits / 2] = (HEX_VALUES_PLUS_ONE[(byte)hex[num_digits - 1]] - 1) << 4;
+
+  return 1;
+}
+
 // Initialise a bitmap that is the binary representation of the number `number`, fit into `bytes` bytes. Note that
 // overflow can happen, in which case the bytes will be set to the remainder of `number` when fit into those bytes
 bitmap bitmap_init_number(u64 number, int bytes) {
@@ -58,7 +161,7 @@ int bitmap_get_bit(bitmap bmap, int index) {
     exit(EXIT_FAILURE);
   }
 
-  byte this_byte = bmap.map[index / BYTE_SIZE];
+  byte this_byte = bitmap_bytes(&bmap)[index / BYTE_SIZE];
   // Shifting the 1 this way is consistent with setting bytes directly
   return (this_byte & (1 << (BYTE_SIZE - 1 - (index % BYTE_SIZE)))) != 0;
 }
@@ -79,7 +182,7 @@ void bitmap_set_bit(bitmap *bmap, int index, int new_value) {
   if (bitmap_get_bit(*bmap, index) == new_value) return;
 
   // Otherwise toggle the bit
-  bmap->map[index / BYTE_SIZE] ^= (1 << (BYTE_SIZE - 1 - (index % BYTE_SIZE)));
+  bitmap_bytes(bmap)[index / BYTE_SIZE] ^= (1 << (BYTE_SIZE - 1 - (index % BYTE_SIZE)));
 }
 
 // Set the byte at byte index `byte_index` to `new_value`. Note that this could be used to set bits in the final
@@ -92,7 +195,7 @@ void bitmap_set_byte(bitmap *bmap, int byte_index, byte new_value) {
   }
 
   // Simply set the byte
-  bmap->map[byte_index] = new_value;
+  bitmap_bytes(bmap)[byte_index] = new_value;
 }
 
 // Set `num_bytes` bytes starting at byte index `starting_byte` to the binary representation of the number
@@ -118,76 +221,69 @@ void bitmap_set_bytes_from_number(bitmap *bmap, u64 number, int starting_byte, i
 int bitmap_equal(bitmap bmap1, bitmap bmap2) {
   if (bmap1.size != bmap2.size) return 0;
 
-  // Check bytes first for speed
-  for (int i = 0; i < bmap1.size / BYTE_SIZE; i++) {
-    if (bmap1.map[i] != bmap2.map[i]) return 0;
-  }
+  const byte *bytes1 = bitmap_bytes(&bmap1);
+  const byte *bytes2 = bitmap_bytes(&bmap2);
+  int full_bytes = bmap1.size / BYTE_SIZE;
+  if (!_bitmap_bytes_equal(bytes1, bytes2, full_bytes)) return 0;
 
   // Check only the necessary bits in the trailing byte
-  for (int i = BYTE_SIZE * (bmap1.size / BYTE_SIZE); i < bmap1.size; i++) {
-    if (bitmap_get_bit(bmap1, i) != bitmap_get_bit(bmap2, i)) return 0;
-  }
-
-  return 1;
+  byte mask = _bitmap_trailing_mask(bmap1.size);
+  return (mask == 0) || ((bytes1[full_bytes] ^ bytes2[full_bytes]) & mask) == 0;
 }
 
 // Get the negation (i.e. zeros and ones swapped) of `bmap`
 bitmap bitmap_not(bitmap bmap) {
   bitmap result = bitmap_init_zeros(bmap.size);
+  bitmap_not_into(&result, bmap);
 
-  // Invert each byte individually
-  for (int i = 0; i < bmap.size / BYTE_SIZE; i++) {
-    bitmap_set_byte(&result, i, ~bmap.map[i]);
-  }
+  return result;
+}
 
-  // Then invert bits in the trailing byte
-  for (int i = BYTE_SIZE * (bmap.size / BYTE_SIZE); i < bmap.size; i++) {
-    bitmap_set_bit(&result, i, 1 - bitmap_get_bit(bmap, i));
-  }
+// Store the negation of `bmap` in `dest`, which must be the same size and may be `bmap` itself
+void bitmap_not_into(bitmap *dest, bitmap bmap) {
+  _bitmap_check_destination(dest, bmap.size);
 
-  return result;
+  byte *dest_bytes = bitmap_bytes(dest);
+  const byte *bytes = bitmap_bytes(&bmap);
+  int full_bytes = bmap.size / BYTE_SIZE;
+  _bitmap_bytes_not(dest_bytes, bytes, full_bytes);
+
+  // Bits past the end are kept clear
+  byte mask = _bitmap_trailing_mask(bmap.size);
+  if (mask != 0) dest_bytes[full_bytes] = ~bytes[full_bytes] & mask;
 }
 
 // Return the result of `bmap1` `operation` `bmap2`, where `operation` is selected from OR, AND or XOR
 bitmap _bitmap_dual_operator(bitmap bmap1, bitmap bmap2, DualOperator operation) {
+  bitmap result = bitmap_init_zeros(bmap1.size);
+  _bitmap_dual_operator_into(&result, bmap1, bmap2, operation);
+
+  return result;
+}
+
+// Store the result of `bmap1` `operation` `bmap2` in `dest`, which must be the same size and may be either input.
+// Each byte is read before it is written, so working in place is safe
+void _bitmap_dual_operator_into(bitmap *dest, bitmap bmap1, bitmap bmap2, DualOperator operation) {
   if (bmap1.size != bmap2.size) {
     fprintf(stderr, "Cannot perform operation on differently sized bitmaps (%d and %d).\n", bmap1.size,
             bmap2.size);
+    exit(EXIT_FAILURE);
   }
-
-  bitmap result = bitmap_init_zeros(bmap1.size);
-
-  // Do the operation on bytes first
-  for (int i = 0; i < bmap1.size / BYTE_SIZE; i++) {
-    switch (operation) {
-      case OR:
-        bitmap_set_byte(&result, i, bmap1.map[i] | bmap2.map[i]);
-        break;
-      case AND:
-        bitmap_set_byte(&result, i, bmap1.map[i] & bmap2.map[i]);
-        break;
-      case XOR:
-        bitmap_set_byte(&result, i, bmap1.map[i] ^ bmap2.map[i]);
-        break;
-    }
-  }
-
-  // Then on the trailing bits
-  for (int i = BYTE_SIZE * (bmap1.size / BYTE_SIZE); i < bmap1.size; i++) {
-    switch (operation) {
-      case OR:
-        bitmap_set_bit(&result, i, bitmap_get_bit(bmap1, i) | bitmap_get_bit(bmap2, i));
-        break;
-      case AND:
-        bitmap_set_bit(&result, i, bitmap_get_bit(bmap1, i) & bitmap_get_bit(bmap2, i));
-        break;
-      case XOR:
-        bitmap_set_bit(&result, i, bitmap_get_bit(bmap1, i) ^ bitmap_get_bit(bmap2, i));
-        break;
-    }
+  _bitmap_check_destination(dest, bmap1.size);
+
+  byte *dest_bytes = bitmap_bytes(dest);
+  const byte *bytes1 = bitmap_bytes(&bmap1);
+  const byte *bytes2 = bitmap_bytes(&bmap2);
+  int full_bytes = bmap1.size / BYTE_SIZE;
+  _bitmap_bytes_operator(dest_bytes, bytes1, bytes2, full_bytes, operation);
+
+  // Then the trailing bits, through a one-byte kernel call so the operator is still only switched on once. Bits
+  // past the end are kept clear
+  byte mask = _bitmap_trailing_mask(bmap1.size);
+  if (mask != 0) {
+    _bitmap_bytes_operator_scalar(dest_bytes + full_bytes, bytes1 + full_bytes, bytes2 + full_bytes, 1, operation);
+    dest_bytes[full_bytes] &= mask;
   }
-
-  return result;
 }
 
 // Get the bitmap corresponding to `bmap1` OR `bmap2`
@@ -199,65 +295,95 @@ bitmap bitmap_and(bitmap bmap1, bitmap bmap2) { return _bitmap_dual_operator(bma
 // Get the bitmap corresponding to `bmap1` XOR `bmap2`
 bitmap bitmap_xor(bitmap bmap1, bitmap bmap2) { return _bitmap_dual_operator(bmap1, bmap2, XOR); }
 
+// Store `bmap1` OR `bmap2` in `dest`
+void bitmap_or_into(bitmap *dest, bitmap bmap1, bitmap bmap2) {
+  _bitmap_dual_operator_into(dest, bmap1, bmap2, OR);
+}
+
+// Store `bmap1` AND `bmap2` in `dest`
+void bitmap_and_into(bitmap *dest, bitmap bmap1, bitmap bmap2) {
+  _bitmap_dual_operator_into(dest, bmap1, bmap2, AND);
+}
+
+// Store `bmap1` XOR `bmap2` in `dest`
+void bitmap_xor_into(bitmap *dest, bitmap bmap1, bitmap bmap2) {
+  _bitmap_dual_operator_into(dest, bmap1, bmap2, XOR);
+}
+
 // Get the bitmap that is a left shift of `count` bits of `bmap`
 bitmap bitmap_lshift(bitmap bmap, int count) {
-  // Handle negative counts by just passsing to the other method
-  if (count < 0) return bitmap_rshift(bmap, -count);
-
   bitmap result = bitmap_init_zeros(bmap.size);
-
-  for (int i = count; i < bmap.size; i++) {
-    bitmap_set_bit(&result, i - count, bitmap_get_bit(bmap, i));
-  }
+  bitmap_lshift_into(&result, bmap, count);
 
   return result;
 }
 
+// Store the left shift of `count` bits of `bmap` in `dest`, which must be the same size and may be `bmap` itself
+void bitmap_lshift_into(bitmap *dest, bitmap bmap, int count) {
+  _bitmap_check_destination(dest, bmap.size);
+  _bitmap_shift_into(dest, bmap, count);  // Negative counts shift the other way
+}
+
 // Get the bitmap that is a right shift of `count` bits of `bmap`
 bitmap bitmap_rshift(bitmap bmap, int count) {
-  if (count < 0) return bitmap_lshift(bmap, -count);
-
   bitmap result = bitmap_init_zeros(bmap.size);
-
-  for (int i = count; i < bmap.size; i++) {
-    bitmap_set_bit(&result, i, bitmap_get_bit(bmap, i - count));
-  }
+  bitmap_rshift_into(&result, bmap, count);
 
   return result;
 }
 
+// Store the right shift of `count` bits of `bmap` in `dest`, which must be the same size and may be `bmap` itself
+void bitmap_rshift_into(bitmap *dest, bitmap bmap, int count) {
+  _bitmap_check_destination(dest, bmap.size);
+  _bitmap_shift_into(dest, bmap, -count);
+}
+
 // Get the bitmap that is a left rotation of `count` bits of `bmap`
 bitmap bitmap_lrotate(bitmap bmap, int count) {
-  if (count < 0) return bitmap_rrotate(bmap, -count);
+  bitmap result = bitmap_init_zeros(bmap.size);
+  bitmap_lrotate_into(&result, bmap, count);
 
-  count = count % bmap.size;  // This method requires count to be between 0 and the size of the bitmap
+  return result;
+}
 
-  bitmap lshifted = bitmap_lshift(bmap, count);              // Bits shifted left
-  bitmap rshifted = bitmap_rshift(bmap, bmap.size - count);  // Wrapped around bits
+// Store the left rotation of `count` bits of `bmap` in `dest`, which must be the same size and may be `bmap`
+// itself
+void bitmap_lrotate_into(bitmap *dest, bitmap bmap, int count) {
+  _bitmap_check_destination(dest, bmap.size);
+  if (bmap.size == 0) return;
 
-  bitmap result = bitmap_or(lshifted, rshifted);  // Get both sets of bits
+  count = ((count % bmap.size) + bmap.size) % bmap.size;  // Between 0 and the size of the bitmap, even if negative
 
-  bitmap_free(&lshifted);
-  bitmap_free(&rshifted);
+  // Words wrap around, so rotating a heap bitmap in place needs a copy of the source. Inline bitmaps are passed by
+  // value, so `bmap` is already a copy
+  bitmap source = (dest->map != NULL && dest->map == bmap.map) ? bitmap_copy(bmap) : bmap;
 
-  return result;
+  // Each word is the bits shifted left, combined with the bits that wrap around from the start
+  for (int i = 0; i < _full_words_needed(bmap.size); i++) {
+    _bitmap_set_word(dest, i, _bitmap_shifted_word(source, i, count) |
+                                  _bitmap_shifted_word(source, i, count - bmap.size));
+  }
+
+  if (source.map != bmap.map) bitmap_free(&source);
 }
 
 // Get the bitmap that is a right rotation of `count` bits of `bmap`
 bitmap bitmap_rrotate(bitmap bmap, int count) {
-  if (count < 0) return bitmap_lrotate(bmap, -count);
-
-  count = count % bmap.size;  // This method requires count to be between 0 and the size of the bitmap
-
-  bitmap rshifted = bitmap_rshift(bmap, count);              // Bits shifted right
-  bitmap lshifted = bitmap_lshift(bmap, bmap.size - count);  // Wrapped around bits
+  bitmap result = bitmap_init_zeros(bmap.size);
+  bitmap_rrotate_into(&result, bmap, count);
 
-  bitmap result = bitmap_or(lshifted, rshifted);  // Get both sets of bits
+  return result;
+}
 
-  bitmap_free(&lshifted);
-  bitmap_free(&rshifted);
+// Store the right rotation of `count` bits of `bmap` in `dest`, which must be the same size and may be `bmap`
+// itself
+void bitmap_rrotate_into(bitmap *dest, bitmap bmap, int count) {
+  if (bmap.size == 0) {
+    _bitmap_check_destination(dest, bmap.size);
+    return;
+  }
 
-  return result;
+  bitmap_lrotate_into(dest, bmap, bmap.size - count % bmap.size);
 }
 
 // Get the sub-bitmap of `bmap` from `start_index` (inclusive) to `end_index` (exclusive)
@@ -268,115 +394,239 @@ bitmap bitmap_slice(bitmap bmap, int start_index, int end_index) {
   }
 
   bitmap result = bitmap_init_zeros(end_index - start_index);
+  bitmap_slice_into(&result, bmap, start_index, end_index);
 
-  for (int i = start_index; i < end_index; i++) {
-    bitmap_set_bit(&result, i - start_index, bitmap_get_bit(bmap, i));
+  return result;
+}
+
+// Store the sub-bitmap of `bmap` from `start_index` (inclusive) to `end_index` (exclusive) in `dest`, which must
+// be of size `end_index - start_index`
+void bitmap_slice_into(bitmap *dest, bitmap bmap, int start_index, int end_index) {
+  if (start_index < 0 || end_index > bmap.size || end_index < start_index) {
+    fprintf(stderr, "Slice [%d:%d] is invalid for bitmap of size %d.\n", start_index, end_index, bmap.size);
+    exit(EXIT_FAILURE);
   }
+  _bitmap_check_destination(dest, end_index - start_index);
 
-  return result;
+  // Bits after `end_index` are cut off when the words are stored. Words are only read from at or after the word
+  // being written, so this is safe even if `dest` shares memory with `bmap`
+  for (int i = 0; i < _full_words_needed(dest->size); i++) {
+    _bitmap_set_word(dest, i, _bitmap_shifted_word(bmap, i, start_index));
+  }
 }
 
 // Return a copy of `bmap`
 bitmap bitmap_copy(bitmap bmap) {
   bitmap result = bitmap_init_zeros(bmap.size);
-  memcpy(result.map, bmap.map, _full_bytes_needed(bmap.size));
+  bitmap_copy_into(&result, bmap);
 
   return result;
 }
 
+// Copy the bits of `bmap` into `dest`, which must be the same size
+void bitmap_copy_into(bitmap *dest, bitmap bmap) {
+  _bitmap_check_destination(dest, bmap.size);
+  memmove(bitmap_bytes(dest), bitmap_bytes(&bmap), _full_bytes_needed(bmap.size));
+}
+
 // Get the choice bitmap, defined as follows: for each bit, a one in `choices` means take the bit in `bmap1`,
 // whereas a zero in `choices` means take the bit in `bmap2`
 bitmap bitmap_choose(bitmap choices, bitmap bmap1, bitmap bmap2) {
+  bitmap result = bitmap_init_zeros(choices.size);
+  bitmap_choose_into(&result, choices, bmap1, bmap2);
+
+  return result;
+}
+
+// Store the choice bitmap of `choices`, `bmap1` and `bmap2` in `dest`, which must be the same size and may be any
+// of the inputs
+void bitmap_choose_into(bitmap *dest, bitmap choices, bitmap bmap1, bitmap bmap2) {
   if (choices.size != bmap1.size || choices.size != bmap2.size) {
     fprintf(stderr, "The three bitmaps must be of the same size (not %d, %d and %d).\n", choices.size, bmap1.size,
             bmap2.size);
     exit(EXIT_FAILURE);
   }
+  _bitmap_check_destination(dest, choices.size);
 
-  bitmap result = bitmap_init_zeros(choices.size);
-  for (int i = 0; i < choices.size; i++) {
-    switch (bitmap_get_bit(choices, i)) {
-      case 1:
-        bitmap_set_bit(&result, i, bitmap_get_bit(bmap1, i));
-        break;
-      case 0:
-        bitmap_set_bit(&result, i, bitmap_get_bit(bmap2, i));
-        break;
-    }
+  for (int i = 0; i < _full_words_needed(choices.size); i++) {
+    u64 choice_word = _bitmap_get_word(choices, i);
+    u64 word1 = _bitmap_get_word(bmap1, i), word2 = _bitmap_get_word(bmap2, i);
+    _bitmap_set_word(dest, i, (choice_word & word1) | (~choice_word & word2));
   }
-
-  return result;
 }
 
 // Get the bitmap where the bit in each index is the bit that appears most often in that index in the three inputs
 bitmap bitmap_majority(bitmap bmap1, bitmap bmap2, bitmap bmap3) {
+  bitmap result = bitmap_init_zeros(bmap1.size);
+  bitmap_majority_into(&result, bmap1, bmap2, bmap3);
+
+  return result;
+}
+
+// Store the majority bitmap of `bmap1`, `bmap2` and `bmap3` in `dest`, which must be the same size and may be any
+// of the inputs
+void bitmap_majority_into(bitmap *dest, bitmap bmap1, bitmap bmap2, bitmap bmap3) {
   if (bmap1.size != bmap2.size || bmap1.size != bmap3.size) {
     fprintf(stderr, "The three bitmaps must be of the same size (not %d, %d and %d).\n", bmap1.size, bmap2.size,
             bmap3.size);
     exit(EXIT_FAILURE);
   }
+  _bitmap_check_destination(dest, bmap1.size);
 
+  for (int i = 0; i < _full_words_needed(bmap1.size); i++) {
+    u64 word1 = _bitmap_get_word(bmap1, i), word2 = _bitmap_get_word(bmap2, i), word3 = _bitmap_get_word(bmap3, i);
+    _bitmap_set_word(dest, i, (word1 & word2) | (word3 & (word1 | word2)));
+  }
+}
+
+// Add two bitmaps of equal size, truncating the result to fit into the same size
+bitmap bitmap_add_mod(bitmap bmap1, bitmap bmap2) {
   bitmap result = bitmap_init_zeros(bmap1.size);
+  bitmap_add_mod_into(&result, bmap1, bmap2);
 
-  for (int i = 0; i < bmap1.size; i++) {
-    if (bitmap_get_bit(bmap1, i) + bitmap_get_bit(bmap2, i) + bitmap_get_bit(bmap3, i) > 1) {
-      bitmap_set_bit(&result, i, 1);
-    }
-  }
+  return result;
+}
+
+// Store the sum of `bmap1` and `bmap2`, truncated to the same size, in `dest`, which must be the same size and may
+// be either input. Each position is read before it is written, so working in place is safe
+void bitmap_add_mod_into(bitmap *dest, bitmap bmap1, bitmap bmap2) { bitmap_add_into(dest, bmap1, bmap2); }
+
+// Get `bmap1` minus `bmap2`, for bitmaps of equal size read as unsigned numbers, wrapping around below zero
+bitmap bitmap_sub_mod(bitmap bmap1, bitmap bmap2) {
+  bitmap result = bitmap_init_zeros(bmap1.size);
+  bitmap_sub_into(&result, bmap1, bmap2);
 
   return result;
 }
 
-// Add two bitmaps of equal size, truncating the result to fit into the same size
-bitmap bitmap_add_mod(bitmap bmap1, bitmap bmap2) {
+// Arithmetic reads a bitmap as an unsigned number with bit 0 the most significant, and works on 64-bit words from
+// `_bitmap_get_word`. A bitmap whose size isn't a multiple of 64 has its last word padded with zeros at the
+// bottom, which is the number shifted up by the padding. Adding, subtracting, comparing and multiplying commute
+// with that shift, and `_bitmap_set_word` clears the padding again, so the words can be used as they are
+
+// Store the sum of `bmap1` and `bmap2`, truncated to the same size, in `dest`, which must be the same size and may
+// be either input. Returns the carry out of the most significant bit
+int bitmap_add_into(bitmap *dest, bitmap bmap1, bitmap bmap2) {
+  _bitmap_check_arithmetic(dest, bmap1, bmap2);
+
+  u64 carry = 0;
+  for (int i = _full_words_needed(bmap1.size) - 1; i >= 0; i--) {
+    u64 sum;
+    u64 carry1 = __builtin_add_overflow(_bitmap_get_word(bmap1, i), _bitmap_get_word(bmap2, i), &sum);
+    u64 carry2 = __builtin_add_overflow(sum, carry, &sum);
+    _bitmap_set_word(dest, i, sum);
+    carry = carry1 | carry2;
+  }
+
+  return carry;
+}
+
+// Store `bmap1` minus `bmap2` in `dest`, wrapping around below zero. `dest` must be the same size as the inputs
+// and may be either of them. Returns 1 if `bmap2` was larger, so the result wrapped
+int bitmap_sub_into(bitmap *dest, bitmap bmap1, bitmap bmap2) {
+  _bitmap_check_arithmetic(dest, bmap1, bmap2);
+
+  u64 borrow = 0;
+  for (int i = _full_words_needed(bmap1.size) - 1; i >= 0; i--) {
+    u64 difference;
+    u64 borrow1 = __builtin_sub_overflow(_bitmap_get_word(bmap1, i), _bitmap_get_word(bmap2, i), &difference);
+    u64 borrow2 = __builtin_sub_overflow(difference, borrow, &difference);
+    _bitmap_set_word(dest, i, difference);
+    borrow = borrow1 | borrow2;
+  }
+
+  return borrow;
+}
+
+// Compare bitmaps of equal size as unsigned numbers, returning -1, 0 or 1 as `bmap1` is less than, equal to or
+// greater than `bmap2`
+int bitmap_compare(bitmap bmap1, bitmap bmap2) {
   if (bmap1.size != bmap2.size) {
-    fprintf(stderr, "Can only add two bitmaps of the same size (not %d and %d).\n", bmap1.size, bmap2.size);
+    fprintf(stderr, "Can only compare two bitmaps of the same size (not %d and %d).\n", bmap1.size, bmap2.size);
     exit(EXIT_FAILURE);
   }
 
-  bitmap result = bitmap_init_zeros(bmap1.size);
-  int carry = 0;
+  for (int i = 0; i < _full_words_needed(bmap1.size); i++) {
+    u64 word1 = _bitmap_get_word(bmap1, i);
+    u64 word2 = _bitmap_get_word(bmap2, i);
+    if (word1 != word2) return (word1 < word2) ? -1 : 1;
+  }
+
+  return 0;
+}
 
-  // First add individual bits on the trailing byte
-  for (int i = bmap1.size - 1; i >= BYTE_SIZE * (bmap1.size / BYTE_SIZE); i--) {
-    int b1 = bitmap_get_bit(bmap1, i);
-    int b2 = bitmap_get_bit(bmap2, i);
+// Store `bmap` times `multiplier`, truncated to the same size, in `dest`, which must be the same size and may be
+// `bmap`. Returns the part of the product that didn't fit
+u64 bitmap_mul_word_into(bitmap *dest, bitmap bmap, u64 multiplier) {
+  _bitmap_check_arithmetic(dest, bmap, bmap);
 
-    bitmap_set_bit(&result, i, b1 ^ b2 ^ carry);
-    carry = b1 & b2;
+  u64 carry = 0;
+  for (int i = _full_words_needed(bmap.size) - 1; i >= 0; i--) {
+    unsigned __int128 product = (unsigned __int128)_bitmap_get_word(bmap, i) * multiplier + carry;
+    _bitmap_set_word(dest, i, (u64)product);
+    carry = product >> WORD_SIZE;
   }
 
-  // For the fully used bytes, do addition on each byte at a time
-  for (int i = bmap1.size / BYTE_SIZE - 1; i >= 0; i--) {
-    int b1 = bmap1.map[i];
-    int b2 = bmap2.map[i];
+  return carry;
+}
 
-    bitmap_set_byte(&result, i, (b1 + b2 + carry) % BYTE_COMBINATIONS);
-    carry = ((b1 + b2 + carry) >= BYTE_COMBINATIONS);
+// Store `bmap` divided by `divisor`, rounded down, in `dest`, which must be the same size and may be `bmap`.
+// Returns the remainder
+u64 bitmap_div_word_into(bitmap *dest, bitmap bmap, u64 divisor) {
+  if (divisor == 0) {
+    fprintf(stderr, "Cannot divide a bitmap by zero.\n");
+    exit(EXIT_FAILURE);
+  }
+  _bitmap_check_arithmetic(dest, bmap, bmap);
+
+  // Long division of the padded number, most significant word first
+  int num_words = _full_words_needed(bmap.size);
+  u64 remainder = 0;
+  u64 last_quotient = 0;
+  for (int i = 0; i < num_words; i++) {
+    unsigned __int128 dividend = ((unsigned __int128)remainder << WORD_SIZE) | _bitmap_get_word(bmap, i);
+    last_quotient = dividend / divisor;
+    remainder = dividend % divisor;
+    _bitmap_set_word(dest, i, last_quotient);
   }
 
-  return result;
+  // Dividing the number shifted up by `padding` gives the true quotient shifted up, plus padding bits that are
+  // cut off when stored. Those bits are (true remainder << padding) / divisor, which recovers the true remainder
+  int padding = num_words * WORD_SIZE - bmap.size;
+  if (padding == 0 || num_words == 0) return remainder;
+
+  u64 padding_bits = last_quotient & ((1ULL << padding) - 1);
+  return (u64)((((unsigned __int128)padding_bits * divisor) + remainder) >> padding);
 }
 
 // Count the number of leading zeros in `bmap`
 int bitmap_leading_zeros(bitmap bmap) {
-  // First count how many bytes are fully zeroed
-  int zeroed_bytes = 0;
-  while (bmap.map[zeroed_bytes] == 0) {
-    zeroed_bytes++;
-    // For a non-multiple-of-8 sized bitmap, there could be ones in the final byte but outside of the bitmap. In
-    // this scenario, the method won't return here, but the next part will ensure the correct result is given
-    if (zeroed_bytes == _full_bytes_needed(bmap.size)) return bmap.size;
+  // Bits past the end read as zero, so the first set bit found is always inside the bitmap
+  for (int i = 0; i < _full_words_needed(bmap.size); i++) {
+    u64 word = _bitmap_get_word(bmap, i);
+    if (word != 0) return i * WORD_SIZE + __builtin_clzll(word);
   }
 
-  // For the final byte, count the zeros individually
-  int zeroed_bits = zeroed_bytes * BYTE_SIZE;
-  while (zeroed_bits < (zeroed_bytes + 1) * BYTE_SIZE && zeroed_bits < bmap.size) {
-    if (bitmap_get_bit(bmap, zeroed_bits) != 0) break;
-    zeroed_bits++;
-  }
+  return bmap.size;
+}
+
+// Get the number of set bits in `bmap`
+int bitmap_popcount(bitmap bmap) {
+  int count = 0;
+  for (int i = 0; i < _full_words_needed(bmap.size); i++) count += __builtin_popcountll(_bitmap_get_word(bmap, i));
 
-  return zeroed_bits;
+  return count;
+}
+
+// Get the index of the first set bit of `bmap` at or after `start_index`, or -1 if there isn't one. Iterating over
+// the set bits with this skips a clear word in one step
+int bitmap_find_next_set(bitmap bmap, int start_index) {
+  return _bitmap_find_next(bmap, start_index, 0);
+}
+
+// Get the index of the first clear bit of `bmap` at or after `start_index`, or -1 if there isn't one
+int bitmap_find_next_clear(bitmap bmap, int start_index) {
+  return _bitmap_find_next(bmap, start_index, 1);
 }
 
 // Store `bmap` as a string of zeros and ones in `buffer`
@@ -405,8 +655,10 @@ void bitmap_string_hex(bitmap bmap, char *buffer, int buffer_size) {
     exit(EXIT_FAILURE);
   }
 
-  for (int i = 0; i < buffer_size_required - 1; i += 2) {
-    sprintf(buffer + i, "%02x", bmap.map[i / 2]);
+  const byte *bytes = bitmap_bytes(&bmap);
+  for (int i = 0; i < buffer_size_required / 2; i++) {
+    buffer[2 * i] = HEX_DIGITS[bytes[i] >> 4];
+    buffer[2 * i + 1] = HEX_DIGITS[bytes[i] & 0xF];
   }
 
   buffer[buffer_size_required - 1] = '\0';
@@ -430,7 +682,7 @@ void bitmap_print_bin_on_line(bitmap bmap) {
 // allocated bits in the final byte
 void bitmap_print_hex(bitmap bmap) {
   for (int i = 0; i < _full_bytes_needed(bmap.size); i++) {
-    printf("%02x", bmap.map[i]);
+    printf("%02x", bitmap_bytes(&bmap)[i]);
   }
 }
 
@@ -443,7 +695,7 @@ void bitmap_print_hex_on_line(bitmap bmap) {
 // Print the bitmap in denary form
 void bitmap_print_den(bitmap bmap) {
   for (int i = 0; i < _full_bytes_needed(bmap.size); i++) {
-    printf("%03d ", bmap.map[i]);
+    printf("%03d ", bitmap_bytes(&bmap)[i]);
   }
 }
 
@@ -453,12 +705,504 @@ void bitmap_print_den_on_line(bitmap bmap) {
   printf("\n");
 }
 
-// Free the memory allocated to `bmap`
+// Free the memory allocated to `bmap`. This is safe for inline bitmaps, which have nothing to free
 void bitmap_free(bitmap *bmap) {
   if (bmap->map == NULL) return;
-  free(bmap->map);
+  if (bmap->owns_map) free(bmap->map);
   bmap->map = NULL;
+  bmap->owns_map = 0;
+}
+
+// Build a rank/select directory over `bmap`, which borrows its bits, so it must outlive the directory
+bitmap_rank_index bitmap_rank_index_init(bitmap bmap) {
+  int num_words = _full_words_needed(bmap.size);
+  int words_per_block = RANK_BLOCK_BITS / WORD_SIZE;
+  int blocks_per_superblock = RANK_SUPERBLOCK_BITS / RANK_BLOCK_BITS;
+  int num_blocks = (bmap.size + RANK_BLOCK_BITS - 1) / RANK_BLOCK_BITS;
+  int num_superblocks = (num_blocks + blocks_per_superblock - 1) / blocks_per_superblock;
+  int num_ones = bitmap_popcount(bmap);
+  int num_samples = (num_ones + SELECT_SAMPLE_RATE - 1) / SELECT_SAMPLE_RATE;
+
+  // The bits stay with `bmap`, and an inline bitmap is copied by value anyway
+  bmap.owns_map = 0;
+  bitmap_rank_index index = {bmap, malloc((num_superblocks + 1) * sizeof *index.superblock_ranks),
+                             malloc((num_blocks + 1) * sizeof *index.block_ranks),
+                             malloc((num_samples + 1) * sizeof *index.select_samples), num_blocks, num_ones};
+  if (!index.superblock_ranks || !index.block_ranks || !index.select_samples) {
+    fprintf(stderr, "Failed to allocate memory for rank index.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int ones = 0;
+  int num_sampled = 0;
+  for (int i = 0; i < num_words; i++) {
+    int block = i / words_per_block;
+    if (i % words_per_block == 0) {
+      if (block % blocks_per_superblock == 0) index.superblock_ranks[block / blocks_per_superblock] = ones;
+      index.block_ranks[block] = ones - index.superblock_ranks[block / blocks_per_superblock];
+    }
+
+    // Sample the block of each set bit whose rank is a multiple of the rate
+    ones += __builtin_popcountll(_bitmap_get_word(index.bmap, i));
+    while (num_sampled < num_samples && num_sampled * SELECT_SAMPLE_RATE < ones) {
+      index.select_samples[num_sampled++] = block;
+    }
+  }
+
+  return index;
+}
+
+// Get the number of set bits before `position` in the bitmap of `index`, where `position` may be its size
+int bitmap_rank(bitmap_rank_index *index, int position) {
+  if (position < 0 || position > index->bmap.size) {
+    fprintf(stderr, "Position %d is out of range for bitmap of size %d.\n", position, index->bmap.size);
+    exit(EXIT_FAILURE);
+  }
+  if (position == index->bmap.size) return index->num_ones;
+
+  int block = position / RANK_BLOCK_BITS;
+  int rank = _bitmap_rank_before_block(index, block);
+
+  int last_word = position / WORD_SIZE;
+  for (int i = block * (RANK_BLOCK_BITS / WORD_SIZE); i < last_word; i++) {
+    rank += __builtin_popcountll(_bitmap_get_word(index->bmap, i));
+  }
+  if (position % WORD_SIZE != 0) {
+    rank += __builtin_popcountll(_bitmap_get_word(index->bmap, last_word) >> (WORD_SIZE - position % WORD_SIZE));
+  }
+
+  return rank;
+}
+
+// Get the position of the set bit with `rank` set bits before it in the bitmap of `index`, or -1 if there are not
+// that many set bits
+int bitmap_select(bitmap_rank_index *index, int rank) {
+  if (rank < 0 || rank >= index->num_ones) return -1;
+
+  // The bit is between this sample's block and the next one's, so binary search the blocks in between
+  int sample = rank / SELECT_SAMPLE_RATE;
+  int num_samples = (index->num_ones + SELECT_SAMPLE_RATE - 1) / SELECT_SAMPLE_RATE;
+  int low = index->select_samples[sample];
+  int high = (sample + 1 < num_samples) ? index->select_samples[sample + 1] : index->num_blocks - 1;
+  while (low < high) {
+    int middle = low + (high - low + 1) / 2;
+    if (_bitmap_rank_before_block(index, middle) <= rank) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+
+  int remaining = rank - _bitmap_rank_before_block(index, low);
+  for (int i = low * (RANK_BLOCK_BITS / WORD_SIZE);; i++) {
+    u64 word = _bitmap_get_word(index->bmap, i);
+    int count = __builtin_popcountll(word);
+    if (remaining < count) return i * WORD_SIZE + _select_in_word(word, remaining);
+    remaining -= count;
+  }
+}
+
+// Free the counts of `index`, leaving its bitmap alone
+void bitmap_rank_index_free(bitmap_rank_index *index) {
+  free(index->superblock_ranks);
+  free(index->block_ranks);
+  free(index->select_samples);
+  index->superblock_ranks = NULL;
+  index->block_ranks = NULL;
+  index->select_samples = NULL;
 }
 
 // Get the number of bytes needed to house a bitmap of `num_bits` (i.e. divide by 8 and round up)
 int _full_bytes_needed(int num_bits) { return (num_bits / BYTE_SIZE) + ((num_bits % BYTE_SIZE) != 0); }
+
+// Exit if `dest` can't hold the result of an operation, which is of size `size`
+void _bitmap_check_destination(bitmap *dest, int size) {
+  if (dest->size != size) {
+    fprintf(stderr, "Destination bitmap of size %d cannot hold a result of size %d.\n", dest->size, size);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Check that `bmap1` and `bmap2` are the same size as each other and `dest`, for an arithmetic operation
+void _bitmap_check_arithmetic(bitmap *dest, bitmap bmap1, bitmap bmap2) {
+  if (bmap1.size != bmap2.size) {
+    fprintf(stderr, "Can only do arithmetic on bitmaps of the same size (not %d and %d).\n", bmap1.size,
+            bmap2.size);
+    exit(EXIT_FAILURE);
+  }
+  _bitmap_check_destination(dest, bmap1.size);
+}
+
+// Get the number of 64-bit words needed to house a bitmap of `num_bits`
+int _full_words_needed(int num_bits) { return (num_bits / WORD_SIZE) + ((num_bits % WORD_SIZE) != 0); }
+
+// Get the word at word index `word_index` of `bmap`, i.e. bits 64 * `word_index` onwards, with the first bit as
+// the most significant so that words compare like the bitmap. Bits past the end of the bitmap (including any set
+// in the final allocated byte) read as zero, as do words out of range
+u64 _bitmap_get_word(bitmap bmap, int word_index) {
+  if (word_index < 0 || word_index >= _full_words_needed(bmap.size)) return 0;
+
+  int first_byte = word_index * WORD_BYTES;
+  int num_bytes = _full_bytes_needed(bmap.size) - first_byte;
+
+  const byte *bytes = bitmap_bytes(&bmap) + first_byte;
+  u64 word = 0;
+  if (num_bytes >= WORD_BYTES) {
+    memcpy(&word, bytes, WORD_BYTES);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+  } else {
+    for (int i = 0; i < num_bytes; i++) {
+      word |= (u64)bytes[i] << (WORD_SIZE - BYTE_SIZE * (i + 1));
+    }
+  }
+
+  int bits_past_end = (word_index + 1) * WORD_SIZE - bmap.size;
+  if (bits_past_end > 0) word &= ~0ULL << bits_past_end;
+
+  return word;
+}
+
+// Set the word at word index `word_index` of `bmap` to `word`, laid out as in `_bitmap_get_word`. Bits of `word`
+// past the end of the bitmap are dropped, and the rest of the final allocated byte is zeroed
+void _bitmap_set_word(bitmap *bmap, int word_index, u64 word) {
+  if (word_index < 0 || word_index >= _full_words_needed(bmap->size)) {
+    fprintf(stderr, "Word index %d is out of range for bitmap of size %d.\n", word_index, bmap->size);
+    exit(EXIT_FAILURE);
+  }
+
+  int first_byte = word_index * WORD_BYTES;
+  int num_bytes = _full_bytes_needed(bmap->size) - first_byte;
+
+  int bits_past_end = (word_index + 1) * WORD_SIZE - bmap->size;
+  if (bits_past_end > 0) word &= ~0ULL << bits_past_end;
+
+  byte *bytes = bitmap_bytes(bmap) + first_byte;
+  if (num_bytes >= WORD_BYTES) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    memcpy(bytes, &word, WORD_BYTES);
+  } else {
+    for (int i = 0; i < num_bytes; i++) bytes[i] = word >> (WORD_SIZE - BYTE_SIZE * (i + 1));
+  }
+}
+
+// Store `bmap` shifted left by `count` bits (or right, if `count` is negative) in `dest`, which should be the same
+// size. Each word is read from words at or after it when shifting left, and at or before it when shifting right,
+// so the words are visited in the order that leaves the source intact if `dest` shares memory with `bmap`
+void _bitmap_shift_into(bitmap *dest, bitmap bmap, int count) {
+  int num_words = _full_words_needed(bmap.size);
+
+  if (count >= 0) {
+    for (int i = 0; i < num_words; i++) _bitmap_set_word(dest, i, _bitmap_shifted_word(bmap, i, count));
+  } else {
+    for (int i = num_words - 1; i >= 0; i--) _bitmap_set_word(dest, i, _bitmap_shifted_word(bmap, i, count));
+  }
+}
+
+// Get word `word_index` of `bmap` shifted left by `count` bits (or right, if `count` is negative), so bit i of the
+// result is bit i + `count` of `bmap`. The word is a funnel shift of the two source words it straddles
+u64 _bitmap_shifted_word(bitmap bmap, int word_index, int count) {
+  int word_shift = count / WORD_SIZE;
+  int bit_shift = count % WORD_SIZE;
+  if (bit_shift < 0) {
+    // Round towards negative infinity, so the bit shift is between 0 and 63
+    word_shift--;
+    bit_shift += WORD_SIZE;
+  }
+
+  u64 high = _bitmap_get_word(bmap, word_index + word_shift);
+  if (bit_shift == 0) return high;
+
+  u64 low = _bitmap_get_word(bmap, word_index + word_shift + 1);
+  return (high << bit_shift) | (low >> (WORD_SIZE - bit_shift));
+}
+
+// Take `bytes` bytes from `arena`, moving on to the next block (and allocating it if there isn't one big enough)
+// when the current one is full. Allocations are aligned to `BITMAP_ARENA_ALIGNMENT` bytes
+byte *_bitmap_arena_alloc(bitmap_arena *arena, int bytes) {
+  int aligned_bytes = (bytes + BITMAP_ARENA_ALIGNMENT - 1) / BITMAP_ARENA_ALIGNMENT * BITMAP_ARENA_ALIGNMENT;
+  bitmap_arena_block *block = arena->current;
+
+  if (block == NULL || block->used + aligned_bytes > block->capacity) {
+    bitmap_arena_block *next = (block == NULL) ? arena->first : block->next;
+
+    // Blocks after the current one are free since the last reset, but may be too small for a large bitmap
+    if (next == NULL || next->capacity < aligned_bytes) {
+      int capacity = (aligned_bytes > arena->block_capacity) ? aligned_bytes : arena->block_capacity;
+      bitmap_arena_block *new_block = malloc(sizeof *new_block + capacity);
+      if (!new_block) {
+        fprintf(stderr, "Failed to allocate memory for bitmap arena.\n");
+        exit(EXIT_FAILURE);
+      }
+
+      new_block->next = next;
+      new_block->capacity = capacity;
+      if (block == NULL) {
+        arena->first = new_block;
+      } else {
+        block->next = new_block;
+      }
+      next = new_block;
+    }
+
+    next->used = 0;
+    arena->current = block = next;
+  }
+
+  byte *result = block->bytes + block->used;
+  block->used += aligned_bytes;
+
+  return result;
+}
+
+// Get the mask of the bits in use in the trailing byte of a bitmap of size `size`, which is 0 if there isn't one
+byte _bitmap_trailing_mask(int size) {
+  return (size % BYTE_SIZE == 0) ? 0 : (byte)(0xFF << (BYTE_SIZE - size % BYTE_SIZE));
+}
+
+// Set the `num_bytes` bytes at `dest` to `operation` applied to the bytes at `bytes1` and `bytes2`, using the
+// widest kernel the CPU supports. `dest` may be either input, but mustn't overlap them otherwise
+void _bitmap_bytes_operator(byte *dest, const byte *bytes1, const byte *bytes2, int num_bytes,
+                            DualOperator operation) {
+#ifdef BITMAP_X86_SIMD
+  if (num_bytes >= AVX2_BYTES && __builtin_cpu_supports("avx2")) {
+    _bitmap_bytes_operator_avx2(dest, bytes1, bytes2, num_bytes, operation);
+  } else {
+    _bitmap_bytes_operator_sse2(dest, bytes1, bytes2, num_bytes, operation);
+  }
+#else
+  _bitmap_bytes_operator_scalar(dest, bytes1, bytes2, num_bytes, operation);
+#endif
+}
+
+// Set the `num_bytes` bytes at `dest` to the complements of the bytes at `bytes`, using the widest kernel the CPU
+// supports
+void _bitmap_bytes_not(byte *dest, const byte *bytes, int num_bytes) {
+#ifdef BITMAP_X86_SIMD
+  if (num_bytes >= AVX2_BYTES && __builtin_cpu_supports("avx2")) {
+    _bitmap_bytes_not_avx2(dest, bytes, num_bytes);
+  } else {
+    _bitmap_bytes_not_sse2(dest, bytes, num_bytes);
+  }
+#else
+  _bitmap_bytes_not_scalar(dest, bytes, num_bytes);
+#endif
+}
+
+// Get whether the `num_bytes` bytes at `bytes1` and `bytes2` are equal, using the widest kernel the CPU supports
+int _bitmap_bytes_equal(const byte *bytes1, const byte *bytes2, int num_bytes) {
+#ifdef BITMAP_X86_SIMD
+  if (num_bytes >= AVX2_BYTES && __builtin_cpu_supports("avx2")) {
+    return _bitmap_bytes_equal_avx2(bytes1, bytes2, num_bytes);
+  }
+  return _bitmap_bytes_equal_sse2(bytes1, bytes2, num_bytes);
+#else
+  return _bitmap_bytes_equal_scalar(bytes1, bytes2, num_bytes);
+#endif
+}
+
+// Portable kernel for `_bitmap_bytes_operator`, working a word at a time and then a byte at a time. It is also the
+// tail of the SIMD kernels
+void _bitmap_bytes_operator_scalar(byte *dest, const byte *bytes1, const byte *bytes2, int num_bytes,
+                                   DualOperator operation) {
+  int i = 0;
+  u64 word1, word2;
+
+  switch (operation) {
+    case OR:
+      for (; i + WORD_BYTES <= num_bytes; i += WORD_BYTES) {
+        memcpy(&word1, bytes1 + i, WORD_BYTES);
+        memcpy(&word2, bytes2 + i, WORD_BYTES);
+        word1 |= word2;
+        memcpy(dest + i, &word1, WORD_BYTES);
+      }
+      for (; i < num_bytes; i++) dest[i] = bytes1[i] | bytes2[i];
+      break;
+    case AND:
+      for (; i + WORD_BYTES <= num_bytes; i += WORD_BYTES) {
+        memcpy(&word1, bytes1 + i, WORD_BYTES);
+        memcpy(&word2, bytes2 + i, WORD_BYTES);
+        word1 &= word2;
+        memcpy(dest + i, &word1, WORD_BYTES);
+      }
+      for (; i < num_bytes; i++) dest[i] = bytes1[i] & bytes2[i];
+      break;
+    case XOR:
+      for (; i + WORD_BYTES <= num_bytes; i += WORD_BYTES) {
+        memcpy(&word1, bytes1 + i, WORD_BYTES);
+        memcpy(&word2, bytes2 + i, WORD_BYTES);
+        word1 ^= word2;
+        memcpy(dest + i, &word1, WORD_BYTES);
+      }
+      for (; i < num_bytes; i++) dest[i] = bytes1[i] ^ bytes2[i];
+      break;
+  }
+}
+
+// Portable kernel for `_bitmap_bytes_not`
+void _bitmap_bytes_not_scalar(byte *dest, const byte *bytes, int num_bytes) {
+  int i = 0;
+  u64 word;
+
+  for (; i + WORD_BYTES <= num_bytes; i += WORD_BYTES) {
+    memcpy(&word, bytes + i, WORD_BYTES);
+    word = ~word;
+    memcpy(dest + i, &word, WORD_BYTES);
+  }
+  for (; i < num_bytes; i++) dest[i] = ~bytes[i];
+}
+
+// Portable kernel for `_bitmap_bytes_equal`
+int _bitmap_bytes_equal_scalar(const byte *bytes1, const byte *bytes2, int num_bytes) {
+  return memcmp(bytes1, bytes2, num_bytes) == 0;
+}
+
+#ifdef BITMAP_X86_SIMD
+// SSE2 kernel for `_bitmap_bytes_operator`. SSE2 is part of x86-64, so this needs no CPU check
+void _bitmap_bytes_operator_sse2(byte *dest, const byte *bytes1, const byte *bytes2, int num_bytes,
+                                 DualOperator operation) {
+  int i = 0;
+
+  switch (operation) {
+    case OR:
+      for (; i + SSE2_BYTES <= num_bytes; i += SSE2_BYTES) {
+        SSE2_STORE(dest, i, _mm_or_si128(SSE2_LOAD(bytes1, i), SSE2_LOAD(bytes2, i)));
+      }
+      break;
+    case AND:
+      for (; i + SSE2_BYTES <= num_bytes; i += SSE2_BYTES) {
+        SSE2_STORE(dest, i, _mm_and_si128(SSE2_LOAD(bytes1, i), SSE2_LOAD(bytes2, i)));
+      }
+      break;
+    case XOR:
+      for (; i + SSE2_BYTES <= num_bytes; i += SSE2_BYTES) {
+        SSE2_STORE(dest, i, _mm_xor_si128(SSE2_LOAD(bytes1, i), SSE2_LOAD(bytes2, i)));
+      }
+      break;
+  }
+
+  _bitmap_bytes_operator_scalar(dest + i, bytes1 + i, bytes2 + i, num_bytes - i, operation);
+}
+
+// SSE2 kernel for `_bitmap_bytes_not`
+void _bitmap_bytes_not_sse2(byte *dest, const byte *bytes, int num_bytes) {
+  int i = 0;
+  __m128i ones = _mm_set1_epi8(-1);
+
+  for (; i + SSE2_BYTES <= num_bytes; i += SSE2_BYTES) {
+    SSE2_STORE(dest, i, _mm_xor_si128(SSE2_LOAD(bytes, i), ones));
+  }
+
+  _bitmap_bytes_not_scalar(dest + i, bytes + i, num_bytes - i);
+}
+
+// SSE2 kernel for `_bitmap_bytes_equal`
+int _bitmap_bytes_equal_sse2(const byte *bytes1, const byte *bytes2, int num_bytes) {
+  int i = 0;
+
+  for (; i + SSE2_BYTES <= num_bytes; i += SSE2_BYTES) {
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(SSE2_LOAD(bytes1, i), SSE2_LOAD(bytes2, i))) != 0xFFFF) return 0;
+  }
+
+  return _bitmap_bytes_equal_scalar(bytes1 + i, bytes2 + i, num_bytes - i);
+}
+
+// AVX2 kernel for `_bitmap_bytes_operator`, only to be called if `__builtin_cpu_supports("avx2")`
+__attribute__((target("avx2"))) void _bitmap_bytes_operator_avx2(byte *dest, const byte *bytes1,
+                                                                 const byte *bytes2, int num_bytes,
+                                                                 DualOperator operation) {
+  int i = 0;
+
+  switch (operation) {
+    case OR:
+      for (; i + AVX2_BYTES <= num_bytes; i += AVX2_BYTES) {
+        AVX2_STORE(dest, i, _mm256_or_si256(AVX2_LOAD(bytes1, i), AVX2_LOAD(bytes2, i)));
+      }
+      break;
+    case AND:
+      for (; i + AVX2_BYTES <= num_bytes; i += AVX2_BYTES) {
+        AVX2_STORE(dest, i, _mm256_and_si256(AVX2_LOAD(bytes1, i), AVX2_LOAD(bytes2, i)));
+      }
+      break;
+    case XOR:
+      for (; i + AVX2_BYTES <= num_bytes; i += AVX2_BYTES) {
+        AVX2_STORE(dest, i, _mm256_xor_si256(AVX2_LOAD(bytes1, i), AVX2_LOAD(bytes2, i)));
+      }
+      break;
+  }
+
+  _bitmap_bytes_operator_scalar(dest + i, bytes1 + i, bytes2 + i, num_bytes - i, operation);
+}
+
+// AVX2 kernel for `_bitmap_bytes_not`, only to be called if `__builtin_cpu_supports("avx2")`
+__attribute__((target("avx2"))) void _bitmap_bytes_not_avx2(byte *dest, const byte *bytes, int num_bytes) {
+  int i = 0;
+  __m256i ones = _mm256_set1_epi8(-1);
+
+  for (; i + AVX2_BYTES <= num_bytes; i += AVX2_BYTES) {
+    AVX2_STORE(dest, i, _mm256_xor_si256(AVX2_LOAD(bytes, i), ones));
+  }
+
+  _bitmap_bytes_not_scalar(dest + i, bytes + i, num_bytes - i);
+}
+
+// AVX2 kernel for `_bitmap_bytes_equal`, only to be called if `__builtin_cpu_supports("avx2")`
+__attribute__((target("avx2"))) int _bitmap_bytes_equal_avx2(const byte *bytes1, const byte *bytes2,
+                                                             int num_bytes) {
+  int i = 0;
+
+  for (; i + AVX2_BYTES <= num_bytes; i += AVX2_BYTES) {
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(AVX2_LOAD(bytes1, i), AVX2_LOAD(bytes2, i))) != -1) return 0;
+  }
+
+  return _bitmap_bytes_equal_scalar(bytes1 + i, bytes2 + i, num_bytes - i);
+}
+#endif
+
+// Get the index of the first bit of `bmap` at or after `start_index` that is set, or clear if `find_clear` is 1,
+// or -1 if there isn't one. Bits are numbered from the most significant end of each word, so the first match in a
+// word is found by counting its leading zeros
+int _bitmap_find_next(bitmap bmap, int start_index, int find_clear) {
+  if (start_index < 0) {
+    fprintf(stderr, "Index %d is out of range for bitmap of size %d.\n", start_index, bmap.size);
+    exit(EXIT_FAILURE);
+  }
+  if (start_index >= bmap.size) return -1;
+
+  int word_index = start_index / WORD_SIZE;
+  u64 flip = find_clear ? ~0ULL : 0;
+  u64 word = (_bitmap_get_word(bmap, word_index) ^ flip) & (~0ULL >> (start_index % WORD_SIZE));
+
+  while (word == 0) {
+    if (++word_index >= _full_words_needed(bmap.size)) return -1;
+    word = _bitmap_get_word(bmap, word_index) ^ flip;
+  }
+
+  // Flipped bits past the end of the last word look clear, so may be found
+  int index = word_index * WORD_SIZE + __builtin_clzll(word);
+  return (index < bmap.size) ? index : -1;
+}
+
+// Get the number of set bits before block `block` of the bitmap of `index`
+int _bitmap_rank_before_block(bitmap_rank_index *index, int block) {
+  return index->superblock_ranks[block / (RANK_SUPERBLOCK_BITS / RANK_BLOCK_BITS)] + index->block_ranks[block];
+}
+
+// Get the position in `word`, from the most significant bit, of the set bit with `rank` set bits before it. The
+// word must have more than `rank` set bits
+int _select_in_word(u64 word, int rank) {
+  // Skip whole bytes, then clear the set bits before the one we want
+  int position = 0;
+  for (int count = __builtin_popcountll(word >> (WORD_SIZE - BYTE_SIZE)); rank >= count;
+       count = __builtin_popcountll(word >> (WORD_SIZE - BYTE_SIZE))) {
+    rank -= count;
+    word <<= BYTE_SIZE;
+    position += BYTE_SIZE;
+  }
+  for (; rank > 0; rank--) word &= ~(1ULL << (WORD_SIZE - 1 - __builtin_clzll(word)));
+
+  return position + __builtin_clzll(word);
+}
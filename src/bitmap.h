@@ -3,20 +3,81 @@
 
 #define BYTE_SIZE 8
 #define BYTE_COMBINATIONS 256
+#define WORD_SIZE 64
+#define WORD_BYTES (WORD_SIZE / BYTE_SIZE)
+#define BITMAP_INLINE_BITS 256
+#define BITMAP_ARENA_ALIGNMENT 8
+#define RANK_BLOCK_BITS 512
+#define RANK_SUPERBLOCK_BITS 65536
+#define SELECT_SAMPLE_RATE 4096
+#define SSE2_BYTES 16
+#define AVX2_BYTES 32
+
+// x86 builds get SSE2 and AVX2 kernels for the logical operators, with AVX2 chosen at run time if the CPU has it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define BITMAP_X86_SIMD 1
+#endif
 
 typedef unsigned char byte;
+typedef unsigned int u32;
 typedef unsigned long long u64;
 
 typedef enum DualOperator { OR, AND, XOR } DualOperator;
 
+// A sequence of `size` bits. Bitmaps of up to `BITMAP_INLINE_BITS` bits are stored in `inline_map`, with `map`
+// left NULL, and larger ones on the heap. `map` may also point at memory the bitmap doesn't own (a view, or a
+// bitmap from an arena), in which case `owns_map` is 0 and `bitmap_free` leaves it alone. Use `bitmap_bytes` to
+// get at the bits either way
 typedef struct bitmap {
   int size;
   byte *map;
+  int owns_map;
+  byte inline_map[BITMAP_INLINE_BITS / BYTE_SIZE];
 } bitmap;
 
+// A block of memory an arena hands out bitmaps from, in a list of blocks the arena keeps until it is freed
+typedef struct bitmap_arena_block {
+  struct bitmap_arena_block *next;
+  int capacity;
+  int used;
+  byte bytes[];
+} bitmap_arena_block;
+
+// A bump allocator for short-lived bitmaps. Bitmaps made in an arena are released all at once by
+// `bitmap_arena_reset`, which keeps the blocks for reuse, so a loop that resets its arena each time round stops
+// calling malloc once the arena has grown to fit. Blocks are allocated lazily, `block_capacity` bytes at a time
+typedef struct bitmap_arena {
+  bitmap_arena_block *first;
+  bitmap_arena_block *current;
+  int block_capacity;
+} bitmap_arena;
+
+// A rank/select directory over a bitmap, which must not change while the directory is in use. For every
+// `RANK_SUPERBLOCK_BITS` bits it stores the set bits before them, and for every `RANK_BLOCK_BITS` bits the set
+// bits before them within their superblock, which is about 3% on top of the bitmap. Counting the set bits before
+// any position then takes at most a block of popcounts. Finding the nth set bit starts from the block of the
+// nearest sample of every `SELECT_SAMPLE_RATE`th set bit
+typedef struct bitmap_rank_index {
+  bitmap bmap;
+  int *superblock_ranks;
+  unsigned short *block_ranks;
+  int *select_samples;
+  int num_blocks;
+  int num_ones;
+} bitmap_rank_index;
+
 bitmap bitmap_init_zeros(int size);
 bitmap bitmap_init_string(const char *string);
+bitmap bitmap_init_hex(const char *hex);
+int bitmap_parse_hex(const char *hex, bitmap *result);
 bitmap bitmap_init_number(u64 number, int bytes);
+byte *bitmap_bytes(bitmap *bmap);
+
+bitmap_arena bitmap_arena_init(int block_capacity);
+bitmap bitmap_init_zeros_in(bitmap_arena *arena, int size);
+bitmap bitmap_copy_in(bitmap_arena *arena, bitmap bmap);
+void bitmap_arena_reset(bitmap_arena *arena);
+void bitmap_arena_free(bitmap_arena *arena);
 
 int bitmap_get_bit(bitmap bmap, int index);
 void bitmap_set_bit(bitmap *bmap, int index, int new_value);
@@ -37,7 +98,32 @@ bitmap bitmap_copy(bitmap bmap);
 bitmap bitmap_choose(bitmap choices, bitmap bmap1, bitmap bmap2);
 bitmap bitmap_majority(bitmap bmap1, bitmap bmap2, bitmap bmap3);
 bitmap bitmap_add_mod(bitmap bmap1, bitmap bmap2);
+bitmap bitmap_sub_mod(bitmap bmap1, bitmap bmap2);
+
+void bitmap_not_into(bitmap *dest, bitmap bmap);
+void bitmap_or_into(bitmap *dest, bitmap bmap1, bitmap bmap2);
+void bitmap_and_into(bitmap *dest, bitmap bmap1, bitmap bmap2);
+void bitmap_xor_into(bitmap *dest, bitmap bmap1, bitmap bmap2);
+void bitmap_lshift_into(bitmap *dest, bitmap bmap, int count);
+void bitmap_rshift_into(bitmap *dest, bitmap bmap, int count);
+void bitmap_lrotate_into(bitmap *dest, bitmap bmap, int count);
+void bitmap_rrotate_into(bitmap *dest, bitmap bmap, int count);
+void bitmap_slice_into(bitmap *dest, bitmap bmap, int start_index, int end_index);
+void bitmap_copy_into(bitmap *dest, bitmap bmap);
+void bitmap_choose_into(bitmap *dest, bitmap choices, bitmap bmap1, bitmap bmap2);
+void bitmap_majority_into(bitmap *dest, bitmap bmap1, bitmap bmap2, bitmap bmap3);
+void bitmap_add_mod_into(bitmap *dest, bitmap bmap1, bitmap bmap2);
+
+int bitmap_add_into(bitmap *dest, bitmap bmap1, bitmap bmap2);
+int bitmap_sub_into(bitmap *dest, bitmap bmap1, bitmap bmap2);
+int bitmap_compare(bitmap bmap1, bitmap bmap2);
+u64 bitmap_mul_word_into(bitmap *dest, bitmap bmap, u64 multiplier);
+u64 bitmap_div_word_into(bitmap *dest, bitmap bmap, u64 divisor);
+
 int bitmap_leading_zeros(bitmap bmap);
+int bitmap_popcount(bitmap bmap);
+int bitmap_find_next_set(bitmap bmap, int start_index);
+int bitmap_find_next_clear(bitmap bmap, int start_index);
 
 void bitmap_string_bin(bitmap bmap, char *buffer, int buffer_size);
 void bitmap_string_hex(bitmap bmap, char *buffer, int buffer_size);
@@ -50,7 +136,43 @@ void bitmap_print_den_on_line(bitmap bmap);
 
 void bitmap_free(bitmap *bmap);
 
+bitmap_rank_index bitmap_rank_index_init(bitmap bmap);
+int bitmap_rank(bitmap_rank_index *index, int position);
+int bitmap_select(bitmap_rank_index *index, int rank);
+void bitmap_rank_index_free(bitmap_rank_index *index);
+
 int _full_bytes_needed(int num_bits);
+int _full_words_needed(int num_bits);
+u64 _bitmap_get_word(bitmap bmap, int word_index);
+void _bitmap_set_word(bitmap *bmap, int word_index, u64 word);
+u64 _bitmap_shifted_word(bitmap bmap, int word_index, int count);
 bitmap _bitmap_dual_operator(bitmap bmap1, bitmap bmap2, DualOperator operation);
+void _bitmap_dual_operator_into(bitmap *dest, bitmap bmap1, bitmap bmap2, DualOperator operation);
+void _bitmap_check_destination(bitmap *dest, int size);
+void _bitmap_check_arithmetic(bitmap *dest, bitmap bmap1, bitmap bmap2);
+void _bitmap_shift_into(bitmap *dest, bitmap bmap, int count);
+byte *_bitmap_arena_alloc(bitmap_arena *arena, int bytes);
+int _bitmap_find_next(bitmap bmap, int start_index, int find_clear);
+int _bitmap_rank_before_block(bitmap_rank_index *index, int block);
+int _select_in_word(u64 word, int rank);
+byte _bitmap_trailing_mask(int size);
+void _bitmap_bytes_operator(byte *dest, const byte *bytes1, const byte *bytes2, int num_bytes,
+                            DualOperator operation);
+void _bitmap_bytes_not(byte *dest, const byte *bytes, int num_bytes);
+int _bitmap_bytes_equal(const byte *bytes1, const byte *bytes2, int num_bytes);
+void _bitmap_bytes_operator_scalar(byte *dest, const byte *bytes1, const byte *bytes2, int num_bytes,
+                                   DualOperator operation);
+void _bitmap_bytes_not_scalar(byte *dest, const byte *bytes, int num_bytes);
+int _bitmap_bytes_equal_scalar(const byte *bytes1, const byte *bytes2, int num_bytes);
+#ifdef BITMAP_X86_SIMD
+void _bitmap_bytes_operator_sse2(byte *dest, const byte *bytes1, const byte *bytes2, int num_bytes,
+                                 DualOperator operation);
+void _bitmap_bytes_not_sse2(byte *dest, const byte *bytes, int num_bytes);
+int _bitmap_bytes_equal_sse2(const byte *bytes1, const byte *bytes2, int num_bytes);
+void _bitmap_bytes_operator_avx2(byte *dest, const byte *bytes1, const byte *bytes2, int num_bytes,
+                                 DualOperator operation);
+void _bitmap_bytes_not_avx2(byte *dest, const byte *bytes, int num_bytes);
+int _bitmap_bytes_equal_avx2(const byte *bytes1, const byte *bytes2, int num_bytes);
+#endif
 
 #endif
@@ -6,6 +6,12 @@
 #include "sha256.h"
 #include "blockchain.h"
 
+// Vector types for the column scans. GCC and Clang lower these to whatever SIMD the target supports
+typedef double double_vector __attribute__((vector_size(4 * sizeof(double))));
+typedef int int_vector __attribute__((vector_size(4 * sizeof(int))));
+typedef long long mask_vector __attribute__((vector_size(4 * sizeof(long long))));
+#define VECTOR_LENGTH 4
+
 static int transactions_count;
 
 // Get number of chars to hold `num` (NOT including null terminator)
@@ -36,6 +42,18 @@ int _num_chars_to_hold_block_serialisation(block blk) {
          U64_MAX_CHARS + strlen("\n\n");
 }
 
+// Clear the lowest set bit of `num`
+int _invert_lowest_one(int num) { return num & (num - 1); }
+
+// Get the index that the skip pointer of the node at `index` should point to. This is the same choice as Bitcoin
+// makes: it gives O(log n) ancestor lookups while keeping the pointers spread over all heights
+int _skip_index(int index) {
+  if (index < 2) return 0;
+
+  // Odd indices jump slightly less far than their even neighbours, so a walk can always land on the target
+  return (index & 1) ? _invert_lowest_one(_invert_lowest_one(index - 1)) + 1 : _invert_lowest_one(index);
+}
+
 // Get a new transaction
 transaction transaction_init(double amount, int payer_id, int payee_id) {
   if (amount <= 0) {
@@ -45,6 +63,11 @@ transaction transaction_init(double amount, int payer_id, int payee_id) {
   return (transaction){amount, payer_id, payee_id, transactions_count++};
 }
 
+// Make sure transactions initialised from now on get IDs after `transaction_id`, e.g. one from an earlier run
+void transaction_reserve_id(int transaction_id) {
+  if (transaction_id >= transactions_count) transactions_count = transaction_id + 1;
+}
+
 // Serialise a transaction, `trans` into `buffer`
 void transaction_serialise(transaction trans, char *buffer, int buffer_size) {
   int buffer_size_required = _num_chars_to_hold_transaction_serialisation(trans);
@@ -65,6 +88,192 @@ void transaction_print_on_line(transaction trans) {
          trans.transaction_id);
 }
 
+// Initialise an empty set of transaction columns
+transaction_columns transaction_columns_init() {
+  return (transaction_columns){NULL, NULL, NULL, NULL, 0, 0};
+}
+
+// Append `trans` to the end of `cols`, growing the columns geometrically
+void transaction_columns_append(transaction_columns *cols, transaction trans) {
+  if (cols->size == cols->capacity) {
+    int new_capacity = (cols->capacity == 0) ? TRANSACTION_COLUMNS_INITIAL_CAPACITY : 2 * cols->capacity;
+
+    double *amounts = realloc(cols->amounts, new_capacity * sizeof *amounts);
+    int *payer_ids = realloc(cols->payer_ids, new_capacity * sizeof *payer_ids);
+    int *payee_ids = realloc(cols->payee_ids, new_capacity * sizeof *payee_ids);
+    int *transaction_ids = realloc(cols->transaction_ids, new_capacity * sizeof *transaction_ids);
+    if (!amounts || !payer_ids || !payee_ids || !transaction_ids) {
+      fprintf(stderr, "Error allocating memory for transaction columns.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    *cols = (transaction_columns){amounts, payer_ids, payee_ids, transaction_ids, cols->size, new_capacity};
+  }
+
+  cols->amounts[cols->size] = trans.amount;
+  cols->payer_ids[cols->size] = trans.payer_id;
+  cols->payee_ids[cols->size] = trans.payee_id;
+  cols->transaction_ids[cols->size] = trans.transaction_id;
+  cols->size++;
+}
+
+// Append all the transactions in `other` to `cols`, growing `cols` at most once
+void transaction_columns_extend(transaction_columns *cols, transaction_columns other) {
+  if (cols->size + other.size > cols->capacity) {
+    int new_capacity = (cols->capacity == 0) ? TRANSACTION_COLUMNS_INITIAL_CAPACITY : cols->capacity;
+    while (cols->size + other.size > new_capacity) new_capacity *= 2;
+
+    double *amounts = realloc(cols->amounts, new_capacity * sizeof *amounts);
+    int *payer_ids = realloc(cols->payer_ids, new_capacity * sizeof *payer_ids);
+    int *payee_ids = realloc(cols->payee_ids, new_capacity * sizeof *payee_ids);
+    int *transaction_ids = realloc(cols->transaction_ids, new_capacity * sizeof *transaction_ids);
+    if (!amounts || !payer_ids || !payee_ids || !transaction_ids) {
+      fprintf(stderr, "Error allocating memory for transaction columns.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    *cols = (transaction_columns){amounts, payer_ids, payee_ids, transaction_ids, cols->size, new_capacity};
+  }
+
+  if (other.size == 0) return;
+
+  memcpy(cols->amounts + cols->size, other.amounts, other.size * sizeof *other.amounts);
+  memcpy(cols->payer_ids + cols->size, other.payer_ids, other.size * sizeof *other.payer_ids);
+  memcpy(cols->payee_ids + cols->size, other.payee_ids, other.size * sizeof *other.payee_ids);
+  memcpy(cols->transaction_ids + cols->size, other.transaction_ids, other.size * sizeof *other.transaction_ids);
+  cols->size += other.size;
+}
+
+// Get the transaction at `index` of `cols`
+transaction transaction_columns_get(transaction_columns cols, int index) {
+  return (transaction){cols.amounts[index], cols.payer_ids[index], cols.payee_ids[index],
+                       cols.transaction_ids[index]};
+}
+
+// Get the sum of all transaction amounts in `cols`
+double transaction_columns_total_amount(transaction_columns cols) {
+  double_vector sums = {0};
+  int i = 0;
+
+  for (; i + VECTOR_LENGTH <= cols.size; i += VECTOR_LENGTH) {
+    double_vector amounts;
+    memcpy(&amounts, cols.amounts + i, sizeof amounts);
+    sums += amounts;
+  }
+
+  double total = 0;
+  for (int lane = 0; lane < VECTOR_LENGTH; lane++) total += sums[lane];
+  for (; i < cols.size; i++) total += cols.amounts[i];  // Scalar tail
+
+  return total;
+}
+
+// Get the total amount of transactions in `cols` that `account_id` pays or is paid
+double transaction_columns_account_volume(transaction_columns cols, int account_id) {
+  double_vector sums = {0};
+  int_vector account = {account_id, account_id, account_id, account_id};
+  int i = 0;
+
+  for (; i + VECTOR_LENGTH <= cols.size; i += VECTOR_LENGTH) {
+    double_vector amounts;
+    int_vector payer_ids, payee_ids;
+    memcpy(&amounts, cols.amounts + i, sizeof amounts);
+    memcpy(&payer_ids, cols.payer_ids + i, sizeof payer_ids);
+    memcpy(&payee_ids, cols.payee_ids + i, sizeof payee_ids);
+
+    // Comparisons give all-ones lanes where they hold, which are widened and used to mask out the amounts
+    mask_vector matches = __builtin_convertvector((payer_ids == account) | (payee_ids == account), mask_vector);
+    sums += (double_vector)((mask_vector)amounts & matches);
+  }
+
+  double total = 0;
+  for (int lane = 0; lane < VECTOR_LENGTH; lane++) total += sums[lane];
+  for (; i < cols.size; i++) {
+    if (cols.payer_ids[i] == account_id || cols.payee_ids[i] == account_id) total += cols.amounts[i];
+  }
+
+  return total;
+}
+
+// Count the transactions in `cols` with amount in the range [`min_amount`, `max_amount`). Calling this for
+// consecutive ranges gives a histogram of the amounts
+int transaction_columns_count_in_range(transaction_columns cols, double min_amount, double max_amount) {
+  mask_vector counts = {0};
+  double_vector mins = {min_amount, min_amount, min_amount, min_amount};
+  double_vector maxes = {max_amount, max_amount, max_amount, max_amount};
+  int i = 0;
+
+  for (; i + VECTOR_LENGTH <= cols.size; i += VECTOR_LENGTH) {
+    double_vector amounts;
+    memcpy(&amounts, cols.amounts + i, sizeof amounts);
+    counts -= (amounts >= mins) & (amounts < maxes);  // Matching lanes are -1
+  }
+
+  int total = 0;
+  for (int lane = 0; lane < VECTOR_LENGTH; lane++) total += counts[lane];
+  for (; i < cols.size; i++) total += (cols.amounts[i] >= min_amount && cols.amounts[i] < max_amount);
+
+  return total;
+}
+
+// Free the memory associated with `cols`
+void transaction_columns_free(transaction_columns *cols) {
+  free(cols->amounts);
+  free(cols->payer_ids);
+  free(cols->payee_ids);
+  free(cols->transaction_ids);
+  *cols = transaction_columns_init();
+}
+
+// Initialise a balance table in which every account has zero balance
+balance_table balance_table_init() { return (balance_table){NULL, 0}; }
+
+// Make sure `table` covers `account_id`, growing it geometrically with zero balances
+void _balance_table_reserve(balance_table *table, int account_id) {
+  if (account_id < 0) {
+    fprintf(stderr, "Account ID %d cannot be stored in a balance table.\n", account_id);
+    exit(EXIT_FAILURE);
+  }
+  if (account_id < table->size) return;
+
+  int new_size = (2 * table->size > account_id + 1) ? 2 * table->size : account_id + 1;
+  double *balances = realloc(table->balances, new_size * sizeof *balances);
+  if (!balances) {
+    fprintf(stderr, "Error allocating memory for balance table.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = table->size; i < new_size; i++) balances[i] = 0;
+  *table = (balance_table){balances, new_size};
+}
+
+// Move the amount of `trans` from the payer to the payee in `table`
+void balance_table_apply(balance_table *table, transaction trans) {
+  _balance_table_reserve(table, trans.payer_id);
+  _balance_table_reserve(table, trans.payee_id);
+
+  table->balances[trans.payer_id] -= trans.amount;
+  table->balances[trans.payee_id] += trans.amount;
+}
+
+// Add every balance in `other` to `table`, for combining tables built from different parts of a chain
+void balance_table_merge(balance_table *table, balance_table other) {
+  if (other.size > 0) _balance_table_reserve(table, other.size - 1);
+
+  for (int i = 0; i < other.size; i++) table->balances[i] += other.balances[i];
+}
+
+// Get the balance of `account_id` in `table`
+double balance_table_get(balance_table table, int account_id) {
+  return (account_id >= 0 && account_id < table.size) ? table.balances[account_id] : 0;
+}
+
+// Free the memory associated with `table`
+void balance_table_free(balance_table *table) {
+  free(table->balances);
+  *table = balance_table_init();
+}
+
 // Given a transaction, create the genesis block
 block block_init_genesis(transaction trans) {
   return (block){bitmap_init_zeros(0), trans, 0};  // Using size 0 bitmap as null
@@ -95,26 +304,35 @@ void block_serialise(block blk, char *buffer, int buffer_size) {
 }
 
 // Get the SHA256 hash of `blk`
-bitmap block_hash(block blk) {
+bitmap block_hash(block blk) { return block_hash_in(NULL, blk); }
+
+// Get the SHA256 hash of `blk`, hashing with scratch space from `arena` (or the heap if it is NULL)
+bitmap block_hash_in(bitmap_arena *arena, block blk) {
   char buffer[BLOCK_SERIALISATION_MAX_CHARS];
 
   block_serialise(blk, buffer, BLOCK_SERIALISATION_MAX_CHARS);
-  return sha256(buffer);
+  return sha256_in(arena, buffer);
 }
 
 // Increment `blk->proof_of_work` until we have at least `POW_LEADING_ZEROS` leading zeros in the block's hash.
 // This method should take a while to run
 void block_find_proof_of_work(block *blk) {
+  // Reusing one arena for every attempt means the search does no allocation after the first hash
+  bitmap_arena arena = bitmap_arena_init(SHA256_ARENA_BLOCK_BYTES);
+
   // Just keep adding one to the POW until we find one with enough leading zeros
   while (1) {
-    bitmap hash = block_hash(*blk);
+    bitmap hash = block_hash_in(&arena, *blk);
     int leading_zeros = bitmap_leading_zeros(hash);
     bitmap_free(&hash);
+    bitmap_arena_reset(&arena);
 
-    if (leading_zeros >= POW_LEADING_ZEROS) return;
+    if (leading_zeros >= POW_LEADING_ZEROS) break;
 
     blk->proof_of_work++;
   }
+
+  bitmap_arena_free(&arena);
 }
 
 // Get whether the proof of work stored in `blk` is valid
@@ -142,52 +360,701 @@ void block_free(block *blk) { bitmap_free(&(blk->prev_hash)); }
 
 // Initialise a chain node on the heap. For this to be a genesis node, have `prev_node` be `NULL`
 chain_node *chain_node_init(chain_node *prev_node, transaction trans) {
+  // Create genesis block if `prev_node` is passed as NULL
+  if (prev_node == NULL) return _chain_node_init_with_block(NULL, block_init_genesis(trans));
+
+  // Reuse the previous node's hash if it has been found, rather than hashing the previous block again
+  if (prev_node->hash.size > 0) {
+    return _chain_node_init_with_block(prev_node, (block){bitmap_copy(prev_node->hash), trans, 0});
+  }
+  return _chain_node_init_with_block(prev_node, block_init(*prev_node->blk, trans));
+}
+
+// Initialise a chain node on the heap holding `blk`, which should follow the block in `prev_node` (or be a genesis
+// block if `prev_node` is NULL). The node takes ownership of `blk`
+chain_node *_chain_node_init_with_block(chain_node *prev_node, block blk) {
   chain_node *result = malloc(sizeof *result);  // Allocate the chain node on the heap
-  if (!result) {
+  block *stored_blk = malloc(sizeof *stored_blk);
+  if (!result || !stored_blk) {
     fprintf(stderr, "Error allocating memory for chain_node.\n");
     exit(EXIT_FAILURE);
   }
 
-  // Create genesis block if `prev_node` is passed as NULL
+  *stored_blk = blk;
+  result->blk = stored_blk;
+  result->hash = (bitmap){0, NULL};  // Set once the proof of work is known
+  result->prev = prev_node;
+
   if (prev_node == NULL) {
-    result->blk = block_init_genesis(trans);
-    result->prev = NULL;
+    result->skip = NULL;
     result->index = 0;
+    result->total_work = BLOCK_WORK;
   } else {
-    result->blk = block_init(prev_node->blk, trans);
-    result->prev = prev_node;
     result->index = prev_node->index + 1;
+    result->skip = chain_node_get_ancestor(prev_node, _skip_index(result->index));
+    result->total_work = prev_node->total_work + BLOCK_WORK;
   }
 
   return result;
 }
 
-// Free the memory associated with `node`, i.e. the stored block and the node itself
+// Get the ancestor of `node` at index `index` (which may be `node` itself), following skip pointers where they
+// do not overshoot. Returns NULL if `index` is out of range
+chain_node *chain_node_get_ancestor(chain_node *node, int index) {
+  if (node == NULL || index < 0 || index > node->index) return NULL;
+
+  chain_node *selected_node = node;
+  while (selected_node->index > index) {
+    int skip_index = _skip_index(selected_node->index);
+    int prev_skip_index = _skip_index(selected_node->index - 1);
+
+    // Take the skip pointer unless the previous node's skip pointer would get strictly closer to the target
+    if (selected_node->skip != NULL &&
+        (skip_index == index ||
+         (skip_index > index && !(prev_skip_index < skip_index - 2 && prev_skip_index >= index)))) {
+      selected_node = selected_node->skip;
+    } else {
+      selected_node = selected_node->prev;
+    }
+  }
+
+  return selected_node;
+}
+
+// Get the most recent node that is an ancestor of both `node1` and `node2`, or NULL if they share no ancestor.
+// After levelling the two nodes, they step back together, taking their skip pointers whenever those still land
+// on different nodes. Nodes at the same index have skip pointers to the same index, so this is O(log n) steps,
+// as in Bitcoin's `LastCommonAncestor`
+chain_node *chain_node_last_common_ancestor(chain_node *node1, chain_node *node2) {
+  if (node1 == NULL || node2 == NULL) return NULL;
+
+  // Bring both nodes to the same index
+  if (node1->index > node2->index) node1 = chain_node_get_ancestor(node1, node2->index);
+  if (node2->index > node1->index) node2 = chain_node_get_ancestor(node2, node1->index);
+
+  while (node1 != node2 && node1 != NULL && node2 != NULL) {
+    if (node1->skip != NULL && node2->skip != NULL && node1->skip != node2->skip) {
+      node1 = node1->skip;
+      node2 = node2->skip;
+    } else {
+      node1 = node1->prev;
+      node2 = node2->prev;
+    }
+  }
+
+  // Unrelated nodes both run off the start of their chains
+  return (node1 == node2) ? node1 : NULL;
+}
+
+// Free the memory associated with `node`, i.e. the stored block (unless it is evicted) and the node itself
 void chain_node_free(chain_node *node) {
-  block_free(&(node->blk));
+  _chain_node_evict(node);
+  bitmap_free(&(node->hash));
   free(node);
   node = NULL;
 }
 
 // Initialise a chain of size 0
-chain chain_init() { return (chain){NULL, NULL, 0}; }
+chain chain_init() {
+  chain_checkpoint checkpoint = {-1, {0, NULL}};
+  chain_block_store store = {NULL, NULL, NULL, 0};
+  return (chain){NULL, NULL, 0, NULL, 0, 0, transaction_columns_init(), NULL, 0, checkpoint,
+                 store, 0, {NULL}, 0, 0};
+}
+
+// Record the accounts of `trans`, stored in the block at `index`, in the filter of that block's segment
+void _chain_add_to_segment_filters(chain *chn, int index, transaction trans) {
+  _segment_filters_add(&(chn->segment_filters), &(chn->num_segments), index, trans);
+}
+
+// Record the accounts of `trans`, stored in the block at `index`, in the filter of that block's segment in the
+// array `*filters` of `*num_filters` segment filters, where blocks are counted from the start of the first segment
+void _segment_filters_add(bloom_filter **filters, int *num_filters, int index, transaction trans) {
+  int segment = index / CHAIN_SEGMENT_SIZE;
+
+  // Start a new filter when the first block of a segment arrives
+  if (segment == *num_filters) {
+    bloom_filter *new_filters = realloc(*filters, (*num_filters + 1) * sizeof *new_filters);
+    if (!new_filters) {
+      fprintf(stderr, "Error allocating memory for segment filters.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    new_filters[segment] = bloom_filter_init(SEGMENT_FILTER_BITS, BLOOM_FILTER_HASHES);
+    *filters = new_filters;
+    (*num_filters)++;
+  }
+
+  bloom_filter_add(*filters + segment, trans.payer_id);
+  bloom_filter_add(*filters + segment, trans.payee_id);
+}
+
+// Get the key of `hash` in the block index. The leading bytes of a block hash are mostly zero because of the proof
+// of work, so the key is taken from the trailing bytes
+u64 _block_index_key(bitmap hash) {
+  int num_bytes = _full_bytes_needed(hash.size);
+  const byte *bytes = bitmap_bytes(&hash);
+  u64 key = 0;
+  for (int i = (num_bytes > 8) ? num_bytes - 8 : 0; i < num_bytes; i++) key = (key << BYTE_SIZE) | bytes[i];
+
+  return key;
+}
+
+// Add `node`, whose hash must be set, to the block index of `chn`, growing the index to keep it at most half full
+void _chain_index_node(chain *chn, chain_node *node) {
+  _chain_reserve_block_index(chn, 1);
+
+  int slot = _block_index_key(node->hash) & (chn->block_index_capacity - 1);
+  while (chn->block_index[slot] != NULL) slot = (slot + 1) & (chn->block_index_capacity - 1);
+  chn->block_index[slot] = node;
+  chn->num_blocks++;
+}
+
+// Grow the block index of `chn` in one step, if needed, so that `num_blocks` more nodes can be indexed while
+// keeping it at most half full
+void _chain_reserve_block_index(chain *chn, int num_blocks) {
+  if (2 * (chn->num_blocks + num_blocks) <= chn->block_index_capacity) return;
+
+  int new_capacity = (chn->block_index_capacity == 0) ? BLOCK_INDEX_INITIAL_CAPACITY : chn->block_index_capacity;
+  while (2 * (chn->num_blocks + num_blocks) > new_capacity) new_capacity *= 2;
+
+  chain_node **new_index = calloc(new_capacity, sizeof *new_index);
+  if (!new_index) {
+    fprintf(stderr, "Error allocating memory for block index.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Move the existing nodes over, probing linearly from their new home slots
+  for (int i = 0; i < chn->block_index_capacity; i++) {
+    chain_node *indexed_node = chn->block_index[i];
+    if (indexed_node == NULL) continue;
+
+    int slot = _block_index_key(indexed_node->hash) & (new_capacity - 1);
+    while (new_index[slot] != NULL) slot = (slot + 1) & (new_capacity - 1);
+    new_index[slot] = indexed_node;
+  }
+
+  free(chn->block_index);
+  chn->block_index = new_index;
+  chn->block_index_capacity = new_capacity;
+}
+
+// Get the node in `chn` (on any branch) whose block has hash `hash`, or NULL if there is none
+chain_node *chain_find_block(chain *chn, bitmap hash) {
+  if (chn->block_index_capacity == 0) return NULL;
+
+  int slot = _block_index_key(hash) & (chn->block_index_capacity - 1);
+  while (chn->block_index[slot] != NULL) {
+    if (bitmap_equal(chn->block_index[slot]->hash, hash)) return chn->block_index[slot];
+    slot = (slot + 1) & (chn->block_index_capacity - 1);
+  }
+
+  return NULL;
+}
+
+// Cut the transaction columns and segment filters of `chn` back to the first `size` blocks of the active branch
+void _chain_truncate_derived(chain *chn, int size) {
+  chn->columns.size = size;
+
+  // Bloom filters can't have entries removed, so rebuild the filter of the segment containing the cut
+  int kept_segments = size / CHAIN_SEGMENT_SIZE;
+  for (int i = kept_segments; i < chn->num_segments; i++) bloom_filter_free(chn->segment_filters + i);
+  chn->num_segments = kept_segments;
+
+  for (int i = kept_segments * CHAIN_SEGMENT_SIZE; i < size; i++) {
+    _chain_add_to_segment_filters(chn, i, transaction_columns_get(chn->columns, i));
+  }
+}
+
+// Add `node`, whose hash must be set, to the tree in `chn`. It becomes the new end if it extends the active
+// branch, or if its branch now has more work than the active branch
+void _chain_insert_node(chain *chn, chain_node *node) {
+  _chain_index_node(chn, node);
+
+  if (node->prev == chn->end) {
+    chn->size++;
+    if (chn->size == 1) chn->start = node;  // If this is the genesis block, also make this node the start
+    _chain_publish_end(chn, node);
+    transaction_columns_append(&(chn->columns), node->blk->trans);
+    _chain_add_to_segment_filters(chn, node->index, node->blk->trans);
+    _chain_evict_cold_blocks(chn);
+  } else if (node->total_work > chn->end->total_work) {
+    chain_reorganise(chn, node);
+  }
+}
 
 // Add a new node to the end of the chain, `chn`
 void chain_add_node(chain *chn, transaction trans) {
   chain_node *new_node = chain_node_init(chn->end, trans);
-  block_find_proof_of_work(&(new_node->blk));
+  block_find_proof_of_work(new_node->blk);
+  new_node->hash = block_hash(*new_node->blk);
+  _chain_insert_node(chn, new_node);
+}
+
+// Add the mined block `blk` to the tree in `chn`, which may start a competing branch, and switch to that branch if
+// it has the most work. Returns the new node, in which case `chn` takes ownership of `blk`. Returns NULL without
+// taking ownership if the proof of work is invalid, the block is already known, its previous block is unknown, or
+// it is a second genesis block
+chain_node *chain_accept_block(chain *chn, block blk) {
+  bitmap hash = block_hash(blk);
+  chain_node *prev_node = (blk.prev_hash.size == 0) ? NULL : chain_find_block(chn, blk.prev_hash);
+
+  int is_valid = (bitmap_leading_zeros(hash) >= POW_LEADING_ZEROS) && chain_find_block(chn, hash) == NULL &&
+                 ((blk.prev_hash.size == 0) ? (chn->start == NULL) : (prev_node != NULL));
+  if (!is_valid) {
+    bitmap_free(&hash);
+    return NULL;
+  }
+
+  // Don't hand out IDs of transactions that are already in the chain
+  transaction_reserve_id(blk.trans.transaction_id);
+
+  chain_node *new_node = _chain_node_init_with_block(prev_node, blk);
+  new_node->hash = hash;
+  _chain_insert_node(chn, new_node);
+
+  return new_node;
+}
+
+// Add the mined block `blk`, whose hash `hash` has already been computed, to the end of the active branch of `chn`
+// without hashing it again. Returns the new node, in which case `chn` takes ownership of `blk` and `hash`. Returns
+// NULL without taking ownership if the proof of work is invalid or `blk` doesn't follow the end of `chn`
+chain_node *chain_append_hashed_block(chain *chn, block blk, bitmap hash) {
+  int follows_end = (chn->end == NULL) ? (blk.prev_hash.size == 0) : bitmap_equal(blk.prev_hash, chn->end->hash);
+  if (bitmap_leading_zeros(hash) < POW_LEADING_ZEROS || !follows_end) return NULL;
+
+  transaction_reserve_id(blk.trans.transaction_id);
+
+  chain_node *new_node = _chain_node_init_with_block(chn->end, blk);
+  new_node->hash = hash;
+  _chain_insert_node(chn, new_node);
+
+  return new_node;
+}
+
+// Link the mined block `blk`, whose hash `hash` has already been computed, to the end of the active branch of
+// `chn` like `chain_append_hashed_block`, but without adding its transaction to the transaction columns or
+// segment filters. The caller must add those for the linked blocks with `_chain_append_derived` before using `chn`
+chain_node *_chain_link_hashed_block(chain *chn, block blk, bitmap hash) {
+  int follows_end = (chn->end == NULL) ? (blk.prev_hash.size == 0) : bitmap_equal(blk.prev_hash, chn->end->hash);
+  if (bitmap_leading_zeros(hash) < POW_LEADING_ZEROS || !follows_end) return NULL;
+
+  transaction_reserve_id(blk.trans.transaction_id);
+
+  chain_node *new_node = _chain_node_init_with_block(chn->end, blk);
+  new_node->hash = hash;
+  _chain_index_node(chn, new_node);
+
   chn->size++;
-  chn->end = new_node;
-  if (chn->size == 1) chn->start = new_node;  // If this is the genesis block, also make this node the start
+  if (chn->size == 1) chn->start = new_node;
+  _chain_publish_end(chn, new_node);
+
+  return new_node;
+}
+
+// Add the transaction columns `cols` and the `num_filters` segment filters `filters` of blocks linked by
+// `_chain_link_hashed_block` to the derived data of `chn`, which must so far cover a whole number of segments.
+// `chn` takes ownership of the filters but not of the array holding them or of `cols`
+void _chain_append_derived(chain *chn, transaction_columns cols, bloom_filter *filters, int num_filters) {
+  if (chn->columns.size % CHAIN_SEGMENT_SIZE != 0 || chn->columns.size + cols.size > chn->size) {
+    fprintf(stderr, "Derived data of %d blocks cannot follow derived data of %d blocks in chain of %d blocks.\n",
+            cols.size, chn->columns.size, chn->size);
+    exit(EXIT_FAILURE);
+  }
+
+  transaction_columns_extend(&(chn->columns), cols);
+
+  if (num_filters > 0) {
+    bloom_filter *new_filters = realloc(chn->segment_filters, (chn->num_segments + num_filters) * sizeof *filters);
+    if (!new_filters) {
+      fprintf(stderr, "Error allocating memory for segment filters.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    memcpy(new_filters + chn->num_segments, filters, num_filters * sizeof *filters);
+    chn->segment_filters = new_filters;
+    chn->num_segments += num_filters;
+  }
+
+  _chain_evict_cold_blocks(chn);
+}
+
+// Make `new_end`, a node in the tree of `chn`, the end of the active branch. Only the blocks after the fork point
+// are rewound and reapplied to the derived data
+void chain_reorganise(chain *chn, chain_node *new_end) {
+  chain_node *fork_node = chain_node_last_common_ancestor(chn->end, new_end);
+  int fork_size = (fork_node == NULL) ? 0 : fork_node->index + 1;
+
+  _chain_truncate_derived(chn, fork_size);
+
+  // Collect the new branch back to the fork, so it can be reapplied oldest first
+  int branch_size = new_end->index + 1 - fork_size;
+  chain_node **branch = malloc(branch_size * sizeof *branch);
+  if (!branch) {
+    fprintf(stderr, "Error allocating memory for reorganisation.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  chain_node *selected_node = new_end;
+  for (int i = branch_size - 1; i >= 0; i--) {
+    branch[i] = selected_node;
+    selected_node = selected_node->prev;
+  }
+
+  for (int i = 0; i < branch_size; i++) {
+    transaction trans = chain_node_block(chn, branch[i])->trans;
+    transaction_columns_append(&(chn->columns), trans);
+    _chain_add_to_segment_filters(chn, branch[i]->index, trans);
+  }
+
+  free(branch);
+
+  chn->start = chain_node_get_ancestor(new_end, 0);
+  chn->size = new_end->index + 1;
+  _chain_publish_end(chn, new_end);
+}
+
+// Make `node` the end of `chn`. The release store means a reader that sees the new end (through an acquire load)
+// also sees the fully initialised node and everything behind it
+void _chain_publish_end(chain *chn, chain_node *node) {
+  __atomic_store_n(&(chn->end), node, __ATOMIC_RELEASE);
+}
+
+// Take a consistent view of the active branch of `chn`. This can be called from any thread while another thread
+// appends to `chn`, and the view stays valid until `chn` is freed, since nodes are never freed before then (even
+// those left on inactive branches by a reorganisation). Only the nodes are safe to read this way; the transaction
+// columns and segment filters are reserved for the appending thread, as are the blocks of a chain with a store
+chain_snapshot chain_take_snapshot(chain *chn) {
+  chain_node *end = __atomic_load_n(&(chn->end), __ATOMIC_ACQUIRE);
+  return (chain_snapshot){end, (end == NULL) ? 0 : end->index + 1};  // The size is derived so it matches `end`
+}
+
+// Get the node at index `index` of the branch in `snap`, or NULL if there is no such node
+chain_node *chain_snapshot_get_node(chain_snapshot snap, int index) {
+  return chain_node_get_ancestor(snap.end, index);
+}
+
+// Get the balance of `account_id` (the amount it has been paid minus the amount it has paid) in `snap`
+double chain_snapshot_account_balance(chain_snapshot snap, int account_id) {
+  double balance = 0;
+
+  for (chain_node *p = snap.end; p != NULL; p = p->prev) {
+    if (p->blk->trans.payee_id == account_id) balance += p->blk->trans.amount;
+    if (p->blk->trans.payer_id == account_id) balance -= p->blk->trans.amount;
+  }
+
+  return balance;
+}
+
+// Store (up to `max_indices` of) the indices of blocks in `snap` whose transaction involves `account_id` in
+// `indices`, most recent first. Returns the total number of such blocks
+int chain_snapshot_account_history(chain_snapshot snap, int account_id, int *indices, int max_indices) {
+  int found = 0;
+
+  for (chain_node *p = snap.end; p != NULL; p = p->prev) {
+    if (p->blk->trans.payer_id != account_id && p->blk->trans.payee_id != account_id) continue;
+
+    if (found < max_indices) indices[found] = p->index;
+    found++;
+  }
+
+  return found;
+}
+
+// Get the node at index `index` of the chain, `chn`, or NULL if there is no such node. If the node's block was
+// evicted, it is read back from the block store
+chain_node *chain_get_node(chain *chn, int index) {
+  chain_node *node = chain_node_get_ancestor(chn->end, index);
+  if (node != NULL) chain_node_block(chn, node);
+
+  return node;
+}
+
+// Get the block of `node`, a node on the active branch of `chn`, reading it back from the block store if it has
+// been evicted. Up to `CHAIN_FAULTED_BLOCKS` blocks read back stay in memory, after which the oldest is evicted
+// again, so the returned block should be used before reading many more
+block *chain_node_block(chain *chn, chain_node *node) {
+  if (node->blk != NULL) return node->blk;
+
+  // The store is indexed by position, so check it really holds this block (e.g. not one from before a reorg)
+  block blk = chn->store.read(chn->store.source, node->index);
+  bitmap hash = block_hash(blk);
+  int matches = bitmap_equal(hash, node->hash);
+  bitmap_free(&hash);
+  if (!matches) {
+    fprintf(stderr, "Block %d in the block store is not the block that was evicted.\n", node->index);
+    exit(EXIT_FAILURE);
+  }
+
+  node->blk = malloc(sizeof *node->blk);
+  if (!node->blk) {
+    fprintf(stderr, "Error allocating memory for block.\n");
+    exit(EXIT_FAILURE);
+  }
+  *node->blk = blk;
+
+  if (chn->num_faulted == CHAIN_FAULTED_BLOCKS) {
+    _chain_node_evict(chn->faulted[chn->faulted_start]);
+    chn->faulted_start = (chn->faulted_start + 1) % CHAIN_FAULTED_BLOCKS;
+    chn->num_faulted--;
+  }
+  chn->faulted[(chn->faulted_start + chn->num_faulted) % CHAIN_FAULTED_BLOCKS] = node;
+  chn->num_faulted++;
+
+  return node->blk;
+}
+
+// Evict the blocks of `chn` that are older than the newest `store.hot_blocks` to `store`, now and as the chain
+// grows. Nodes keep their hash, links and place in the block index, so only the blocks themselves leave memory.
+// Reader threads can't walk snapshots of a chain with a store, as the blocks they would read can be evicted
+void chain_set_block_store(chain *chn, chain_block_store store) {
+  if (store.hot_blocks < 1) {
+    fprintf(stderr, "A chain must keep at least 1 block in memory, not %d.\n", store.hot_blocks);
+    exit(EXIT_FAILURE);
+  }
+
+  chn->store = store;
+  _chain_evict_cold_blocks(chn);
+}
+
+// Evict the blocks of the active branch of `chn` that are outside the hot window and held by the block store
+void _chain_evict_cold_blocks(chain *chn) {
+  if (chn->store.read == NULL) return;
+
+  int evict_size = chn->size - chn->store.hot_blocks;
+  int stored = chn->store.size(chn->store.source);
+  if (evict_size > stored) evict_size = stored;
+
+  for (; chn->evicted_size < evict_size; chn->evicted_size++) {
+    _chain_node_evict(chain_node_get_ancestor(chn->end, chn->evicted_size));
+  }
+}
+
+// Free the block of `node`, leaving the node itself
+void _chain_node_evict(chain_node *node) {
+  if (node->blk == NULL) return;
+
+  block_free(node->blk);
+  free(node->blk);
+  node->blk = NULL;
+}
+
+// Store (up to `max_indices` of) the indices of blocks in `chn` whose transaction involves `account_id` in
+// `indices`, in chain order. Segments whose filter rules out the account are skipped without being scanned.
+// Returns the total number of such blocks
+int chain_account_history(chain *chn, int account_id, int *indices, int max_indices) {
+  int found = 0;
+
+  for (int segment = 0; segment < chn->num_segments; segment++) {
+    if (!bloom_filter_may_contain(chn->segment_filters[segment], account_id)) continue;
+
+    int segment_end = (segment + 1) * CHAIN_SEGMENT_SIZE;
+    if (segment_end > chn->columns.size) segment_end = chn->columns.size;
+
+    for (int i = segment * CHAIN_SEGMENT_SIZE; i < segment_end; i++) {
+      if (chn->columns.payer_ids[i] != account_id && chn->columns.payee_ids[i] != account_id) continue;
+
+      if (found < max_indices) indices[found] = i;
+      found++;
+    }
+  }
+
+  return found;
+}
+
+// Write the segment filters of `chn` to the file at `path`, so they need not be rebuilt from the blocks
+void chain_save_segment_filters(chain *chn, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "Failed to open \"%s\" to save segment filters.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  int header[] = {SEGMENT_FILTERS_MAGIC, CHAIN_SEGMENT_SIZE, SEGMENT_FILTER_BITS, BLOOM_FILTER_HASHES,
+                  chn->num_segments};
+  int written = (fwrite(header, sizeof header, 1, file) == 1);
+  for (int i = 0; i < chn->num_segments; i++) {
+    bitmap bits = chn->segment_filters[i].bits;
+    int num_bytes = _full_bytes_needed(bits.size);
+    written &= (fwrite(bitmap_bytes(&bits), 1, num_bytes, file) == num_bytes);
+  }
+
+  if (fclose(file) != 0 || !written) {
+    fprintf(stderr, "Failed to write segment filters to \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
 }
 
-// Free the memory associated with the chain, `chn`
+// Replace the segment filters of `chn` with those in the file at `path`. Returns 0 (leaving `chn` unchanged) if
+// the file is missing, or was written with different parameters or for a chain with a different segment count
+int chain_load_segment_filters(chain *chn, const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) return 0;
+
+  int header[5];
+  int expected_header[] = {SEGMENT_FILTERS_MAGIC, CHAIN_SEGMENT_SIZE, SEGMENT_FILTER_BITS, BLOOM_FILTER_HASHES,
+                           chn->num_segments};
+  if (fread(header, sizeof header, 1, file) != 1 || memcmp(header, expected_header, sizeof header) != 0) {
+    fclose(file);
+    return 0;
+  }
+
+  // Read into new filters first, so a truncated file doesn't leave `chn` half loaded
+  bloom_filter *filters = malloc(chn->num_segments * sizeof *filters);
+  if (!filters && chn->num_segments > 0) {
+    fprintf(stderr, "Error allocating memory for segment filters.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int read = 1;
+  for (int i = 0; i < chn->num_segments; i++) {
+    filters[i] = bloom_filter_init(SEGMENT_FILTER_BITS, BLOOM_FILTER_HASHES);
+    byte *bytes = bitmap_bytes(&(filters[i].bits));
+    read &= (fread(bytes, 1, SEGMENT_FILTER_BITS / BYTE_SIZE, file) == SEGMENT_FILTER_BITS / BYTE_SIZE);
+  }
+  fclose(file);
+
+  bloom_filter *old_filters = read ? chn->segment_filters : filters;
+  for (int i = 0; i < chn->num_segments; i++) bloom_filter_free(old_filters + i);
+  free(old_filters);
+
+  if (read) chn->segment_filters = filters;
+  return read;
+}
+
+// Apply the transactions of the active branch of `chn` from index `from_index` onwards to `table`, and return it.
+// Passing a new table and index 0 computes the balances from genesis
+balance_table chain_compute_balances(chain *chn, int from_index, balance_table table) {
+  for (int i = (from_index < 0) ? 0 : from_index; i < chn->columns.size; i++) {
+    balance_table_apply(&table, transaction_columns_get(chn->columns, i));
+  }
+
+  return table;
+}
+
+// Check that every block on the active branch of `chn` has a valid proof of work and follows the hash of the block
+// before it. Blocks up to the checkpoint are trusted if the checkpoint block still has the recorded hash, so only
+// blocks after it are hashed. On success, the checkpoint is moved to the end of the chain
+int chain_validate(chain *chn) {
+  if (chn->end == NULL) return 1;
+
+  // Confirm the checkpoint with a single hash. If it doesn't match (e.g. after a reorganisation past it), validate
+  // from genesis
+  int first_index = 0;
+  chain_node *checkpoint_node = chain_get_node(chn, chn->checkpoint.index);
+  if (checkpoint_node != NULL) {
+    bitmap checkpoint_hash = block_hash(*checkpoint_node->blk);
+    if (bitmap_equal(checkpoint_hash, chn->checkpoint.hash)) first_index = chn->checkpoint.index + 1;
+    bitmap_free(&checkpoint_hash);
+  }
+
+  if (first_index == chn->size) return 1;  // Nothing has been added since the checkpoint
+
+  // Walk back from the end, comparing each block's hash with the previous hash stored by the block after it
+  bitmap end_hash = {0, NULL};
+  bitmap next_prev_hash = {0, NULL};
+  int is_valid = 1;
+  for (chain_node *p = chn->end; p != NULL && p->index >= first_index && is_valid; p = p->prev) {
+    block *blk = chain_node_block(chn, p);
+    bitmap hash = block_hash(*blk);
+
+    is_valid = (bitmap_leading_zeros(hash) >= POW_LEADING_ZEROS) &&
+               (p == chn->end || bitmap_equal(hash, next_prev_hash));
+    next_prev_hash = blk->prev_hash;
+
+    if (p == chn->end) {
+      bitmap_free(&end_hash);
+      end_hash = hash;
+    } else {
+      bitmap_free(&hash);
+    }
+  }
+
+  // The first block checked must follow the checkpoint block, or be a genesis block
+  if (is_valid) {
+    is_valid =
+        (first_index == 0) ? (next_prev_hash.size == 0) : bitmap_equal(next_prev_hash, chn->checkpoint.hash);
+  }
+
+  if (is_valid) {
+    bitmap_free(&(chn->checkpoint.hash));
+    chn->checkpoint = (chain_checkpoint){chn->end->index, end_hash};
+  } else {
+    bitmap_free(&end_hash);
+  }
+
+  return is_valid;
+}
+
+// Write the checkpoint of `chn` to the file at `path`
+void chain_save_checkpoint(chain *chn, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "Failed to open \"%s\" to save checkpoint.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  int header[] = {CHECKPOINT_MAGIC, chn->checkpoint.index, chn->checkpoint.hash.size};
+  int num_bytes = _full_bytes_needed(chn->checkpoint.hash.size);
+  int written = (fwrite(header, sizeof header, 1, file) == 1) &&
+                (fwrite(bitmap_bytes(&(chn->checkpoint.hash)), 1, num_bytes, file) == num_bytes);
+
+  if (fclose(file) != 0 || !written) {
+    fprintf(stderr, "Failed to write checkpoint to \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Replace the checkpoint of `chn` with the one in the file at `path`. Returns 0 (leaving `chn` unchanged) if the
+// file is missing or invalid. The checkpoint is still confirmed against the chain by `chain_validate`
+int chain_load_checkpoint(chain *chn, const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) return 0;
+
+  int header[3];
+  int read = (fread(header, sizeof header, 1, file) == 1);
+  if (!read || header[0] != CHECKPOINT_MAGIC || header[2] != HASH_SIZE_BITS) {
+    fclose(file);
+    return 0;
+  }
+
+  bitmap hash = bitmap_init_zeros(HASH_SIZE_BITS);
+  read = (fread(bitmap_bytes(&hash), 1, HASH_SIZE_BITS / BYTE_SIZE, file) == HASH_SIZE_BITS / BYTE_SIZE);
+  fclose(file);
+
+  if (!read) {
+    bitmap_free(&hash);
+    return 0;
+  }
+
+  bitmap_free(&(chn->checkpoint.hash));
+  chn->checkpoint = (chain_checkpoint){header[1], hash};
+
+  return 1;
+}
+
+// Free the memory associated with the chain, `chn`. No snapshots of `chn` may be in use
 void chain_free(chain *chn) {
-  chain_node *selected_node = chn->end;
-  for (int i = 0; i < chn->size; i++) {
-    chain_node *next_selected_node =
-        selected_node->prev;  // We are about to free chn->end, so need to get prev here
-    chain_node_free(selected_node);
-    selected_node = next_selected_node;
+  // Every node, including those on inactive branches, is in the block index
+  for (int i = 0; i < chn->block_index_capacity; i++) {
+    if (chn->block_index[i] != NULL) chain_node_free(chn->block_index[i]);
   }
+  free(chn->block_index);
+  chn->block_index = NULL;
+  chn->block_index_capacity = 0;
+  chn->num_blocks = 0;
+
+  transaction_columns_free(&(chn->columns));
+
+  for (int i = 0; i < chn->num_segments; i++) bloom_filter_free(chn->segment_filters + i);
+  free(chn->segment_filters);
+  chn->segment_filters = NULL;
+  chn->num_segments = 0;
+
+  bitmap_free(&(chn->checkpoint.hash));
+  chn->checkpoint.index = -1;
+
+  chn->store.read = NULL;
+  chn->evicted_size = 0;
+  chn->num_faulted = 0;
 }
@@ -2,9 +2,11 @@
 #define BLOCKCHAIN_H
 
 #include "bitmap.h"
+#include "bloom.h"
 
 // This is very low (so the program runs quickly)
 #define POW_LEADING_ZEROS 6
+#define BLOCK_WORK (1ULL << POW_LEADING_ZEROS)  // Expected number of hashes needed to mine a block
 
 #define MAX_AMOUNT_PRECISION 6
 #define AMOUNT_FORMAT "%.6lf"
@@ -13,6 +15,17 @@
 #define TRANSACTION_SERIALISATION_MAX_CHARS 40
 #define BLOCK_SERIALISATION_MAX_CHARS 130
 
+#define TRANSACTION_COLUMNS_INITIAL_CAPACITY 64
+
+#define BLOCK_INDEX_INITIAL_CAPACITY 64
+
+#define CHAIN_FAULTED_BLOCKS 64  // Evicted blocks that can be read back into memory at once
+
+#define CHAIN_SEGMENT_SIZE 4096
+#define SEGMENT_FILTER_BITS (2 * CHAIN_SEGMENT_SIZE * BLOOM_BITS_PER_KEY)  // A payer and a payee per block
+#define SEGMENT_FILTERS_MAGIC 0x464d4c42  // "BLMF"
+#define CHECKPOINT_MAGIC 0x54504b43       // "CKPT"
+
 // TODO: Add RSA public/private keys here instead of just IDs
 typedef struct transaction {
   double amount;
@@ -29,40 +42,149 @@ typedef struct block {
 } block;
 
 typedef struct chain_node {
-  block blk;
+  block *blk;   // NULL while the block is evicted to the chain's block store
+  bitmap hash;  // Hash of `blk` once its proof of work is found, otherwise size 0
   struct chain_node *prev;
-  int index;  // Index in the chain, i.e. genesis block would have 0 index
+  struct chain_node *skip;  // Pointer to an earlier ancestor, used to find ancestors in O(log n) steps
+  int index;                // Index in the chain, i.e. genesis block would have 0 index
+  u64 total_work;           // Work of this block and all of its ancestors
 } chain_node;
 
+// Structure-of-arrays copy of a chain's transactions, so that aggregate queries scan contiguous memory
+typedef struct transaction_columns {
+  double *amounts;
+  int *payer_ids;
+  int *payee_ids;
+  int *transaction_ids;
+  int size;
+  int capacity;
+} transaction_columns;
+
+// Balance of each account (the amount it has been paid minus the amount it has paid), indexed by account ID
+typedef struct balance_table {
+  double *balances;
+  int size;  // Number of account IDs covered, from 0
+} balance_table;
+
+// Records that the active branch has been validated up to the block at `index` (-1 if none), whose hash is `hash`
+typedef struct chain_checkpoint {
+  int index;
+  bitmap hash;
+} chain_checkpoint;
+
+// Where a chain keeps the blocks it evicts from memory, such as the block log it is written to. `read` gets a copy
+// of block `index` of the active branch, and `size` gets how many blocks from the start of the active branch the
+// store holds. Only a chain that grows linearly can use a store, since the store is indexed by position
+typedef struct chain_block_store {
+  block (*read)(void *source, int index);
+  int (*size)(void *source);
+  void *source;
+  int hot_blocks;  // Blocks at the end of the active branch that are never evicted
+} chain_block_store;
+
+// A tree of blocks, which may contain competing branches. `end` is the tip of the active branch, which is the one
+// with the most work, and `size` is the length of that branch. The derived data below reflects the active branch.
+// A chain has a single appending thread, and other threads read it through `chain_take_snapshot`
 typedef struct chain {
   chain_node *start;
   chain_node *end;
   int size;
+  chain_node **block_index;  // Every node in the tree, in an open addressing hash table keyed by block hash
+  int block_index_capacity;
+  int num_blocks;
+  transaction_columns columns;    // Entry i holds the transaction of the node with index i
+  bloom_filter *segment_filters;  // Filter i holds the account IDs in blocks [i * CHAIN_SEGMENT_SIZE, ...)
+  int num_segments;
+  chain_checkpoint checkpoint;
+  chain_block_store store;                    // `read` is NULL unless blocks are being evicted
+  int evicted_size;                           // Blocks of the active branch before this have been evicted
+  chain_node *faulted[CHAIN_FAULTED_BLOCKS];  // Evicted nodes whose blocks were read back, in a ring
+  int faulted_start;
+  int num_faulted;
 } chain;
 
+// Consistent view of the active branch of a chain, which reader threads can use alongside an appending thread
+typedef struct chain_snapshot {
+  chain_node *end;
+  int size;
+} chain_snapshot;
+
 transaction transaction_init(double amount, int payer_id, int payee_id);
+void transaction_reserve_id(int transaction_id);
 void transaction_serialise(transaction trans, char *buffer, int buffer_size);
 void transaction_print_on_line(transaction trans);
 
+transaction_columns transaction_columns_init();
+void transaction_columns_append(transaction_columns *cols, transaction trans);
+void transaction_columns_extend(transaction_columns *cols, transaction_columns other);
+transaction transaction_columns_get(transaction_columns cols, int index);
+double transaction_columns_total_amount(transaction_columns cols);
+double transaction_columns_account_volume(transaction_columns cols, int account_id);
+int transaction_columns_count_in_range(transaction_columns cols, double min_amount, double max_amount);
+void transaction_columns_free(transaction_columns *cols);
+
+balance_table balance_table_init();
+void balance_table_apply(balance_table *table, transaction trans);
+void balance_table_merge(balance_table *table, balance_table other);
+double balance_table_get(balance_table table, int account_id);
+void balance_table_free(balance_table *table);
+
 block block_init_genesis(transaction trans);
 block block_init(block prev_blk, transaction trans);
 void block_serialise(block blk, char *buffer, int buffer_size);
 bitmap block_hash(block blk);
+bitmap block_hash_in(bitmap_arena *arena, block blk);
 void block_find_proof_of_work(block *blk);
 int block_proof_of_work_is_valid(block blk);
 int block_prev_block_hash_matches(block prev_blk, block curr_blk);
 void block_free(block *blk);
 
 chain_node *chain_node_init(chain_node *prev_node, transaction trans);
+chain_node *chain_node_get_ancestor(chain_node *node, int index);
+chain_node *chain_node_last_common_ancestor(chain_node *node1, chain_node *node2);
 void chain_node_free(chain_node *node);
 
 chain chain_init();
 void chain_add_node(chain *chn, transaction trans);
+chain_node *chain_get_node(chain *chn, int index);
+block *chain_node_block(chain *chn, chain_node *node);
+void chain_set_block_store(chain *chn, chain_block_store store);
+chain_node *chain_find_block(chain *chn, bitmap hash);
+chain_node *chain_accept_block(chain *chn, block blk);
+chain_node *chain_append_hashed_block(chain *chn, block blk, bitmap hash);
+void chain_reorganise(chain *chn, chain_node *new_end);
+chain_snapshot chain_take_snapshot(chain *chn);
+chain_node *chain_snapshot_get_node(chain_snapshot snap, int index);
+double chain_snapshot_account_balance(chain_snapshot snap, int account_id);
+int chain_snapshot_account_history(chain_snapshot snap, int account_id, int *indices, int max_indices);
+balance_table chain_compute_balances(chain *chn, int from_index, balance_table table);
+int chain_validate(chain *chn);
+void chain_save_checkpoint(chain *chn, const char *path);
+int chain_load_checkpoint(chain *chn, const char *path);
+int chain_account_history(chain *chn, int account_id, int *indices, int max_indices);
+void chain_save_segment_filters(chain *chn, const char *path);
+int chain_load_segment_filters(chain *chn, const char *path);
 void chain_free(chain *chn);
 
 int _num_chars_to_hold_int(int num);
 int _num_chars_to_hold_double(double num);
 int _num_chars_to_hold_transaction_serialisation(transaction trans);
 int _num_chars_to_hold_block_serialisation(block blk);
+int _invert_lowest_one(int num);
+int _skip_index(int index);
+void _chain_add_to_segment_filters(chain *chn, int index, transaction trans);
+void _segment_filters_add(bloom_filter **filters, int *num_filters, int index, transaction trans);
+chain_node *_chain_node_init_with_block(chain_node *prev_node, block blk);
+u64 _block_index_key(bitmap hash);
+void _chain_index_node(chain *chn, chain_node *node);
+void _chain_reserve_block_index(chain *chn, int num_blocks);
+void _chain_insert_node(chain *chn, chain_node *node);
+chain_node *_chain_link_hashed_block(chain *chn, block blk, bitmap hash);
+void _chain_append_derived(chain *chn, transaction_columns cols, bloom_filter *filters, int num_filters);
+void _chain_truncate_derived(chain *chn, int size);
+void _chain_publish_end(chain *chn, chain_node *node);
+void _chain_evict_cold_blocks(chain *chn);
+void _chain_node_evict(chain_node *node);
+void _balance_table_reserve(balance_table *table, int account_id);
 
 #endif
@@ -0,0 +1,49 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "bitmap.h"
+#include "bloom.h"
+
+// Initialise an empty bloom filter of `num_bits` bits, setting `num_hashes` bits per key
+bloom_filter bloom_filter_init(int num_bits, int num_hashes) {
+  if (num_bits <= 0 || num_hashes <= 0) {
+    fprintf(stderr, "Bloom filter cannot be initialised with %d bits and %d hashes.\n", num_bits, num_hashes);
+    exit(EXIT_FAILURE);
+  }
+
+  return (bloom_filter){bitmap_init_zeros(num_bits), num_hashes};
+}
+
+// Mix the bits of `key` (the splitmix64 finaliser), so that nearby keys such as account IDs spread out
+u64 _bloom_hash(u64 key) {
+  key += 0x9e3779b97f4a7c15ULL;
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+  return key ^ (key >> 31);
+}
+
+// Add `key` to `filter`. The probe positions are h1 + i * h2, with both halves taken from a single hash
+void bloom_filter_add(bloom_filter *filter, u64 key) {
+  u64 hash = _bloom_hash(key);
+  u64 h1 = hash & 0xffffffff;
+  u64 h2 = (hash >> 32) | 1;  // Odd, so the probes don't collapse onto the same bit
+
+  for (int i = 0; i < filter->num_hashes; i++) {
+    bitmap_set_bit(&(filter->bits), (h1 + i * h2) % filter->bits.size, 1);
+  }
+}
+
+// Get whether `key` may have been added to `filter`. A zero result means it definitely has not
+int bloom_filter_may_contain(bloom_filter filter, u64 key) {
+  u64 hash = _bloom_hash(key);
+  u64 h1 = hash & 0xffffffff;
+  u64 h2 = (hash >> 32) | 1;
+
+  for (int i = 0; i < filter.num_hashes; i++) {
+    if (!bitmap_get_bit(filter.bits, (h1 + i * h2) % filter.bits.size)) return 0;
+  }
+
+  return 1;
+}
+
+// Free the memory associated with `filter`
+void bloom_filter_free(bloom_filter *filter) { bitmap_free(&(filter->bits)); }
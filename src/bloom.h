@@ -0,0 +1,23 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include "bitmap.h"
+
+// About 10 bits and 7 hashes per key gives a false-positive rate of about 1%
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_FILTER_HASHES 7
+
+// Probabilistic set of 64-bit keys: may report false positives, but never false negatives
+typedef struct bloom_filter {
+  bitmap bits;
+  int num_hashes;
+} bloom_filter;
+
+bloom_filter bloom_filter_init(int num_bits, int num_hashes);
+void bloom_filter_add(bloom_filter *filter, u64 key);
+int bloom_filter_may_contain(bloom_filter filter, u64 key);
+void bloom_filter_free(bloom_filter *filter);
+
+u64 _bloom_hash(u64 key);
+
+#endif
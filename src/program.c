@@ -2,8 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include "blockchain.h"
+#include "storage.h"
 
 #define BUFFER_SIZE 20
+#define CHAIN_LOG_PATH "chain.log"
+#define BALANCE_SNAPSHOT_PATH "balances.snapshot"
+#define PENDING_LOG_PREFIX "pending.wal"
+#define CHAIN_HOT_BLOCKS 1024  // Newest blocks kept in memory, with older ones read back from the log when needed
+#define REINDEX_THREADS 4
 #define MAX_ID 1023
 #define MAX_AMOUNT 10000
 
@@ -42,6 +48,32 @@ int get_payee_id() {
   }
 }
 
+int get_account_id() {
+  char buffer[BUFFER_SIZE];
+
+  while (1) {
+    printf("Enter account ID > ");
+    fgets(buffer, BUFFER_SIZE, stdin);
+
+    int newline_found = 0;
+    for (int i = 0; i < BUFFER_SIZE; i++) {
+      if (buffer[i] == '\n') {
+        int account_id;
+        int found = sscanf(buffer, "%d", &account_id);
+
+        if (found && 0 <= account_id && account_id <= MAX_ID) return account_id;
+
+        newline_found = 1;
+        break;
+      }
+    }
+
+    if (!newline_found) clear_stdin();
+
+    printf("ID must be a number between 0 and %d.\n", MAX_ID);
+  }
+}
+
 int get_payer_id() {
   char buffer[BUFFER_SIZE];
 
@@ -94,35 +126,85 @@ double get_amount() {
   }
 }
 
-void add_transaction(chain *chn) {
+// Mine every pending transaction into `chn`, confirming each once its block is in the log
+void mine_pending(chain *chn, block_log *log, pending_log *pending, balance_table *balances) {
+  while (pending->queue_size > 0) {
+    transaction trans = pending->queue[pending->queue_head];
+    chain_add_node(chn, trans);
+    block_log_append(log, *chn->end->blk);
+    balance_table_apply(balances, trans);
+    pending_log_confirm(pending, 1);
+
+    if (chn->size % BALANCE_SNAPSHOT_INTERVAL == 0) {
+      balance_snapshot_save(*balances, chn->end, BALANCE_SNAPSHOT_PATH);
+    }
+  }
+}
+
+void add_transaction(chain *chn, block_log *log, pending_log *pending, balance_table *balances) {
   int payee_id = get_payee_id();
   int payer_id = get_payer_id();
   double amount = get_amount();
 
+  // The transaction is only acknowledged once it is on disk
+  pending_log_append(pending, transaction_init(amount, payer_id, payee_id));
+  pending_log_sync(pending);
+
   printf("\nTransaction of " AMOUNT_FORMAT " from %d to %d added.\nPress ENTER to continue > ", amount, payer_id,
          payee_id);
   clear_stdin();
 
-  transaction trans = transaction_init(amount, payer_id, payee_id);
-  chain_add_node(chn, trans);
+  mine_pending(chn, log, pending, balances);
 }
 
 void display_ledger(chain *chn) {
   printf("\nDisplaying ledger of size %d:\n", chn->size);
 
-  for (chain_node *p = chn->end; p != NULL; p = p->prev) {
+  // The transactions are read from the columns, as most blocks are only on disk
+  for (int i = chn->size - 1; i >= 0; i--) {
     printf("| ");
-    transaction_print_on_line(p->blk.trans);
+    transaction_print_on_line(transaction_columns_get(chn->columns, i));
   }
 
   printf("\nPress ENTER to continue > ");
   clear_stdin();
 }
 
-int main() {
+void display_balance(balance_table *balances) {
+  int account_id = get_account_id();
+
+  printf("\nAccount %d has balance " AMOUNT_FORMAT ".\nPress ENTER to continue > ", account_id,
+         balance_table_get(*balances, account_id));
+  clear_stdin();
+}
+
+int main(int argc, char **argv) {
+  int reindex = (argc == 2 && strcmp(argv[1], "--reindex") == 0);
+  if (argc > 1 && !reindex) {
+    fprintf(stderr, "Usage: %s [--reindex]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
   char buffer[BUFFER_SIZE];  // Buffer to hold user input
   chain chn = chain_init();
 
+  // Restore the chain from previous runs. A reindex rebuilds the chain and its balances from the log in parallel,
+  // without trusting the balance snapshot
+  block_log log = block_log_open(CHAIN_LOG_PATH, SYNC_EVERY_BLOCK, 0);
+  chain_use_block_log(&chn, &log, CHAIN_HOT_BLOCKS);
+  balance_table balances;
+  if (reindex) {
+    balances = balance_table_init();
+    block_log_reindex(&log, &chn, REINDEX_THREADS, &balances);
+  } else {
+    block_log_load(&log, &chn);
+    balances = chain_restore_balances(&chn, BALANCE_SNAPSHOT_PATH, NULL);
+  }
+
+  // Mine transactions that were acknowledged but not mined before the last run stopped
+  pending_log pending = pending_log_open(PENDING_LOG_PREFIX, 1, &chn);
+  mine_pending(&chn, &log, &pending, &balances);
+
   // TUI loop
   while (1) {
     clear_screen();
@@ -130,6 +212,7 @@ int main() {
         "-----| Blockchain Program |-----\n"
         "1 - Add transaction\n"
         "2 - View ledger\n"
+        "3 - View account balance\n"
         "0 - Quit\n"
         "Enter option > ");
 
@@ -146,9 +229,11 @@ int main() {
     }
 
     if (strcmp(buffer, "1") == 0) {
-      add_transaction(&chn);
+      add_transaction(&chn, &log, &pending, &balances);
     } else if (strcmp(buffer, "2") == 0) {
       display_ledger(&chn);
+    } else if (strcmp(buffer, "3") == 0) {
+      display_balance(&balances);
     } else if (strcmp(buffer, "0") == 0) {
       break;
     } else {
@@ -159,6 +244,11 @@ int main() {
     }
   }
 
+  if (chn.end != NULL) balance_snapshot_save(balances, chn.end, BALANCE_SNAPSHOT_PATH);
+
+  balance_table_free(&balances);
+  pending_log_close(&pending);
+  block_log_close(&log);
   chain_free(&chn);
 
   return EXIT_SUCCESS;
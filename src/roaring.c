@@ -0,0 +1,552 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bitmap.h"
+#include "roaring.h"
+
+// Initialise an empty roaring bitmap, which allocates nothing until a value is added
+roaring_bitmap roaring_init(void) { return (roaring_bitmap){NULL, NULL, 0, 0}; }
+
+// Get a roaring bitmap holding the indices of the set bits of `bmap`
+roaring_bitmap roaring_from_bitmap(bitmap bmap) {
+  roaring_bitmap result = roaring_init();
+  int num_chunks = (bmap.size + ROARING_CHUNK_BITS - 1) / ROARING_CHUNK_BITS;
+
+  for (int key = 0; key < num_chunks; key++) {
+    // Words past the end of `bmap` read as zero
+    u64 words[ROARING_BITSET_WORDS];
+    for (int i = 0; i < ROARING_BITSET_WORDS; i++) {
+      words[i] = _bitmap_get_word(bmap, key * ROARING_BITSET_WORDS + i);
+    }
+
+    roaring_container container = _container_from_words(words);
+    if (container.cardinality > 0) _roaring_insert_container(&result, result.num_containers, key, container);
+  }
+
+  return result;
+}
+
+// Get a bitmap of `size` bits with the bits at the values in `rbmap` set. Every value must be less than `size`
+bitmap roaring_to_bitmap(roaring_bitmap rbmap, int size) {
+  bitmap result = bitmap_init_zeros(size);
+
+  for (int c = 0; c < rbmap.num_containers; c++) {
+    u64 words[ROARING_BITSET_WORDS];
+    _container_to_words(rbmap.containers + c, words);
+
+    for (int i = 0; i < ROARING_BITSET_WORDS; i++) {
+      if (words[i] == 0) continue;
+
+      long long first_bit = ((long long)rbmap.keys[c] * ROARING_BITSET_WORDS + i) * WORD_SIZE;
+      int bits_in_range = (size - first_bit >= WORD_SIZE) ? WORD_SIZE : (size > first_bit) ? size - first_bit : 0;
+      if (bits_in_range < WORD_SIZE && (bits_in_range == 0 || words[i] << bits_in_range != 0)) {
+        fprintf(stderr, "Roaring bitmap has values past the end of a bitmap of size %d.\n", size);
+        exit(EXIT_FAILURE);
+      }
+
+      _bitmap_set_word(&result, first_bit / WORD_SIZE, words[i]);
+    }
+  }
+
+  return result;
+}
+
+// Add `value` to `rbmap`
+void roaring_add(roaring_bitmap *rbmap, u32 value) {
+  u16 key = value >> 16;
+  int index = _roaring_find_container(*rbmap, key);
+
+  if (index == rbmap->num_containers || rbmap->keys[index] != key) {
+    _roaring_insert_container(rbmap, index, key, _container_init_array(ROARING_INITIAL_CAPACITY));
+  }
+
+  _container_add(rbmap->containers + index, value & 0xFFFF);
+}
+
+// Get whether `value` is in `rbmap`
+int roaring_contains(roaring_bitmap rbmap, u32 value) {
+  u16 key = value >> 16;
+  int index = _roaring_find_container(rbmap, key);
+
+  return index < rbmap.num_containers && rbmap.keys[index] == key &&
+         _container_contains(rbmap.containers + index, value & 0xFFFF);
+}
+
+// Get the number of values in `rbmap`
+u64 roaring_cardinality(roaring_bitmap rbmap) {
+  u64 cardinality = 0;
+  for (int i = 0; i < rbmap.num_containers; i++) cardinality += rbmap.containers[i].cardinality;
+
+  return cardinality;
+}
+
+// Get the intersection of `rbmap1` and `rbmap2`
+roaring_bitmap roaring_and(roaring_bitmap rbmap1, roaring_bitmap rbmap2) {
+  return _roaring_operator(rbmap1, rbmap2, AND);
+}
+
+// Get the union of `rbmap1` and `rbmap2`
+roaring_bitmap roaring_or(roaring_bitmap rbmap1, roaring_bitmap rbmap2) {
+  return _roaring_operator(rbmap1, rbmap2, OR);
+}
+
+// Get the values in exactly one of `rbmap1` and `rbmap2`
+roaring_bitmap roaring_xor(roaring_bitmap rbmap1, roaring_bitmap rbmap2) {
+  return _roaring_operator(rbmap1, rbmap2, XOR);
+}
+
+// Convert every container of `rbmap` to whichever form is smallest for its values. Adding values keeps containers
+// in the form they are in (apart from full arrays becoming bitsets), so this is worth calling after building a
+// bitmap one value at a time
+void roaring_optimise(roaring_bitmap *rbmap) {
+  for (int i = 0; i < rbmap->num_containers; i++) {
+    u64 words[ROARING_BITSET_WORDS];
+    _container_to_words(rbmap->containers + i, words);
+    _container_free(rbmap->containers + i);
+    rbmap->containers[i] = _container_from_words(words);
+  }
+}
+
+// Get an iterator at the start of `rbmap`, which must not change while the iterator is in use
+roaring_iterator roaring_iterator_init(roaring_bitmap *rbmap) { return (roaring_iterator){rbmap, 0, 0, 0}; }
+
+// Store the next value of the iterator's bitmap in `value`, in increasing order. Returns 0 once every value has
+// been visited
+int roaring_iterator_next(roaring_iterator *it, u32 *value) {
+  while (it->container_index < it->rbmap->num_containers) {
+    roaring_container *container = it->rbmap->containers + it->container_index;
+    u32 high = (u32)it->rbmap->keys[it->container_index] << 16;
+
+    switch (container->type) {
+      case CONTAINER_ARRAY:
+        if (it->position < container->cardinality) {
+          *value = high | container->values[it->position++];
+          return 1;
+        }
+        break;
+      case CONTAINER_BITSET: {
+        int next = _words_find_next(container->words, it->position, 0);
+        if (next < ROARING_CHUNK_BITS) {
+          *value = high | next;
+          it->position = next + 1;
+          return 1;
+        }
+        break;
+      }
+      case CONTAINER_RUN:
+        if (it->position < container->num_runs) {
+          roaring_run run = container->runs[it->position];
+          *value = high | (run.start + it->run_offset);
+          if (it->run_offset++ == run.length) {
+            it->position++;
+            it->run_offset = 0;
+          }
+          return 1;
+        }
+        break;
+    }
+
+    it->container_index++;
+    it->position = 0;
+    it->run_offset = 0;
+  }
+
+  return 0;
+}
+
+// Free the containers of `rbmap`, leaving it empty
+void roaring_free(roaring_bitmap *rbmap) {
+  for (int i = 0; i < rbmap->num_containers; i++) _container_free(rbmap->containers + i);
+  free(rbmap->keys);
+  free(rbmap->containers);
+  *rbmap = roaring_init();
+}
+
+// Apply `operation` to `rbmap1` and `rbmap2` chunk by chunk. A chunk in only one of them is copied as it is,
+// unless the operation is AND
+roaring_bitmap _roaring_operator(roaring_bitmap rbmap1, roaring_bitmap rbmap2, DualOperator operation) {
+  roaring_bitmap result = roaring_init();
+  int i = 0, j = 0;
+
+  while (i < rbmap1.num_containers || j < rbmap2.num_containers) {
+    if (j == rbmap2.num_containers || (i < rbmap1.num_containers && rbmap1.keys[i] < rbmap2.keys[j])) {
+      if (operation != AND) {
+        _roaring_insert_container(&result, result.num_containers, rbmap1.keys[i],
+                                  _container_copy(rbmap1.containers + i));
+      }
+      i++;
+    } else if (i == rbmap1.num_containers || rbmap2.keys[j] < rbmap1.keys[i]) {
+      if (operation != AND) {
+        _roaring_insert_container(&result, result.num_containers, rbmap2.keys[j],
+                                  _container_copy(rbmap2.containers + j));
+      }
+      j++;
+    } else {
+      roaring_container container = _container_operator(rbmap1.containers + i, rbmap2.containers + j, operation);
+      if (container.cardinality > 0) {
+        _roaring_insert_container(&result, result.num_containers, rbmap1.keys[i], container);
+      } else {
+        _container_free(&container);
+      }
+      i++;
+      j++;
+    }
+  }
+
+  return result;
+}
+
+// Get the index of the container for `key` in `rbmap`, or where it would be inserted if there isn't one
+int _roaring_find_container(roaring_bitmap rbmap, u16 key) {
+  int low = 0, high = rbmap.num_containers;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (rbmap.keys[middle] < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+// Insert `container` for chunk `key` at `index` of `rbmap`, which takes ownership of it
+void _roaring_insert_container(roaring_bitmap *rbmap, int index, u16 key, roaring_container container) {
+  if (rbmap->num_containers == rbmap->capacity) {
+    rbmap->capacity = (rbmap->capacity == 0) ? ROARING_INITIAL_CAPACITY : 2 * rbmap->capacity;
+    rbmap->keys = _roaring_alloc(rbmap->keys, rbmap->capacity, sizeof *rbmap->keys);
+    rbmap->containers = _roaring_alloc(rbmap->containers, rbmap->capacity, sizeof *rbmap->containers);
+  }
+
+  int num_after = rbmap->num_containers - index;
+  memmove(rbmap->keys + index + 1, rbmap->keys + index, num_after * sizeof *rbmap->keys);
+  memmove(rbmap->containers + index + 1, rbmap->containers + index, num_after * sizeof *rbmap->containers);
+  rbmap->keys[index] = key;
+  rbmap->containers[index] = container;
+  rbmap->num_containers++;
+}
+
+// Initialise an empty array container with room for `capacity` values
+roaring_container _container_init_array(int capacity) {
+  roaring_container container = {CONTAINER_ARRAY, 0, 0, capacity, NULL, NULL, NULL};
+  container.values = _roaring_alloc(NULL, capacity, sizeof *container.values);
+
+  return container;
+}
+
+// Get a container for the values set in the chunk `words`, in whichever form takes the least memory: an array of
+// values, a bitset, or runs. The container is empty (and allocates nothing) if no values are set
+roaring_container _container_from_words(const u64 *words) {
+  // A run starts at each set bit whose previous bit, which may be in the previous word, is clear
+  int cardinality = 0, num_runs = 0;
+  u64 previous_bit = 0;
+  for (int i = 0; i < ROARING_BITSET_WORDS; i++) {
+    cardinality += __builtin_popcountll(words[i]);
+    num_runs += __builtin_popcountll(words[i] & ~((words[i] >> 1) | (previous_bit << (WORD_SIZE - 1))));
+    previous_bit = words[i] & 1;
+  }
+
+  roaring_container container = {CONTAINER_ARRAY, cardinality, 0, 0, NULL, NULL, NULL};
+  if (cardinality == 0) return container;
+
+  int run_bytes = num_runs * sizeof(roaring_run);
+  if (run_bytes < cardinality * (int)sizeof(u16) && run_bytes < ROARING_BITSET_WORDS * (int)sizeof(u64)) {
+    container.type = CONTAINER_RUN;
+    container.num_runs = container.capacity = num_runs;
+    container.runs = _roaring_alloc(NULL, num_runs, sizeof *container.runs);
+
+    int start = _words_find_next(words, 0, 0);
+    for (int r = 0; r < num_runs; r++) {
+      int end = _words_find_next(words, start, 1);
+      container.runs[r] = (roaring_run){start, end - 1 - start};
+      start = _words_find_next(words, end, 0);
+    }
+  } else if (cardinality <= ROARING_ARRAY_MAX) {
+    container.capacity = cardinality;
+    container.values = _roaring_alloc(NULL, cardinality, sizeof *container.values);
+
+    int num_values = 0;
+    for (int i = 0; i < ROARING_BITSET_WORDS; i++) {
+      for (u64 word = words[i]; word != 0; word &= ~(1ULL << (WORD_SIZE - 1 - __builtin_clzll(word)))) {
+        container.values[num_values++] = i * WORD_SIZE + __builtin_clzll(word);
+      }
+    }
+  } else {
+    container.type = CONTAINER_BITSET;
+    container.words = _roaring_alloc(NULL, ROARING_BITSET_WORDS, sizeof *container.words);
+    memcpy(container.words, words, ROARING_BITSET_WORDS * sizeof *container.words);
+  }
+
+  return container;
+}
+
+// Get a copy of `container`
+roaring_container _container_copy(roaring_container *container) {
+  roaring_container result = *container;
+
+  switch (container->type) {
+    case CONTAINER_ARRAY:
+      result.values = _roaring_alloc(NULL, container->capacity, sizeof *result.values);
+      memcpy(result.values, container->values, container->cardinality * sizeof *result.values);
+      break;
+    case CONTAINER_BITSET:
+      result.words = _roaring_alloc(NULL, ROARING_BITSET_WORDS, sizeof *result.words);
+      memcpy(result.words, container->words, ROARING_BITSET_WORDS * sizeof *result.words);
+      break;
+    case CONTAINER_RUN:
+      result.runs = _roaring_alloc(NULL, container->capacity, sizeof *result.runs);
+      memcpy(result.runs, container->runs, container->num_runs * sizeof *result.runs);
+      break;
+  }
+
+  return result;
+}
+
+// Apply `operation` to two containers of the same chunk. Two arrays are merged, and an AND with an array only
+// checks the array's values; anything else is done a word at a time on bitsets
+roaring_container _container_operator(roaring_container *container1, roaring_container *container2,
+                                      DualOperator operation) {
+  if (container1->type == CONTAINER_ARRAY && container2->type == CONTAINER_ARRAY) {
+    return _container_merge_arrays(container1, container2, operation);
+  }
+  if (operation == AND && container1->type == CONTAINER_ARRAY) {
+    return _container_filter_array(container1, container2);
+  }
+  if (operation == AND && container2->type == CONTAINER_ARRAY) {
+    return _container_filter_array(container2, container1);
+  }
+
+  u64 words1[ROARING_BITSET_WORDS], words2[ROARING_BITSET_WORDS];
+  _container_to_words(container1, words1);
+  _container_to_words(container2, words2);
+  _bitmap_bytes_operator((byte *)words1, (byte *)words1, (byte *)words2, sizeof words1, operation);
+
+  return _container_from_words(words1);
+}
+
+// Apply `operation` to two array containers by merging their sorted values
+roaring_container _container_merge_arrays(roaring_container *container1, roaring_container *container2,
+                                          DualOperator operation) {
+  roaring_container result = _container_init_array(container1->cardinality + container2->cardinality);
+  const u16 *values1 = container1->values, *values2 = container2->values;
+  int i = 0, j = 0;
+
+  while (i < container1->cardinality || j < container2->cardinality) {
+    if (j == container2->cardinality || (i < container1->cardinality && values1[i] < values2[j])) {
+      if (operation != AND) result.values[result.cardinality++] = values1[i];
+      i++;
+    } else if (i == container1->cardinality || values2[j] < values1[i]) {
+      if (operation != AND) result.values[result.cardinality++] = values2[j];
+      j++;
+    } else {
+      if (operation != XOR) result.values[result.cardinality++] = values1[i];
+      i++;
+      j++;
+    }
+  }
+
+  // A union can have too many values for an array
+  if (result.cardinality > ROARING_ARRAY_MAX) {
+    u64 words[ROARING_BITSET_WORDS];
+    _container_to_words(&result, words);
+    _container_free(&result);
+    result = _container_from_words(words);
+  }
+
+  return result;
+}
+
+// Get an array container of the values of `array` that are also in `other`
+roaring_container _container_filter_array(roaring_container *array, roaring_container *other) {
+  roaring_container result = _container_init_array(array->cardinality);
+
+  for (int i = 0; i < array->cardinality; i++) {
+    if (_container_contains(other, array->values[i])) result.values[result.cardinality++] = array->values[i];
+  }
+
+  return result;
+}
+
+// Write the values of `container` as a bitset of `ROARING_BITSET_WORDS` words to `words`
+void _container_to_words(roaring_container *container, u64 *words) {
+  if (container->type == CONTAINER_BITSET) {
+    memcpy(words, container->words, ROARING_BITSET_WORDS * sizeof *words);
+    return;
+  }
+
+  memset(words, 0, ROARING_BITSET_WORDS * sizeof *words);
+  if (container->type == CONTAINER_ARRAY) {
+    for (int i = 0; i < container->cardinality; i++) {
+      u16 low = container->values[i];
+      words[low / WORD_SIZE] |= 1ULL << (WORD_SIZE - 1 - low % WORD_SIZE);
+    }
+  } else {
+    for (int i = 0; i < container->num_runs; i++) {
+      _words_set_range(words, container->runs[i].start, container->runs[i].start + container->runs[i].length);
+    }
+  }
+}
+
+// Get whether `low` is in `container`
+int _container_contains(roaring_container *container, u16 low) {
+  switch (container->type) {
+    case CONTAINER_ARRAY: {
+      int first = 0, last = container->cardinality - 1;
+      while (first <= last) {
+        int middle = first + (last - first) / 2;
+        if (container->values[middle] == low) return 1;
+        if (container->values[middle] < low) {
+          first = middle + 1;
+        } else {
+          last = middle - 1;
+        }
+      }
+      return 0;
+    }
+    case CONTAINER_BITSET:
+      return (container->words[low / WORD_SIZE] >> (WORD_SIZE - 1 - low % WORD_SIZE)) & 1;
+    case CONTAINER_RUN: {
+      int run = _container_find_run(container, low);
+      return run >= 0 && low <= container->runs[run].start + container->runs[run].length;
+    }
+  }
+
+  return 0;
+}
+
+// Add `low` to `container`, keeping it in the same form except that a full array becomes a bitset
+void _container_add(roaring_container *container, u16 low) {
+  if (_container_contains(container, low)) return;
+
+  switch (container->type) {
+    case CONTAINER_ARRAY:
+      if (container->cardinality == ROARING_ARRAY_MAX) {
+        u64 *words = _roaring_alloc(NULL, ROARING_BITSET_WORDS, sizeof *words);
+        _container_to_words(container, words);
+        _container_free(container);
+        container->type = CONTAINER_BITSET;
+        container->words = words;
+        container->capacity = 0;
+        _container_add(container, low);
+        return;
+      }
+
+      if (container->cardinality == container->capacity) {
+        container->capacity = (container->capacity == 0) ? ROARING_INITIAL_CAPACITY : 2 * container->capacity;
+        if (container->capacity > ROARING_ARRAY_MAX) container->capacity = ROARING_ARRAY_MAX;
+        container->values = _roaring_alloc(container->values, container->capacity, sizeof *container->values);
+      }
+
+      int index = container->cardinality;
+      while (index > 0 && container->values[index - 1] > low) index--;
+      memmove(container->values + index + 1, container->values + index,
+              (container->cardinality - index) * sizeof *container->values);
+      container->values[index] = low;
+      break;
+    case CONTAINER_BITSET:
+      container->words[low / WORD_SIZE] |= 1ULL << (WORD_SIZE - 1 - low % WORD_SIZE);
+      break;
+    case CONTAINER_RUN: {
+      // Extend the run ending just before `low` or the one starting just after it, joining them if both exist,
+      // or else start a new run
+      roaring_run *runs = container->runs;
+      int before = _container_find_run(container, low);
+      int after = before + 1;
+      int joins_before = (before >= 0 && runs[before].start + runs[before].length + 1 == low);
+      int joins_after = (after < container->num_runs && runs[after].start == low + 1);
+
+      if (joins_before && joins_after) {
+        runs[before].length += runs[after].length + 2;
+        memmove(runs + after, runs + after + 1, (container->num_runs - after - 1) * sizeof *runs);
+        container->num_runs--;
+      } else if (joins_before) {
+        runs[before].length++;
+      } else if (joins_after) {
+        runs[after].start--;
+        runs[after].length++;
+      } else {
+        if (container->num_runs == container->capacity) {
+          container->capacity = 2 * container->capacity;
+          container->runs = runs = _roaring_alloc(runs, container->capacity, sizeof *runs);
+        }
+        memmove(runs + after + 1, runs + after, (container->num_runs - after) * sizeof *runs);
+        runs[after] = (roaring_run){low, 0};
+        container->num_runs++;
+      }
+      break;
+    }
+  }
+
+  container->cardinality++;
+}
+
+// Get the index of the last run of `container` that starts at or before `low`, or -1 if there isn't one
+int _container_find_run(roaring_container *container, u16 low) {
+  int first = 0, last = container->num_runs - 1, found = -1;
+  while (first <= last) {
+    int middle = first + (last - first) / 2;
+    if (container->runs[middle].start <= low) {
+      found = middle;
+      first = middle + 1;
+    } else {
+      last = middle - 1;
+    }
+  }
+
+  return found;
+}
+
+// Free the memory of `container`
+void _container_free(roaring_container *container) {
+  free(container->values);
+  free(container->words);
+  free(container->runs);
+  container->values = NULL;
+  container->words = NULL;
+  container->runs = NULL;
+}
+
+// Get the index of the first bit at or after `start` in the chunk `words` that is set, or clear if `find_clear` is
+// 1, or `ROARING_CHUNK_BITS` if there isn't one
+int _words_find_next(const u64 *words, int start, int find_clear) {
+  if (start >= ROARING_CHUNK_BITS) return ROARING_CHUNK_BITS;
+
+  int word_index = start / WORD_SIZE;
+  u64 flip = find_clear ? ~0ULL : 0;
+  u64 word = (words[word_index] ^ flip) & (~0ULL >> (start % WORD_SIZE));
+
+  while (word == 0) {
+    if (++word_index == ROARING_BITSET_WORDS) return ROARING_CHUNK_BITS;
+    word = words[word_index] ^ flip;
+  }
+
+  return word_index * WORD_SIZE + __builtin_clzll(word);
+}
+
+// Set the bits from `start` to `end` inclusive in the chunk `words`
+void _words_set_range(u64 *words, int start, int end) {
+  int first_word = start / WORD_SIZE, last_word = end / WORD_SIZE;
+  u64 first_mask = ~0ULL >> (start % WORD_SIZE);
+  u64 last_mask = ~0ULL << (WORD_SIZE - 1 - end % WORD_SIZE);
+
+  if (first_word == last_word) {
+    words[first_word] |= first_mask & last_mask;
+    return;
+  }
+
+  words[first_word] |= first_mask;
+  for (int i = first_word + 1; i < last_word; i++) words[i] = ~0ULL;
+  words[last_word] |= last_mask;
+}
+
+// Resize `memory` (which may be NULL) to hold `num_elements` elements of `element_size` bytes
+void *_roaring_alloc(void *memory, int num_elements, int element_size) {
+  void *result = realloc(memory, (size_t)num_elements * element_size);
+  if (!result && num_elements > 0) {
+    fprintf(stderr, "Failed to allocate memory for roaring bitmap.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return result;
+}
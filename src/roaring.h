@@ -0,0 +1,89 @@
+#ifndef ROARING_H
+#define ROARING_H
+
+#include "bitmap.h"
+
+#define ROARING_CHUNK_BITS 65536
+#define ROARING_BITSET_WORDS (ROARING_CHUNK_BITS / WORD_SIZE)
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_INITIAL_CAPACITY 4
+
+typedef unsigned short u16;
+
+// How a container stores the low 16 bits of the values in its chunk
+typedef enum RoaringContainerType { CONTAINER_ARRAY, CONTAINER_BITSET, CONTAINER_RUN } RoaringContainerType;
+
+// The values `start` to `start + length` inclusive
+typedef struct roaring_run {
+  u16 start;
+  u16 length;
+} roaring_run;
+
+// The values in one chunk of `ROARING_CHUNK_BITS` values. An array holds up to `ROARING_ARRAY_MAX` sorted values,
+// a bitset holds a bit per value (most significant bit first, as in `bitmap`), and a run container holds sorted
+// runs that don't touch. Only the pointer for `type` is set
+typedef struct roaring_container {
+  RoaringContainerType type;
+  int cardinality;
+  int num_runs;
+  int capacity;  // Values or runs allocated
+  u16 *values;
+  u64 *words;
+  roaring_run *runs;
+} roaring_container;
+
+// A compressed set of 32-bit values. Values are split into chunks by their high 16 bits, and each chunk with any
+// values in it has a container for their low 16 bits, in whichever form is smallest for its contents. Memory is
+// proportional to the values present rather than the largest one
+typedef struct roaring_bitmap {
+  u16 *keys;
+  roaring_container *containers;
+  int num_containers;
+  int capacity;
+} roaring_bitmap;
+
+// A position in a roaring bitmap, for visiting its values in order
+typedef struct roaring_iterator {
+  roaring_bitmap *rbmap;
+  int container_index;
+  int position;  // Index of the value, bit or run within the container
+  int run_offset;
+} roaring_iterator;
+
+roaring_bitmap roaring_init(void);
+roaring_bitmap roaring_from_bitmap(bitmap bmap);
+bitmap roaring_to_bitmap(roaring_bitmap rbmap, int size);
+void roaring_add(roaring_bitmap *rbmap, u32 value);
+int roaring_contains(roaring_bitmap rbmap, u32 value);
+u64 roaring_cardinality(roaring_bitmap rbmap);
+roaring_bitmap roaring_and(roaring_bitmap rbmap1, roaring_bitmap rbmap2);
+roaring_bitmap roaring_or(roaring_bitmap rbmap1, roaring_bitmap rbmap2);
+roaring_bitmap roaring_xor(roaring_bitmap rbmap1, roaring_bitmap rbmap2);
+void roaring_optimise(roaring_bitmap *rbmap);
+roaring_iterator roaring_iterator_init(roaring_bitmap *rbmap);
+int roaring_iterator_next(roaring_iterator *it, u32 *value);
+void roaring_free(roaring_bitmap *rbmap);
+
+roaring_bitmap _roaring_operator(roaring_bitmap rbmap1, roaring_bitmap rbmap2, DualOperator operation);
+int _roaring_find_container(roaring_bitmap rbmap, u16 key);
+void _roaring_insert_container(roaring_bitmap *rbmap, int index, u16 key, roaring_container container);
+
+roaring_container _container_init_array(int capacity);
+roaring_container _container_from_words(const u64 *words);
+roaring_container _container_copy(roaring_container *container);
+roaring_container _container_operator(roaring_container *container1, roaring_container *container2,
+                                      DualOperator operation);
+roaring_container _container_merge_arrays(roaring_container *container1, roaring_container *container2,
+                                          DualOperator operation);
+roaring_container _container_filter_array(roaring_container *array, roaring_container *other);
+void _container_to_words(roaring_container *container, u64 *words);
+int _container_contains(roaring_container *container, u16 low);
+void _container_add(roaring_container *container, u16 low);
+int _container_find_run(roaring_container *container, u16 low);
+void _container_free(roaring_container *container);
+
+int _words_find_next(const u64 *words, int start, int find_clear);
+void _words_set_range(u64 *words, int start, int end);
+void *_roaring_alloc(void *memory, int num_elements, int element_size);
+
+#endif
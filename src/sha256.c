@@ -16,14 +16,17 @@ static const int H0[NUM_WORKING_VARS] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa
                                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
 
 // Convert `message` to a bitmap whose length is a multiple of 512 and is of the correct form for SHA-256
-bitmap _pad_message(const char *message, int char_count) {
+bitmap _pad_message(const char *message, int char_count) { return _pad_message_in(NULL, message, char_count); }
+
+// Convert `message` to a padded bitmap as `_pad_message` does, made in `arena` (or on the heap if it is NULL)
+bitmap _pad_message_in(bitmap_arena *arena, const char *message, int char_count) {
   int l = char_count * BYTE_SIZE;
   int k = MESSAGE_BLOCK_SIZE - MESSAGE_LENGTH_SIZE - ((l + 1) % MESSAGE_BLOCK_SIZE);
   if (k < 0) k += MESSAGE_BLOCK_SIZE;
 
   // message | 1 | k zeros | length of message
   int size = l + 1 + k + MESSAGE_LENGTH_SIZE;
-  bitmap padded_message = bitmap_init_zeros(size);
+  bitmap padded_message = bitmap_init_zeros_in(arena, size);
 
   for (int i = 0; i < char_count; i++) {
     bitmap_set_byte(&padded_message, i, message[i]);
@@ -40,71 +43,95 @@ bitmap _pad_message(const char *message, int char_count) {
 
 // SHA-256 helper function
 bitmap _lower_sigma_0(bitmap bmap) {
-  bitmap bmap1 = bitmap_rrotate(bmap, 7);
-  bitmap bmap2 = bitmap_rrotate(bmap, 18);
-  bitmap bmap3 = bitmap_rshift(bmap, 3);
-  bitmap bmap4 = bitmap_xor(bmap1, bmap2);
-  bitmap result = bitmap_xor(bmap4, bmap3);
-
-  bitmap_free(&bmap1);
-  bitmap_free(&bmap2);
-  bitmap_free(&bmap3);
-  bitmap_free(&bmap4);
+  bitmap result = bitmap_init_zeros(bmap.size);
+  _lower_sigma_0_into(&result, bmap);
 
   return result;
 }
 
+// SHA-256 helper function, storing the result in `dest`, which must be the same size as `bmap`
+void _lower_sigma_0_into(bitmap *dest, bitmap bmap) {
+  bitmap term = bitmap_init_zeros(bmap.size);
+
+  bitmap_rrotate_into(dest, bmap, 7);
+  bitmap_rrotate_into(&term, bmap, 18);
+  bitmap_xor_into(dest, *dest, term);
+  bitmap_rshift_into(&term, bmap, 3);
+  bitmap_xor_into(dest, *dest, term);
+
+  bitmap_free(&term);
+}
+
 // SHA-256 helper function
 bitmap _lower_sigma_1(bitmap bmap) {
-  bitmap bmap1 = bitmap_rrotate(bmap, 17);
-  bitmap bmap2 = bitmap_rrotate(bmap, 19);
-  bitmap bmap3 = bitmap_rshift(bmap, 10);
-  bitmap bmap4 = bitmap_xor(bmap1, bmap2);
-  bitmap result = bitmap_xor(bmap4, bmap3);
-
-  bitmap_free(&bmap1);
-  bitmap_free(&bmap2);
-  bitmap_free(&bmap3);
-  bitmap_free(&bmap4);
+  bitmap result = bitmap_init_zeros(bmap.size);
+  _lower_sigma_1_into(&result, bmap);
 
   return result;
 }
 
+// SHA-256 helper function, storing the result in `dest`, which must be the same size as `bmap`
+void _lower_sigma_1_into(bitmap *dest, bitmap bmap) {
+  bitmap term = bitmap_init_zeros(bmap.size);
+
+  bitmap_rrotate_into(dest, bmap, 17);
+  bitmap_rrotate_into(&term, bmap, 19);
+  bitmap_xor_into(dest, *dest, term);
+  bitmap_rshift_into(&term, bmap, 10);
+  bitmap_xor_into(dest, *dest, term);
+
+  bitmap_free(&term);
+}
+
 // SHA-256 helper function
 bitmap _upper_sigma_0(bitmap bmap) {
-  bitmap bmap1 = bitmap_rrotate(bmap, 2);
-  bitmap bmap2 = bitmap_rrotate(bmap, 13);
-  bitmap bmap3 = bitmap_rrotate(bmap, 22);
-  bitmap bmap4 = bitmap_xor(bmap1, bmap2);
-  bitmap result = bitmap_xor(bmap4, bmap3);
-
-  bitmap_free(&bmap1);
-  bitmap_free(&bmap2);
-  bitmap_free(&bmap3);
-  bitmap_free(&bmap4);
+  bitmap result = bitmap_init_zeros(bmap.size);
+  _upper_sigma_0_into(&result, bmap);
 
   return result;
 }
 
+// SHA-256 helper function, storing the result in `dest`, which must be the same size as `bmap`
+void _upper_sigma_0_into(bitmap *dest, bitmap bmap) {
+  bitmap term = bitmap_init_zeros(bmap.size);
+
+  bitmap_rrotate_into(dest, bmap, 2);
+  bitmap_rrotate_into(&term, bmap, 13);
+  bitmap_xor_into(dest, *dest, term);
+  bitmap_rrotate_into(&term, bmap, 22);
+  bitmap_xor_into(dest, *dest, term);
+
+  bitmap_free(&term);
+}
+
 // SHA-256 helper function
 bitmap _upper_sigma_1(bitmap bmap) {
-  bitmap bmap1 = bitmap_rrotate(bmap, 6);
-  bitmap bmap2 = bitmap_rrotate(bmap, 11);
-  bitmap bmap3 = bitmap_rrotate(bmap, 25);
-  bitmap bmap4 = bitmap_xor(bmap1, bmap2);
-  bitmap result = bitmap_xor(bmap4, bmap3);
-
-  bitmap_free(&bmap1);
-  bitmap_free(&bmap2);
-  bitmap_free(&bmap3);
-  bitmap_free(&bmap4);
+  bitmap result = bitmap_init_zeros(bmap.size);
+  _upper_sigma_1_into(&result, bmap);
 
   return result;
 }
 
+// SHA-256 helper function, storing the result in `dest`, which must be the same size as `bmap`
+void _upper_sigma_1_into(bitmap *dest, bitmap bmap) {
+  bitmap term = bitmap_init_zeros(bmap.size);
+
+  bitmap_rrotate_into(dest, bmap, 6);
+  bitmap_rrotate_into(&term, bmap, 11);
+  bitmap_xor_into(dest, *dest, term);
+  bitmap_rrotate_into(&term, bmap, 25);
+  bitmap_xor_into(dest, *dest, term);
+
+  bitmap_free(&term);
+}
+
 // Perform the SHA-256 hashing algorithm on the string `message`, returning the result as a bitmap
-bitmap sha256(const char *message) {
-  bitmap padded_message = _pad_message(message, strlen(message));
+bitmap sha256(const char *message) { return sha256_in(NULL, message); }
+
+// Perform SHA-256 on `message` as `sha256` does, with the padded message made in `arena` if it isn't NULL. Every
+// other intermediate is stored inline, so hashing with an arena that has room does no allocation at all
+bitmap sha256_in(bitmap_arena *arena, const char *message) {
+  bitmap padded_message = _pad_message_in(arena, message, strlen(message));
 
   // Set up K as bitmaps from the constants
   bitmap K[NUM_WORK_ITERATIONS];
@@ -130,17 +157,14 @@ bitmap sha256(const char *message) {
     }
 
     // The remaining entries are defined from a recurrence relation
+    bitmap term = bitmap_init_zeros(WORD_LENGTH);
     for (int t = MESSAGE_BLOCK_SIZE / WORD_LENGTH; t < SCHEDULE_LENGTH; t++) {
-      bitmap term1 = _lower_sigma_1(W[t - 2]);
-      bitmap term2 = _lower_sigma_0(W[t - 15]);
-      bitmap term3 = bitmap_add_mod(term1, W[t - 7]);
-      bitmap term4 = bitmap_add_mod(term2, W[t - 16]);
-      W[t] = bitmap_add_mod(term3, term4);
-
-      bitmap_free(&term1);
-      bitmap_free(&term2);
-      bitmap_free(&term3);
-      bitmap_free(&term4);
+      W[t] = bitmap_init_zeros(WORD_LENGTH);
+      _lower_sigma_1_into(W + t, W[t - 2]);
+      bitmap_add_mod_into(W + t, W[t], W[t - 7]);
+      _lower_sigma_0_into(&term, W[t - 15]);
+      bitmap_add_mod_into(W + t, W[t], term);
+      bitmap_add_mod_into(W + t, W[t], W[t - 16]);
     }
 
     // a0 b1 c2 d3 e4 f5 g6 h7
@@ -149,55 +173,40 @@ bitmap sha256(const char *message) {
       working_vars[k] = bitmap_copy(H[k]);
     }
 
+    // Every intermediate value is written into T1, T2 or `term`, so the rounds allocate nothing
+    bitmap T1 = bitmap_init_zeros(WORD_LENGTH);
+    bitmap T2 = bitmap_init_zeros(WORD_LENGTH);
     for (int t = 0; t < NUM_WORK_ITERATIONS; t++) {
-      bitmap term1 = _upper_sigma_1(working_vars[4]);
-      bitmap term2 = bitmap_choose(working_vars[4], working_vars[5], working_vars[6]);
-      bitmap term3 = bitmap_add_mod(working_vars[7], term1);
-      bitmap term4 = bitmap_add_mod(term3, term2);
-      bitmap term5 = bitmap_add_mod(term4, K[t]);
-      bitmap T1 = bitmap_add_mod(term5, W[t]);
-
-      bitmap term6 = _upper_sigma_0(working_vars[0]);
-      bitmap term7 = bitmap_majority(working_vars[0], working_vars[1], working_vars[2]);
-      bitmap T2 = bitmap_add_mod(term6, term7);
-
-      bitmap_free(&term1);
-      bitmap_free(&term2);
-      bitmap_free(&term3);
-      bitmap_free(&term4);
-      bitmap_free(&term5);
-      bitmap_free(&term6);
-      bitmap_free(&term7);
-
-      // Need to free old bitmaps before replacing in each of the working variables
-      bitmap_free(working_vars + 7);
-      working_vars[7] = bitmap_copy(working_vars[6]);
-      bitmap_free(working_vars + 6);
-      working_vars[6] = bitmap_copy(working_vars[5]);
-      bitmap_free(working_vars + 5);
-      working_vars[5] = bitmap_copy(working_vars[4]);
-      bitmap_free(working_vars + 4);
-      working_vars[4] = bitmap_add_mod(working_vars[3], T1);
-      bitmap_free(working_vars + 3);
-      working_vars[3] = bitmap_copy(working_vars[2]);
-      bitmap_free(working_vars + 2);
-      working_vars[2] = bitmap_copy(working_vars[1]);
-      bitmap_free(working_vars + 1);
-      working_vars[1] = bitmap_copy(working_vars[0]);
-      bitmap_free(working_vars + 0);
-      working_vars[0] = bitmap_add_mod(T1, T2);
-
-      bitmap_free(&T1);
-      bitmap_free(&T2);
+      _upper_sigma_1_into(&T1, working_vars[4]);
+      bitmap_add_mod_into(&T1, T1, working_vars[7]);
+      bitmap_choose_into(&term, working_vars[4], working_vars[5], working_vars[6]);
+      bitmap_add_mod_into(&T1, T1, term);
+      bitmap_add_mod_into(&T1, T1, K[t]);
+      bitmap_add_mod_into(&T1, T1, W[t]);
+
+      _upper_sigma_0_into(&T2, working_vars[0]);
+      bitmap_majority_into(&term, working_vars[0], working_vars[1], working_vars[2]);
+      bitmap_add_mod_into(&T2, T2, term);
+
+      bitmap_copy_into(working_vars + 7, working_vars[6]);
+      bitmap_copy_into(working_vars + 6, working_vars[5]);
+      bitmap_copy_into(working_vars + 5, working_vars[4]);
+      bitmap_add_mod_into(working_vars + 4, working_vars[3], T1);
+      bitmap_copy_into(working_vars + 3, working_vars[2]);
+      bitmap_copy_into(working_vars + 2, working_vars[1]);
+      bitmap_copy_into(working_vars + 1, working_vars[0]);
+      bitmap_add_mod_into(working_vars + 0, T1, T2);
     }
 
     for (int k = 0; k < NUM_WORKING_VARS; k++) {
-      bitmap sum = bitmap_add_mod(working_vars[k], H[k]);
-      bitmap_free(H + k);
+      bitmap_add_mod_into(H + k, H[k], working_vars[k]);
       bitmap_free(working_vars + k);
-      H[k] = sum;
     }
 
+    bitmap_free(&T1);
+    bitmap_free(&T2);
+    bitmap_free(&term);
+
     for (int k = 0; k < SCHEDULE_LENGTH; k++) {
       bitmap_free(W + k);
     }
@@ -206,7 +215,7 @@ bitmap sha256(const char *message) {
   bitmap result = bitmap_init_zeros(WORD_LENGTH * NUM_WORKING_VARS);
 
   for (int i = 0; i < WORD_LENGTH * NUM_WORKING_VARS / BYTE_SIZE; i++) {
-    bitmap_set_byte(&result, i, H[(i * BYTE_SIZE) / WORD_LENGTH].map[i % (WORD_LENGTH / BYTE_SIZE)]);
+    bitmap_set_byte(&result, i, bitmap_bytes(H + (i * BYTE_SIZE) / WORD_LENGTH)[i % (WORD_LENGTH / BYTE_SIZE)]);
   }
 
   for (int i = 0; i < NUM_WORK_ITERATIONS; i++) {
@@ -11,13 +11,20 @@
 #define NUM_WORK_ITERATIONS 64
 #define HASH_SIZE_BITS 256
 #define HASH_SIZE_HEX_CHARS 64
+#define SHA256_ARENA_BLOCK_BYTES 4096
 
 bitmap sha256(const char *message);
+bitmap sha256_in(bitmap_arena *arena, const char *message);
 
 bitmap _pad_message(const char *message, int char_count);
+bitmap _pad_message_in(bitmap_arena *arena, const char *message, int char_count);
 bitmap _lower_sigma_0(bitmap bmap);
 bitmap _lower_sigma_1(bitmap bmap);
 bitmap _upper_sigma_0(bitmap bmap);
 bitmap _upper_sigma_1(bitmap bmap);
+void _lower_sigma_0_into(bitmap *dest, bitmap bmap);
+void _lower_sigma_1_into(bitmap *dest, bitmap bmap);
+void _upper_sigma_0_into(bitmap *dest, bitmap bmap);
+void _upper_sigma_1_into(bitmap *dest, bitmap bmap);
 
 #endif
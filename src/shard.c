@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "blockchain.h"
+#include "shard.h"
+
+// Initialise a ledger with `num_shards` empty shards
+sharded_ledger sharded_ledger_init(int num_shards) {
+  if (num_shards <= 0) {
+    fprintf(stderr, "Sharded ledger cannot be initialised with %d shards.\n", num_shards);
+    exit(EXIT_FAILURE);
+  }
+
+  chain *shards = malloc(num_shards * sizeof *shards);
+  if (!shards) {
+    fprintf(stderr, "Error allocating memory for shards.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < num_shards; i++) shards[i] = chain_init();
+
+  return (sharded_ledger){shards, num_shards};
+}
+
+// Get the index of the shard that owns `account_id`
+int sharded_ledger_shard_of(sharded_ledger ledger, int account_id) {
+  int shard = account_id % ledger.num_shards;
+  return (shard < 0) ? shard + ledger.num_shards : shard;
+}
+
+// Mine every transaction queued for a shard, in order. This is the entry point of a shard's thread
+void *_shard_worker_run(void *arg) {
+  shard_worker *worker = arg;
+  for (int i = 0; i < worker->queue_size; i++) chain_add_node(worker->shard, worker->queue[i]);
+
+  return NULL;
+}
+
+// Mine the queues in `workers` (one per shard) with a thread per non-empty queue, and empty the queues
+void _sharded_ledger_mine_queues(sharded_ledger *ledger, shard_worker *workers) {
+  pthread_t *threads = malloc(ledger->num_shards * sizeof *threads);
+  if (!threads) {
+    fprintf(stderr, "Error allocating memory for shard threads.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < ledger->num_shards; i++) {
+    if (workers[i].queue_size == 0) continue;
+
+    if (pthread_create(threads + i, NULL, _shard_worker_run, workers + i) != 0) {
+      fprintf(stderr, "Failed to start the thread for shard %d.\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (int i = 0; i < ledger->num_shards; i++) {
+    if (workers[i].queue_size == 0) continue;
+
+    pthread_join(threads[i], NULL);
+    workers[i].queue_size = 0;
+  }
+
+  free(threads);
+}
+
+// Point the queue of each worker at its own slice of `queues`, sized to the number of transactions in `targets`
+// bound for its shard, then queue those transactions in order. A target of -1 means the transaction is not queued
+void _sharded_ledger_fill_queues(sharded_ledger *ledger, shard_worker *workers, transaction *queues,
+                                 transaction *transactions, int *targets, int num_transactions) {
+  for (int i = 0; i < ledger->num_shards; i++) workers[i] = (shard_worker){ledger->shards + i, NULL, 0};
+  for (int i = 0; i < num_transactions; i++) {
+    if (targets[i] >= 0) workers[targets[i]].queue_size++;
+  }
+
+  int offset = 0;
+  for (int i = 0; i < ledger->num_shards; i++) {
+    workers[i].queue = queues + offset;
+    offset += workers[i].queue_size;
+    workers[i].queue_size = 0;
+  }
+
+  for (int i = 0; i < num_transactions; i++) {
+    if (targets[i] < 0) continue;
+
+    shard_worker *worker = workers + targets[i];
+    worker->queue[worker->queue_size++] = transactions[i];
+  }
+}
+
+// Add `transactions` to the ledger. Each is mined on its payer's shard, with all shards mining in parallel. Then
+// the transfers between shards are committed by mining their receipts on the payees' shards, again in parallel
+void sharded_ledger_submit(sharded_ledger *ledger, transaction *transactions, int num_transactions) {
+  shard_worker *workers = malloc(ledger->num_shards * sizeof *workers);
+  transaction *queues = malloc(num_transactions * sizeof *queues);
+  int *targets = malloc(num_transactions * sizeof *targets);
+  if (!workers || (!queues && num_transactions > 0) || (!targets && num_transactions > 0)) {
+    fprintf(stderr, "Error allocating memory for shard queues.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Phase one: prepare every transaction on the payer's shard
+  for (int i = 0; i < num_transactions; i++) {
+    targets[i] = sharded_ledger_shard_of(*ledger, transactions[i].payer_id);
+  }
+  _sharded_ledger_fill_queues(ledger, workers, queues, transactions, targets, num_transactions);
+  _sharded_ledger_mine_queues(ledger, workers);
+
+  // Phase two: the prepare blocks are now mined, so commit the cross-shard ones on the payee's shard
+  for (int i = 0; i < num_transactions; i++) {
+    int payee_shard = sharded_ledger_shard_of(*ledger, transactions[i].payee_id);
+    targets[i] = (payee_shard == targets[i]) ? -1 : payee_shard;
+  }
+  _sharded_ledger_fill_queues(ledger, workers, queues, transactions, targets, num_transactions);
+  _sharded_ledger_mine_queues(ledger, workers);
+
+  free(targets);
+  free(queues);
+  free(workers);
+}
+
+// Get the balance of `account_id`. Only blocks on the account's own shard affect it: the payer side of a block
+// counts on the payer's shard, and the payee side on the payee's shard, so each transfer is counted exactly once
+double sharded_ledger_account_balance(sharded_ledger *ledger, int account_id) {
+  int shard = sharded_ledger_shard_of(*ledger, account_id);
+  chain_snapshot snap = chain_take_snapshot(ledger->shards + shard);
+  double balance = 0;
+
+  for (chain_node *p = snap.end; p != NULL; p = p->prev) {
+    transaction trans = p->blk->trans;
+    if (trans.payee_id == account_id && sharded_ledger_shard_of(*ledger, trans.payee_id) == shard) {
+      balance += trans.amount;
+    }
+    if (trans.payer_id == account_id && sharded_ledger_shard_of(*ledger, trans.payer_id) == shard) {
+      balance -= trans.amount;
+    }
+  }
+
+  return balance;
+}
+
+// Get the total amount transferred in the ledger, merging the totals of each shard. Receipts are skipped so that
+// transfers between shards are only counted once
+double sharded_ledger_total_amount(sharded_ledger *ledger) {
+  double total = 0;
+
+  for (int i = 0; i < ledger->num_shards; i++) {
+    transaction_columns cols = ledger->shards[i].columns;
+    for (int j = 0; j < cols.size; j++) {
+      if (sharded_ledger_shard_of(*ledger, cols.payer_ids[j]) == i) total += cols.amounts[j];
+    }
+  }
+
+  return total;
+}
+
+// Get the total number of blocks over all shards
+int sharded_ledger_size(sharded_ledger *ledger) {
+  int size = 0;
+  for (int i = 0; i < ledger->num_shards; i++) size += chain_take_snapshot(ledger->shards + i).size;
+
+  return size;
+}
+
+// Free the memory associated with `ledger`, including all of its shards
+void sharded_ledger_free(sharded_ledger *ledger) {
+  for (int i = 0; i < ledger->num_shards; i++) chain_free(ledger->shards + i);
+  free(ledger->shards);
+  ledger->shards = NULL;
+  ledger->num_shards = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "blockchain.h"
+
+// A ledger whose accounts are partitioned between independent chains (shards), which are mined in parallel. Each
+// account lives on shard `account_id % num_shards`. A transfer between two shards is done in two phases: it is
+// prepared by a block on the payer's shard, which debits the payer, and once that is mined it is committed by a
+// receipt block (holding the same transaction) on the payee's shard, which credits the payee. Shards accept every
+// block, so a commit never fails and there is no abort. Validating blocks (e.g. rejecting overdrafts) would need
+// an abort that mines a refund on the payer's shard when the receipt is rejected
+typedef struct sharded_ledger {
+  chain *shards;
+  int num_shards;
+} sharded_ledger;
+
+// Work for the thread mining one shard
+typedef struct shard_worker {
+  chain *shard;
+  transaction *queue;
+  int queue_size;
+} shard_worker;
+
+sharded_ledger sharded_ledger_init(int num_shards);
+int sharded_ledger_shard_of(sharded_ledger ledger, int account_id);
+void sharded_ledger_submit(sharded_ledger *ledger, transaction *transactions, int num_transactions);
+double sharded_ledger_account_balance(sharded_ledger *ledger, int account_id);
+double sharded_ledger_total_amount(sharded_ledger *ledger);
+int sharded_ledger_size(sharded_ledger *ledger);
+void sharded_ledger_free(sharded_ledger *ledger);
+
+void *_shard_worker_run(void *arg);
+void _sharded_ledger_fill_queues(sharded_ledger *ledger, shard_worker *workers, transaction *queues,
+                                 transaction *transactions, int *targets, int num_transactions);
+void _sharded_ledger_mine_queues(sharded_ledger *ledger, shard_worker *workers);
+
+#endif
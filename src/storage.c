@@ -0,0 +1,1342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bitmap.h"
+#include "sha256.h"
+#include "blockchain.h"
+#include "storage.h"
+
+// CRC-32 of each byte value, for the reflected polynomial 0xedb88320
+static const u32 CRC32_TABLE[BYTE_COMBINATIONS] = {
+    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
+    0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
+    0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
+    0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172, 0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
+    0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
+    0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924, 0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
+    0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
+    0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e, 0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
+    0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
+    0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0, 0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
+    0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
+    0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a, 0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
+    0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
+    0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc, 0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
+    0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
+    0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236, 0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
+    0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
+    0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38, 0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
+    0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
+    0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2, 0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
+    0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
+    0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d};
+
+// Get the CRC-32 (as used by zip and PNG) of the `size` bytes in `data`
+u32 crc32(const byte *data, int size) {
+  u32 crc = 0xffffffff;
+  for (int i = 0; i < size; i++) crc = CRC32_TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> BYTE_SIZE);
+
+  return crc ^ 0xffffffff;
+}
+
+// Store `value` in the four bytes at `buffer`, least significant first, so files don't depend on the host
+void _store_u32(byte *buffer, u32 value) {
+  for (int i = 0; i < 4; i++) buffer[i] = value >> (BYTE_SIZE * i);
+}
+
+// Store `value` in the eight bytes at `buffer`, least significant first
+void _store_u64(byte *buffer, u64 value) {
+  for (int i = 0; i < 8; i++) buffer[i] = value >> (BYTE_SIZE * i);
+}
+
+// Get the number stored by `_store_u32` at `buffer`
+u32 _load_u32(const byte *buffer) {
+  u32 value = 0;
+  for (int i = 3; i >= 0; i--) value = (value << BYTE_SIZE) | buffer[i];
+
+  return value;
+}
+
+// Get the number stored by `_store_u64` at `buffer`
+u64 _load_u64(const byte *buffer) {
+  u64 value = 0;
+  for (int i = 7; i >= 0; i--) value = (value << BYTE_SIZE) | buffer[i];
+
+  return value;
+}
+
+// Store `blk` as a record of BLOCK_RECORD_SIZE bytes at `buffer`. The payload is a genesis flag, the previous hash
+// (zeros for genesis), the transaction and the proof of work
+void _encode_block_record(block blk, byte *buffer) {
+  byte *payload = buffer + RECORD_HEADER_SIZE;
+  u64 amount_bits;
+  memcpy(&amount_bits, &(blk.trans.amount), sizeof amount_bits);
+
+  memset(payload, 0, BLOCK_RECORD_PAYLOAD_SIZE);
+  payload[0] = (blk.prev_hash.size == 0);
+  if (blk.prev_hash.size != 0) memcpy(payload + 1, bitmap_bytes(&(blk.prev_hash)), HASH_SIZE_BITS / BYTE_SIZE);
+  _store_u64(payload + 33, amount_bits);
+  _store_u32(payload + 41, blk.trans.payer_id);
+  _store_u32(payload + 45, blk.trans.payee_id);
+  _store_u32(payload + 49, blk.trans.transaction_id);
+  _store_u64(payload + 53, blk.proof_of_work);
+
+  _store_u32(buffer, BLOCK_RECORD_PAYLOAD_SIZE);
+  _store_u32(buffer + 4, crc32(payload, BLOCK_RECORD_PAYLOAD_SIZE));
+}
+
+// Get the block stored by `_encode_block_record` at `buffer`
+block _decode_block_record(const byte *buffer) {
+  const byte *payload = buffer + RECORD_HEADER_SIZE;
+  u64 amount_bits = _load_u64(payload + 33);
+
+  block blk;
+  if (payload[0]) {
+    blk.prev_hash = bitmap_init_zeros(0);
+  } else {
+    blk.prev_hash = bitmap_init_zeros(HASH_SIZE_BITS);
+    memcpy(bitmap_bytes(&(blk.prev_hash)), payload + 1, HASH_SIZE_BITS / BYTE_SIZE);
+  }
+  memcpy(&(blk.trans.amount), &amount_bits, sizeof amount_bits);
+  blk.trans.payer_id = _load_u32(payload + 41);
+  blk.trans.payee_id = _load_u32(payload + 45);
+  blk.trans.transaction_id = _load_u32(payload + 49);
+  blk.proof_of_work = _load_u64(payload + 53);
+
+  return blk;
+}
+
+// Get whether the record at `buffer` has the expected length and checksum
+int _block_record_is_valid(const byte *buffer) {
+  return _load_u32(buffer) == BLOCK_RECORD_PAYLOAD_SIZE &&
+         _load_u32(buffer + 4) == crc32(buffer + RECORD_HEADER_SIZE, BLOCK_RECORD_PAYLOAD_SIZE);
+}
+
+// Write all `size` bytes of `data` to `fd`, retrying short writes
+void _write_fully(int fd, const byte *data, long long size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      fprintf(stderr, "Failed to write to file.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    data += written;
+    size -= written;
+  }
+}
+
+// Get the directory holding the file at `path` in `dir_path`, which should hold `FILENAME_MAX` characters
+void _parent_dir(const char *path, char *dir_path) {
+  const char *slash = strrchr(path, '/');
+  if (slash) {
+    snprintf(dir_path, FILENAME_MAX, "%.*s", (int)(slash - path + 1), path);
+  } else {
+    snprintf(dir_path, FILENAME_MAX, ".");
+  }
+}
+
+// Force the directory holding `path` to disk, so that creating, renaming or deleting `path` survives a crash
+void _sync_parent_dir(const char *path) {
+  char dir_path[FILENAME_MAX];
+  _parent_dir(path, dir_path);
+
+  int fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+  if (fd < 0 || fsync(fd) != 0) {
+    fprintf(stderr, "Failed to sync directory \"%s\".\n", dir_path);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+}
+
+// Open the block log at `path`, creating it if needed. A torn or corrupt tail, left by a crash part way through a
+// write, is truncated so that the log ends after its last intact record
+block_log block_log_open(const char *path, SyncPolicy policy, int sync_every) {
+  if (policy != SYNC_EVERY_BLOCK && sync_every <= 0) {
+    fprintf(stderr, "Block log cannot sync every %d blocks or milliseconds.\n", sync_every);
+    exit(EXIT_FAILURE);
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  byte *chunk = malloc(BLOCK_LOG_READ_CHUNK_RECORDS * BLOCK_RECORD_SIZE);
+  if (fd < 0 || !chunk) {
+    fprintf(stderr, "Failed to open block log \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  byte header[BLOCK_LOG_HEADER_SIZE];
+  ssize_t header_read = read(fd, header, BLOCK_LOG_HEADER_SIZE);
+  if (header_read < BLOCK_LOG_HEADER_SIZE) {
+    // A new log (or one torn before its header was complete)
+    _store_u32(header, BLOCK_LOG_MAGIC);
+    _store_u32(header + 4, BLOCK_LOG_VERSION);
+    if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+      fprintf(stderr, "Failed to initialise block log \"%s\".\n", path);
+      exit(EXIT_FAILURE);
+    }
+    _write_fully(fd, header, BLOCK_LOG_HEADER_SIZE);
+    fsync(fd);
+  } else if (_load_u32(header) != BLOCK_LOG_MAGIC || _load_u32(header + 4) != BLOCK_LOG_VERSION) {
+    fprintf(stderr, "\"%s\" is not a block log.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  // Count the intact records, reading in large chunks
+  int num_records = 0;
+  while (1) {
+    ssize_t chunk_read = read(fd, chunk, BLOCK_LOG_READ_CHUNK_RECORDS * BLOCK_RECORD_SIZE);
+    int chunk_records = (chunk_read < 0) ? 0 : chunk_read / BLOCK_RECORD_SIZE;
+
+    int valid_records = 0;
+    while (valid_records < chunk_records && _block_record_is_valid(chunk + valid_records * BLOCK_RECORD_SIZE)) {
+      valid_records++;
+    }
+    num_records += valid_records;
+
+    if (valid_records < BLOCK_LOG_READ_CHUNK_RECORDS) break;
+  }
+  free(chunk);
+
+  long long valid_size = BLOCK_LOG_HEADER_SIZE + (long long)num_records * BLOCK_RECORD_SIZE;
+  if (ftruncate(fd, valid_size) != 0 || lseek(fd, valid_size, SEEK_SET) != valid_size) {
+    fprintf(stderr, "Failed to recover block log \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  block_log_syncer *syncer = (policy == SYNC_INTERVAL) ? _block_log_syncer_start(fd, sync_every) : NULL;
+
+  return (block_log){fd, policy, sync_every, 0, num_records, syncer};
+}
+
+// Force the file `fd` of a block log to disk
+void _block_log_fsync(int fd) {
+  if (fsync(fd) != 0) {
+    fprintf(stderr, "Failed to sync block log.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Start a thread that syncs the block log file `fd` every `interval_ms` milliseconds, whenever it has records
+// that aren't on disk yet
+block_log_syncer *_block_log_syncer_start(int fd, int interval_ms) {
+  block_log_syncer *syncer = malloc(sizeof *syncer);
+  if (!syncer) {
+    fprintf(stderr, "Error allocating memory for block log syncer.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  syncer->fd = fd;
+  syncer->interval_ms = interval_ms;
+  syncer->unsynced_records = 0;
+  syncer->stopping = 0;
+  pthread_mutex_init(&(syncer->lock), NULL);
+  pthread_cond_init(&(syncer->wake), NULL);
+  if (pthread_create(&(syncer->thread), NULL, _block_log_syncer_run, syncer) != 0) {
+    fprintf(stderr, "Failed to start the block log syncer thread.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return syncer;
+}
+
+// Sync the log of `syncer` once per interval until it is stopped. The lock is released during the sync itself, so
+// appends don't wait for the disk
+void *_block_log_syncer_run(void *arg) {
+  block_log_syncer *syncer = arg;
+  pthread_mutex_lock(&(syncer->lock));
+
+  while (!syncer->stopping) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    long long nanoseconds = deadline.tv_nsec + syncer->interval_ms % 1000 * 1000000LL;
+    deadline.tv_sec += syncer->interval_ms / 1000 + nanoseconds / 1000000000;
+    deadline.tv_nsec = nanoseconds % 1000000000;
+
+    // Only woken early to stop, so spurious wakeups go back to waiting
+    int timed_out = 0;
+    while (!syncer->stopping && !timed_out) {
+      timed_out = (pthread_cond_timedwait(&(syncer->wake), &(syncer->lock), &deadline) == ETIMEDOUT);
+    }
+
+    if (syncer->unsynced_records > 0) {
+      syncer->unsynced_records = 0;
+      pthread_mutex_unlock(&(syncer->lock));
+      _block_log_fsync(syncer->fd);
+      pthread_mutex_lock(&(syncer->lock));
+    }
+  }
+
+  pthread_mutex_unlock(&(syncer->lock));
+  return NULL;
+}
+
+// Stop the thread of `syncer` and free it. Records it had not synced yet are left for the caller to sync
+void _block_log_syncer_stop(block_log_syncer *syncer) {
+  pthread_mutex_lock(&(syncer->lock));
+  syncer->stopping = 1;
+  pthread_cond_signal(&(syncer->wake));
+  pthread_mutex_unlock(&(syncer->lock));
+
+  pthread_join(syncer->thread, NULL);
+  pthread_mutex_destroy(&(syncer->lock));
+  pthread_cond_destroy(&(syncer->wake));
+  free(syncer);
+}
+
+// Force the records of `log` to disk
+void block_log_sync(block_log *log) {
+  if (log->syncer) {
+    pthread_mutex_lock(&(log->syncer->lock));
+    log->unsynced_records = log->syncer->unsynced_records;
+    log->syncer->unsynced_records = 0;
+    pthread_mutex_unlock(&(log->syncer->lock));
+  }
+
+  if (log->unsynced_records > 0) _block_log_fsync(log->fd);
+  log->unsynced_records = 0;
+}
+
+// Append `blk` to `log`. The record is written to the file straight away, so it survives the process crashing.
+// It survives the machine crashing once it is synced: before this returns under SYNC_EVERY_BLOCK, every
+// `sync_every` blocks under SYNC_EVERY_N_BLOCKS, and within `sync_every` milliseconds under SYNC_INTERVAL
+void block_log_append(block_log *log, block blk) {
+  byte record[BLOCK_RECORD_SIZE];
+  _encode_block_record(blk, record);
+  _write_fully(log->fd, record, BLOCK_RECORD_SIZE);
+  log->num_records++;
+
+  if (log->syncer) {
+    pthread_mutex_lock(&(log->syncer->lock));
+    log->syncer->unsynced_records++;
+    pthread_mutex_unlock(&(log->syncer->lock));
+    return;
+  }
+
+  log->unsynced_records++;
+  if (log->policy == SYNC_EVERY_BLOCK || log->unsynced_records >= log->sync_every) block_log_sync(log);
+}
+
+// Add every block in `log` to `chn`, in the order they were logged, without mining them again. Returns the number
+// of blocks that `chn` accepted
+int block_log_load(block_log *log, chain *chn) {
+  byte *chunk = malloc(BLOCK_LOG_READ_CHUNK_RECORDS * BLOCK_RECORD_SIZE);
+  if (!chunk) {
+    fprintf(stderr, "Error allocating memory for reading block log.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int accepted = 0;
+  for (int first = 0; first < log->num_records; first += BLOCK_LOG_READ_CHUNK_RECORDS) {
+    int chunk_records = log->num_records - first;
+    if (chunk_records > BLOCK_LOG_READ_CHUNK_RECORDS) chunk_records = BLOCK_LOG_READ_CHUNK_RECORDS;
+
+    long long offset = BLOCK_LOG_HEADER_SIZE + (long long)first * BLOCK_RECORD_SIZE;
+    if (pread(log->fd, chunk, chunk_records * BLOCK_RECORD_SIZE, offset) != chunk_records * BLOCK_RECORD_SIZE) {
+      fprintf(stderr, "Failed to read block log.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < chunk_records; i++) {
+      block blk = _decode_block_record(chunk + i * BLOCK_RECORD_SIZE);
+      if (chain_accept_block(chn, blk) != NULL) {
+        accepted++;
+      } else {
+        block_free(&blk);
+      }
+    }
+  }
+
+  free(chunk);
+
+  return accepted;
+}
+
+// Rebuild the empty chain `chn` and its balances from `log`, which should hold a single branch in chain order (as
+// written by the program). The log is read sequentially, then split into `num_threads` runs of whole segments
+// that are decoded, hashed and checked in parallel. Each thread builds the balances, transaction columns and
+// segment filters of its run, so linking the runs onto `chn` only has to create and index the nodes before the
+// columns and filters are appended in bulk and the partial tables are merged into `*balances`, which should be
+// empty. Reindexing stops at the first block that is corrupt, has an invalid proof of work or doesn't follow the
+// block before it. Returns the number of blocks reindexed
+int block_log_reindex(block_log *log, chain *chn, int num_threads, balance_table *balances) {
+  if (num_threads <= 0) {
+    fprintf(stderr, "Reindex cannot use %d threads.\n", num_threads);
+    exit(EXIT_FAILURE);
+  }
+  if (chn->size != 0) {
+    fprintf(stderr, "Reindex needs an empty chain, not one of %d blocks.\n", chn->size);
+    exit(EXIT_FAILURE);
+  }
+
+  long long records_size = (long long)log->num_records * BLOCK_RECORD_SIZE;
+  byte *records = malloc(records_size);
+  block *blocks = malloc(log->num_records * sizeof *blocks);
+  bitmap *hashes = malloc(log->num_records * sizeof *hashes);
+  reindex_worker *workers = malloc(num_threads * sizeof *workers);
+  pthread_t *threads = malloc(num_threads * sizeof *threads);
+  if ((!records || !blocks || !hashes) && log->num_records > 0) {
+    fprintf(stderr, "Error allocating memory for reindex.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!workers || !threads) {
+    fprintf(stderr, "Error allocating memory for reindex.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (long long done = 0; done < records_size;) {
+    long long read = pread(log->fd, records + done, records_size - done, BLOCK_LOG_HEADER_SIZE + done);
+    if (read <= 0) {
+      fprintf(stderr, "Failed to read block log.\n");
+      exit(EXIT_FAILURE);
+    }
+    done += read;
+  }
+
+  // Runs hold whole segments, so each run's filters follow on from the filters of the runs before it
+  int num_segments = (log->num_records + CHAIN_SEGMENT_SIZE - 1) / CHAIN_SEGMENT_SIZE;
+  for (int i = 0; i < num_threads; i++) {
+    long long first = (long long)num_segments * i / num_threads * CHAIN_SEGMENT_SIZE;
+    long long last = (long long)num_segments * (i + 1) / num_threads * CHAIN_SEGMENT_SIZE;
+    if (first > log->num_records) first = log->num_records;
+    if (last > log->num_records) last = log->num_records;
+
+    workers[i] = (reindex_worker){records + first * BLOCK_RECORD_SIZE, last - first, (i == 0), blocks + first,
+                                  hashes + first, 0, balance_table_init(), transaction_columns_init(), NULL, 0};
+    pthread_create(threads + i, NULL, _reindex_worker_run, workers + i);
+  }
+  for (int i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+
+  // Link the runs in order. Runs after a failure are dropped
+  _chain_reserve_block_index(chn, log->num_records);
+  int reindexed = 0;
+  int failed = 0;
+  for (int i = 0; i < num_threads; i++) {
+    reindex_worker *worker = workers + i;
+
+    // Blocks within a run were checked by its thread, so only its first block can fail to link, and a run is
+    // either linked whole, with its derived data, or dropped
+    int linked = 0;
+    for (int j = 0; j < worker->num_valid; j++) {
+      if (!failed && _chain_link_hashed_block(chn, worker->blocks[j], worker->hashes[j]) != NULL) {
+        linked++;
+      } else {
+        failed = 1;
+        block_free(worker->blocks + j);
+        bitmap_free(worker->hashes + j);
+      }
+    }
+    if (linked > 0) {
+      balance_table_merge(balances, worker->balances);
+      _chain_append_derived(chn, worker->columns, worker->filters, worker->num_filters);
+    } else {
+      for (int j = 0; j < worker->num_filters; j++) bloom_filter_free(worker->filters + j);
+    }
+    if (worker->num_valid < worker->num_records) failed = 1;
+    reindexed += linked;
+
+    balance_table_free(&(worker->balances));
+    transaction_columns_free(&(worker->columns));
+    free(worker->filters);
+  }
+
+  free(records);
+  free(blocks);
+  free(hashes);
+  free(workers);
+  free(threads);
+
+  return reindexed;
+}
+
+// Thread of a reindex: decode, hash and check the records of one run, stopping at the first block that fails, and
+// apply the valid blocks to the run's balances, transaction columns and segment filters
+void *_reindex_worker_run(void *arg) {
+  reindex_worker *worker = arg;
+
+  for (int i = 0; i < worker->num_records; i++) {
+    const byte *record = worker->records + (long long)i * BLOCK_RECORD_SIZE;
+    if (!_block_record_is_valid(record)) return NULL;
+
+    block blk = _decode_block_record(record);
+    bitmap hash = block_hash(blk);
+
+    int links = (i == 0) ? (!worker->is_first || blk.prev_hash.size == 0)
+                         : bitmap_equal(blk.prev_hash, worker->hashes[i - 1]);
+    if (!links || bitmap_leading_zeros(hash) < POW_LEADING_ZEROS) {
+      block_free(&blk);
+      bitmap_free(&hash);
+      return NULL;
+    }
+
+    worker->blocks[i] = blk;
+    worker->hashes[i] = hash;
+    worker->num_valid++;
+    balance_table_apply(&(worker->balances), blk.trans);
+    transaction_columns_append(&(worker->columns), blk.trans);
+    _segment_filters_add(&(worker->filters), &(worker->num_filters), i, blk.trans);
+  }
+
+  return NULL;
+}
+
+// Get a copy of the block in record `index` of `log`, which the caller should free
+block block_log_read(block_log *log, int index) {
+  if (index < 0 || index >= log->num_records) {
+    fprintf(stderr, "Index %d is out of range for block log of %d records.\n", index, log->num_records);
+    exit(EXIT_FAILURE);
+  }
+
+  byte record[BLOCK_RECORD_SIZE];
+  long long offset = BLOCK_LOG_HEADER_SIZE + (long long)index * BLOCK_RECORD_SIZE;
+  if (pread(log->fd, record, BLOCK_RECORD_SIZE, offset) != BLOCK_RECORD_SIZE || !_block_record_is_valid(record)) {
+    fprintf(stderr, "Failed to read record %d of block log.\n", index);
+    exit(EXIT_FAILURE);
+  }
+
+  return _decode_block_record(record);
+}
+
+// Evict the blocks of `chn` older than the newest `hot_blocks` to `log`, which must hold the chain's blocks in
+// order (as when every block is appended to it once mined). Evicted blocks are read back from the log by
+// `chain_get_node` when asked for, so `log` must stay open for as long as `chn` is used
+void chain_use_block_log(chain *chn, block_log *log, int hot_blocks) {
+  chain_set_block_store(chn, (chain_block_store){_block_log_store_read, _block_log_store_size, log, hot_blocks});
+}
+
+// Read block `index` of the block log `source`, for a chain's block store
+block _block_log_store_read(void *source, int index) { return block_log_read(source, index); }
+
+// Get the number of blocks in the block log `source`, for a chain's block store
+int _block_log_store_size(void *source) { return ((block_log *)source)->num_records; }
+
+// Sync and close `log`, freeing its memory
+void block_log_close(block_log *log) {
+  if (log->syncer) _block_log_syncer_stop(log->syncer);
+  log->syncer = NULL;
+  block_log_sync(log);
+  close(log->fd);
+  log->fd = -1;
+}
+
+// Get the nodes of the active branch of `chn` in chain order, in an array the caller should free. The nodes only
+// link backwards, so they need collecting before a file can be written from genesis onwards
+chain_node **_active_branch_nodes(chain *chn) {
+  chain_node **nodes = malloc(chn->size * sizeof *nodes);
+  if (!nodes && chn->size > 0) {
+    fprintf(stderr, "Error allocating memory for chain nodes.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (chain_node *p = chn->end; p != NULL; p = p->prev) nodes[p->index] = p;
+
+  return nodes;
+}
+
+// Write the active branch of `chn` to a chain image at `path`, for `mapped_chain_open`. Each record holds the
+// previous hash, the block's own hash, the proof of work, the transaction and a genesis flag. The image is written
+// to a temporary file and renamed into place, so readers never see a partial image
+void mapped_chain_write(chain *chn, const char *path) {
+  char temp_path[FILENAME_MAX];
+  snprintf(temp_path, FILENAME_MAX, "%s.tmp", path);
+
+  FILE *file = fopen(temp_path, "wb");
+  if (!file) {
+    fprintf(stderr, "Failed to open \"%s\" to write chain image.\n", temp_path);
+    exit(EXIT_FAILURE);
+  }
+
+  byte header[CHAIN_IMAGE_HEADER_SIZE] = {0};
+  _store_u32(header, CHAIN_IMAGE_MAGIC);
+  _store_u32(header + 4, CHAIN_IMAGE_VERSION);
+  _store_u64(header + 8, chn->size);
+  int written = (fwrite(header, CHAIN_IMAGE_HEADER_SIZE, 1, file) == 1);
+
+  chain_node **nodes = _active_branch_nodes(chn);
+
+  for (int i = 0; i < chn->size; i++) {
+    block blk = *chain_node_block(chn, nodes[i]);
+    u64 amount_bits;
+    memcpy(&amount_bits, &(blk.trans.amount), sizeof amount_bits);
+
+    byte record[CHAIN_IMAGE_RECORD_SIZE] = {0};
+    if (blk.prev_hash.size != 0) memcpy(record, bitmap_bytes(&(blk.prev_hash)), HASH_SIZE_BITS / BYTE_SIZE);
+    memcpy(record + 32, bitmap_bytes(&(nodes[i]->hash)), HASH_SIZE_BITS / BYTE_SIZE);
+    _store_u64(record + 64, blk.proof_of_work);
+    _store_u64(record + 72, amount_bits);
+    _store_u32(record + 80, blk.trans.payer_id);
+    _store_u32(record + 84, blk.trans.payee_id);
+    _store_u32(record + 88, blk.trans.transaction_id);
+    _store_u32(record + 92, blk.prev_hash.size == 0);
+
+    written &= (fwrite(record, CHAIN_IMAGE_RECORD_SIZE, 1, file) == 1);
+  }
+  free(nodes);
+
+  if (fflush(file) != 0 || fsync(fileno(file)) != 0 || fclose(file) != 0 || !written ||
+      rename(temp_path, path) != 0) {
+    fprintf(stderr, "Failed to write chain image to \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Map the chain image at `path` into memory. This takes constant time however long the chain is
+mapped_chain mapped_chain_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0 || file_stat.st_size < CHAIN_IMAGE_HEADER_SIZE) {
+    fprintf(stderr, "Failed to open chain image \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  const byte *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // The mapping stays valid without the descriptor
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Failed to map chain image \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  u64 size = _load_u64(data + 8);
+  if (_load_u32(data) != CHAIN_IMAGE_MAGIC || _load_u32(data + 4) != CHAIN_IMAGE_VERSION ||
+      CHAIN_IMAGE_HEADER_SIZE + size * CHAIN_IMAGE_RECORD_SIZE != (u64)file_stat.st_size) {
+    fprintf(stderr, "\"%s\" is not a valid chain image.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  return (mapped_chain){data, file_stat.st_size, size};
+}
+
+// Get a pointer to the record of the block at `index` in `mchn`
+const byte *_mapped_chain_record(mapped_chain mchn, int index) {
+  if (index < 0 || index >= mchn.size) {
+    fprintf(stderr, "Index %d is out of range for chain image of size %d.\n", index, mchn.size);
+    exit(EXIT_FAILURE);
+  }
+
+  return mchn.data + CHAIN_IMAGE_HEADER_SIZE + (long long)index * CHAIN_IMAGE_RECORD_SIZE;
+}
+
+// Get the block at `index` in `mchn`. Its previous hash points into the mapping rather than being copied, so it
+// must not be modified or freed, and is only valid until `mchn` is closed
+block mapped_chain_get_block(mapped_chain mchn, int index) {
+  const byte *record = _mapped_chain_record(mchn, index);
+  u64 amount_bits = _load_u64(record + 72);
+
+  block blk;
+  blk.prev_hash = (bitmap){_load_u32(record + 92) ? 0 : HASH_SIZE_BITS, (byte *)record};
+  memcpy(&(blk.trans.amount), &amount_bits, sizeof amount_bits);
+  blk.trans.payer_id = _load_u32(record + 80);
+  blk.trans.payee_id = _load_u32(record + 84);
+  blk.trans.transaction_id = _load_u32(record + 88);
+  blk.proof_of_work = _load_u64(record + 64);
+
+  return blk;
+}
+
+// Get the hash of the block at `index` in `mchn`. Like the blocks, this points into the mapping
+bitmap mapped_chain_get_hash(mapped_chain mchn, int index) {
+  return (bitmap){HASH_SIZE_BITS, (byte *)_mapped_chain_record(mchn, index) + 32};
+}
+
+// Unmap `mchn`
+void mapped_chain_close(mapped_chain *mchn) {
+  munmap((void *)mchn->data, mchn->data_size);
+  mchn->data = NULL;
+  mchn->size = 0;
+}
+
+// Save `table`, which must reflect the chain up to and including `node`, as a snapshot at `path`. The snapshot is
+// tagged with the node's index and hash, checksummed, and written atomically by renaming a synced temporary file.
+// The directory is synced after the rename, so the new snapshot is durable once this returns
+void balance_snapshot_save(balance_table table, chain_node *node, const char *path) {
+  long long data_size = BALANCE_SNAPSHOT_HEADER_SIZE + 8LL * table.size;
+  byte *data = calloc(data_size + 4, 1);  // Room for the trailing checksum
+  if (!data) {
+    fprintf(stderr, "Error allocating memory for balance snapshot.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  _store_u32(data, BALANCE_SNAPSHOT_MAGIC);
+  _store_u32(data + 4, BALANCE_SNAPSHOT_VERSION);
+  _store_u32(data + 8, node->index);
+  _store_u32(data + 12, table.size);
+  memcpy(data + 16, bitmap_bytes(&(node->hash)), HASH_SIZE_BITS / BYTE_SIZE);
+  for (int i = 0; i < table.size; i++) {
+    u64 balance_bits;
+    memcpy(&balance_bits, table.balances + i, sizeof balance_bits);
+    _store_u64(data + BALANCE_SNAPSHOT_HEADER_SIZE + 8LL * i, balance_bits);
+  }
+  _store_u32(data + data_size, crc32(data, data_size));
+
+  char temp_path[FILENAME_MAX];
+  snprintf(temp_path, FILENAME_MAX, "%s.tmp", path);
+  int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open \"%s\" to write balance snapshot.\n", temp_path);
+    exit(EXIT_FAILURE);
+  }
+
+  _write_fully(fd, data, data_size + 4);
+  if (fsync(fd) != 0 || close(fd) != 0 || rename(temp_path, path) != 0) {
+    fprintf(stderr, "Failed to write balance snapshot to \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+  _sync_parent_dir(path);
+
+  free(data);
+}
+
+// Load the snapshot at `path` into `table`, and the index and hash of the block it reflects into `index` and
+// `hash` (which the caller should free). Returns 0, setting nothing, if the file is missing or fails its checksum
+int balance_snapshot_load(const char *path, balance_table *table, int *index, bitmap *hash) {
+  int fd = open(path, O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0) return 0;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size < BALANCE_SNAPSHOT_HEADER_SIZE + 4) {
+    close(fd);
+    return 0;
+  }
+
+  byte *data = malloc(file_stat.st_size);
+  if (!data) {
+    fprintf(stderr, "Error allocating memory for balance snapshot.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  long long data_size = file_stat.st_size - 4;
+  int is_valid = (read(fd, data, file_stat.st_size) == file_stat.st_size) &&
+                 _load_u32(data) == BALANCE_SNAPSHOT_MAGIC && _load_u32(data + 4) == BALANCE_SNAPSHOT_VERSION &&
+                 data_size == BALANCE_SNAPSHOT_HEADER_SIZE + 8LL * _load_u32(data + 12) &&
+                 _load_u32(data + data_size) == crc32(data, data_size);
+  close(fd);
+
+  if (is_valid) {
+    *index = _load_u32(data + 8);
+    *hash = bitmap_init_zeros(HASH_SIZE_BITS);
+    memcpy(bitmap_bytes(hash), data + 16, HASH_SIZE_BITS / BYTE_SIZE);
+
+    *table = balance_table_init();
+    int size = _load_u32(data + 12);
+    if (size > 0) _balance_table_reserve(table, size - 1);
+    for (int i = 0; i < size; i++) {
+      u64 balance_bits = _load_u64(data + BALANCE_SNAPSHOT_HEADER_SIZE + 8LL * i);
+      memcpy(table->balances + i, &balance_bits, sizeof balance_bits);
+    }
+  }
+
+  free(data);
+
+  return is_valid;
+}
+
+// Get the balances of the active branch of `chn`, starting from the snapshot at `path` and replaying only the
+// blocks after it. If the snapshot is missing, invalid, or its block is no longer on the active branch, the
+// balances are computed from genesis. The number of blocks replayed is stored in `replayed_blocks` if not NULL
+balance_table chain_restore_balances(chain *chn, const char *path, int *replayed_blocks) {
+  balance_table table = balance_table_init();
+  int index;
+  bitmap hash;
+  int from_index = 0;
+
+  if (balance_snapshot_load(path, &table, &index, &hash)) {
+    chain_node *node = chain_get_node(chn, index);
+    if (node != NULL && bitmap_equal(node->hash, hash)) {
+      from_index = index + 1;
+    } else {
+      balance_table_free(&table);
+    }
+    bitmap_free(&hash);
+  }
+
+  if (replayed_blocks != NULL) *replayed_blocks = chn->size - from_index;
+
+  return chain_compute_balances(chn, from_index, table);
+}
+
+// Map signed `value` to an unsigned number that is small when `value` is close to zero (0, -1, 1, -2, ...)
+u64 _zigzag_encode(long long value) { return ((u64)value << 1) ^ (u64)(value >> 63); }
+
+// Get the number that `_zigzag_encode` mapped to `value`
+long long _zigzag_decode(u64 value) { return (long long)(value >> 1) ^ -(long long)(value & 1); }
+
+// Store `value` at `buffer` in seven-bit groups, least significant first, with the top bit marking that more
+// groups follow. Returns the number of bytes used
+int _store_varint(byte *buffer, u64 value) {
+  int size = 0;
+  while (value >= 0x80) {
+    buffer[size++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  buffer[size++] = value;
+
+  return size;
+}
+
+// Read a varint from `buffer` (of `size` bytes) at `*position` into `value`, advancing `*position`. Returns 0 if
+// the varint runs past the end of the buffer or is too long
+int _load_varint(const byte *buffer, int size, int *position, u64 *value) {
+  *value = 0;
+  for (int shift = 0; shift < 7 * MAX_VARINT_SIZE && *position < size; shift += 7) {
+    byte this_byte = buffer[(*position)++];
+    *value |= (u64)(this_byte & 0x7f) << shift;
+    if (!(this_byte & 0x80)) return 1;
+  }
+
+  return 0;
+}
+
+// Store a block compactly at `buffer`, returning the number of bytes used. The previous hash is left out, since it
+// can be derived by hashing the block before. The amount is kept exactly, as its bits affect the hash, while the
+// IDs and proof of work are varints, and the transaction ID is stored as the difference from the previous one
+int _encode_compact_block(transaction trans, u64 proof_of_work, int prev_transaction_id, byte *buffer) {
+  u64 amount_bits;
+  memcpy(&amount_bits, &(trans.amount), sizeof amount_bits);
+  _store_u64(buffer, amount_bits);
+
+  int size = 8;
+  size += _store_varint(buffer + size, _zigzag_encode(trans.payer_id));
+  size += _store_varint(buffer + size, _zigzag_encode(trans.payee_id));
+  size += _store_varint(buffer + size, _zigzag_encode((long long)trans.transaction_id - prev_transaction_id));
+  size += _store_varint(buffer + size, proof_of_work);
+
+  return size;
+}
+
+// Get the largest size that `lz_compress` can produce from `input_size` bytes
+int lz_compress_bound(int input_size) { return input_size + input_size / 255 + 16; }
+
+// Write the part of a sequence length that doesn't fit in its four bit token field. Returns the bytes used
+int _lz_write_length(byte *output, int length) {
+  int size = 0;
+  for (length -= 15; length >= 255; length -= 255) output[size++] = 255;
+  output[size++] = length;
+
+  return size;
+}
+
+// Compress `input_size` bytes of `input` into `output`, which must hold `lz_compress_bound(input_size)` bytes, and
+// return the compressed size. This is an LZ77 scheme in the style of LZ4: each sequence is a token (literal count
+// and match length in four bits each, extended with extra bytes when they are 15), the literals, and a two byte
+// offset back to the match. Matches are found through a hash table of the last position of each four byte string
+int lz_compress(const byte *input, int input_size, byte *output) {
+  int table[1 << LZ_HASH_BITS];
+  for (int i = 0; i < (1 << LZ_HASH_BITS); i++) table[i] = -1;
+
+  int out = 0;
+  int literal_start = 0;
+  int position = 0;
+
+  while (position + LZ_MIN_MATCH <= input_size) {
+    u32 sequence = _load_u32(input + position);
+    int slot = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+    int candidate = table[slot];
+    table[slot] = position;
+
+    if (candidate < 0 || position - candidate > LZ_MAX_OFFSET || _load_u32(input + candidate) != sequence) {
+      position++;
+      continue;
+    }
+
+    int match_length = LZ_MIN_MATCH;
+    while (position + match_length < input_size &&
+           input[candidate + match_length] == input[position + match_length]) {
+      match_length++;
+    }
+
+    // Emit the literals since the last match, then the match itself
+    int literal_length = position - literal_start;
+    byte *token = output + out++;
+    *token = ((literal_length < 15) ? literal_length : 15) << 4;
+    if (literal_length >= 15) out += _lz_write_length(output + out, literal_length);
+    memcpy(output + out, input + literal_start, literal_length);
+    out += literal_length;
+
+    output[out++] = (position - candidate) & 0xff;
+    output[out++] = (position - candidate) >> BYTE_SIZE;
+    int extra_length = match_length - LZ_MIN_MATCH;
+    *token |= (extra_length < 15) ? extra_length : 15;
+    if (extra_length >= 15) out += _lz_write_length(output + out, extra_length);
+
+    position += match_length;
+    literal_start = position;
+  }
+
+  // The final sequence is only literals
+  int literal_length = input_size - literal_start;
+  output[out++] = ((literal_length < 15) ? literal_length : 15) << 4;
+  if (literal_length >= 15) out += _lz_write_length(output + out, literal_length);
+  memcpy(output + out, input + literal_start, literal_length);
+  out += literal_length;
+
+  return out;
+}
+
+// Add the extension bytes of a sequence length at `*position` in `input` to `*length`, advancing `*position`.
+// Returns 0 if the input ends first
+int _lz_read_length(const byte *input, int input_size, int *position, int *length) {
+  byte extra;
+  do {
+    if (*position >= input_size) return 0;
+    extra = input[(*position)++];
+    *length += extra;
+  } while (extra == 255);
+
+  return 1;
+}
+
+// Decompress the `input_size` bytes of `input` made by `lz_compress` into `output`, which holds `output_size`
+// bytes. Returns the decompressed size, or -1 if the input is malformed
+int lz_decompress(const byte *input, int input_size, byte *output, int output_size) {
+  int in = 0;
+  int out = 0;
+
+  while (in < input_size) {
+    byte token = input[in++];
+
+    int literal_length = token >> 4;
+    if (literal_length == 15 && !_lz_read_length(input, input_size, &in, &literal_length)) return -1;
+    if (literal_length > input_size - in || literal_length > output_size - out) return -1;
+    memcpy(output + out, input + in, literal_length);
+    in += literal_length;
+    out += literal_length;
+
+    if (in == input_size) break;  // The final sequence has no match
+
+    if (input_size - in < 2) return -1;
+    int offset = input[in] | (input[in + 1] << BYTE_SIZE);
+    in += 2;
+
+    int match_length = token & 15;
+    if (match_length == 15 && !_lz_read_length(input, input_size, &in, &match_length)) return -1;
+    match_length += LZ_MIN_MATCH;
+    if (offset == 0 || offset > out || match_length > output_size - out) return -1;
+
+    // Copy byte by byte, since the match may overlap the bytes it produces
+    for (int i = 0; i < match_length; i++, out++) output[out] = output[out - offset];
+  }
+
+  return out;
+}
+
+// Write the active branch of `chn` to `path` in the compact encoding (see `_encode_compact_block`), in segments of
+// COMPACT_SEGMENT_BLOCKS blocks. If `compress` is set, each segment is also compressed with `lz_compress`
+void chain_write_compact(chain *chn, const char *path, int compress) {
+  FILE *file = fopen(path, "wb");
+  byte *raw = malloc(COMPACT_SEGMENT_BLOCKS * COMPACT_BLOCK_MAX_SIZE);
+  byte *compressed = malloc(lz_compress_bound(COMPACT_SEGMENT_BLOCKS * COMPACT_BLOCK_MAX_SIZE));
+  if (!file || !raw || !compressed) {
+    fprintf(stderr, "Failed to open \"%s\" to write compact chain.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  byte header[COMPACT_CHAIN_HEADER_SIZE];
+  _store_u32(header, COMPACT_CHAIN_MAGIC);
+  _store_u32(header + 4, COMPACT_CHAIN_VERSION);
+  _store_u32(header + 8, compress != 0);
+  _store_u32(header + 12, chn->size);
+  int written = (fwrite(header, COMPACT_CHAIN_HEADER_SIZE, 1, file) == 1);
+
+  chain_node **nodes = _active_branch_nodes(chn);
+  int prev_transaction_id = 0;
+
+  for (int first = 0; first < chn->size; first += COMPACT_SEGMENT_BLOCKS) {
+    int segment_blocks = (chn->size - first < COMPACT_SEGMENT_BLOCKS) ? chn->size - first : COMPACT_SEGMENT_BLOCKS;
+
+    int raw_size = 0;
+    for (int i = first; i < first + segment_blocks; i++) {
+      block blk = *chain_node_block(chn, nodes[i]);
+      raw_size += _encode_compact_block(blk.trans, blk.proof_of_work, prev_transaction_id, raw + raw_size);
+      prev_transaction_id = blk.trans.transaction_id;
+    }
+
+    byte *stored = compress ? compressed : raw;
+    int stored_size = compress ? lz_compress(raw, raw_size, compressed) : raw_size;
+
+    byte segment_header[COMPACT_SEGMENT_HEADER_SIZE];
+    _store_u32(segment_header, segment_blocks);
+    _store_u32(segment_header + 4, raw_size);
+    _store_u32(segment_header + 8, stored_size);
+    _store_u32(segment_header + 12, crc32(raw, raw_size));
+    written &= (fwrite(segment_header, COMPACT_SEGMENT_HEADER_SIZE, 1, file) == 1) &&
+               (fwrite(stored, 1, stored_size, file) == stored_size);
+  }
+
+  free(nodes);
+  free(raw);
+  free(compressed);
+
+  if (fclose(file) != 0 || !written) {
+    fprintf(stderr, "Failed to write compact chain to \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Add the blocks in the compact chain file at `path` to the empty chain `chn`. Each block's previous hash is
+// restored from the hash of the block before, which `chain_accept_block` has already computed. A segment is only
+// added once all of it has decoded, and reading stops at the first corrupt segment or rejected block. Returns the
+// number of blocks added, which is less than the number in the file if it is corrupt
+int chain_read_compact(const char *path, chain *chn) {
+  FILE *file = fopen(path, "rb");
+  byte *raw = malloc(COMPACT_SEGMENT_BLOCKS * COMPACT_BLOCK_MAX_SIZE);
+  byte *stored = malloc(lz_compress_bound(COMPACT_SEGMENT_BLOCKS * COMPACT_BLOCK_MAX_SIZE));
+  block *blocks = malloc(COMPACT_SEGMENT_BLOCKS * sizeof *blocks);
+  if (!file || !raw || !stored || !blocks) {
+    fprintf(stderr, "Failed to open compact chain \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  byte header[COMPACT_CHAIN_HEADER_SIZE];
+  if (fread(header, COMPACT_CHAIN_HEADER_SIZE, 1, file) != 1 || _load_u32(header) != COMPACT_CHAIN_MAGIC ||
+      _load_u32(header + 4) != COMPACT_CHAIN_VERSION || chn->size != 0) {
+    fprintf(stderr, "\"%s\" is not a compact chain, or the chain to read it into is not empty.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  int compressed = _load_u32(header + 8);
+  int num_blocks = _load_u32(header + 12);
+  int num_read = 0;
+  int prev_transaction_id = 0;
+  chain_node *prev_node = NULL;
+
+  for (int first = 0; first < num_blocks && num_read == first; first += COMPACT_SEGMENT_BLOCKS) {
+    int expected_blocks = num_blocks - first;
+    if (expected_blocks > COMPACT_SEGMENT_BLOCKS) expected_blocks = COMPACT_SEGMENT_BLOCKS;
+
+    byte segment_header[COMPACT_SEGMENT_HEADER_SIZE];
+    int is_valid = (fread(segment_header, COMPACT_SEGMENT_HEADER_SIZE, 1, file) == 1);
+
+    int segment_blocks = _load_u32(segment_header);
+    int raw_size = _load_u32(segment_header + 4);
+    int stored_size = _load_u32(segment_header + 8);
+    is_valid = is_valid && segment_blocks == expected_blocks && raw_size >= 0 &&
+               raw_size <= COMPACT_SEGMENT_BLOCKS * COMPACT_BLOCK_MAX_SIZE && stored_size >= 0 &&
+               stored_size <= lz_compress_bound(COMPACT_SEGMENT_BLOCKS * COMPACT_BLOCK_MAX_SIZE) &&
+               (compressed || stored_size == raw_size) &&
+               fread(compressed ? stored : raw, 1, stored_size, file) == stored_size &&
+               (!compressed || lz_decompress(stored, stored_size, raw, raw_size) == raw_size) &&
+               _load_u32(segment_header + 12) == crc32(raw, raw_size);
+
+    // Decode the whole segment before adding any of it, so trailing bytes reject the segment
+    int position = 0;
+    for (int i = 0; i < segment_blocks && is_valid; i++) {
+      u64 payer_id, payee_id, transaction_id_delta, proof_of_work;
+      is_valid = (raw_size - position >= 8);
+      if (!is_valid) break;
+
+      u64 amount_bits = _load_u64(raw + position);
+      memcpy(&(blocks[i].trans.amount), &amount_bits, sizeof amount_bits);
+      position += 8;
+
+      is_valid = _load_varint(raw, raw_size, &position, &payer_id) &&
+                 _load_varint(raw, raw_size, &position, &payee_id) &&
+                 _load_varint(raw, raw_size, &position, &transaction_id_delta) &&
+                 _load_varint(raw, raw_size, &position, &proof_of_work);
+      if (!is_valid) break;
+
+      blocks[i].trans.payer_id = _zigzag_decode(payer_id);
+      blocks[i].trans.payee_id = _zigzag_decode(payee_id);
+      blocks[i].trans.transaction_id = prev_transaction_id + _zigzag_decode(transaction_id_delta);
+      blocks[i].proof_of_work = proof_of_work;
+      prev_transaction_id = blocks[i].trans.transaction_id;
+    }
+    if (!is_valid || position != raw_size) break;
+
+    for (int i = 0; i < segment_blocks; i++) {
+      block blk = blocks[i];
+      blk.prev_hash = (prev_node == NULL) ? bitmap_init_zeros(0) : bitmap_copy(prev_node->hash);
+
+      prev_node = chain_accept_block(chn, blk);
+      if (prev_node == NULL) {
+        block_free(&blk);
+        break;
+      }
+      num_read++;
+    }
+  }
+
+  fclose(file);
+  free(raw);
+  free(stored);
+  free(blocks);
+
+  return num_read;
+}
+
+// Open the pending transaction log with segments `<prefix>.<seq>`, syncing after every `sync_every` transactions.
+// Transactions left in the log by an earlier run are replayed into the queue, except those already in `chn`
+pending_log pending_log_open(const char *prefix, int sync_every, chain *chn) {
+  if (sync_every <= 0 || strlen(prefix) >= FILENAME_MAX) {
+    fprintf(stderr, "Cannot open pending log \"%s\" syncing every %d transactions.\n", prefix, sync_every);
+    exit(EXIT_FAILURE);
+  }
+
+  pending_log log = {"", -1, sync_every, 0, NULL, 0, NULL, NULL, 0, 0, 0};
+  strcpy(log.prefix, prefix);
+
+  // Find the segments left by an earlier run
+  const char *slash = strrchr(prefix, '/');
+  const char *base = slash ? slash + 1 : prefix;
+  char dir_path[FILENAME_MAX];
+  _parent_dir(prefix, dir_path);
+
+  int *seqs = NULL;
+  int num_seqs = 0;
+  DIR *dir = opendir(dir_path);
+  for (struct dirent *entry = dir ? readdir(dir) : NULL; entry != NULL; entry = readdir(dir)) {
+    int base_length = strlen(base);
+    int seq, end = 0;
+    if (strncmp(entry->d_name, base, base_length) != 0 || entry->d_name[base_length] != '.' ||
+        sscanf(entry->d_name + base_length + 1, "%d%n", &seq, &end) != 1 || entry->d_name[base_length + 1 + end]) {
+      continue;
+    }
+
+    seqs = realloc(seqs, (num_seqs + 1) * sizeof *seqs);
+    if (!seqs) {
+      fprintf(stderr, "Error allocating memory for pending log.\n");
+      exit(EXIT_FAILURE);
+    }
+    seqs[num_seqs++] = seq;
+  }
+  if (dir) closedir(dir);
+  if (num_seqs > 0) qsort(seqs, num_seqs, sizeof *seqs, _compare_ints);
+
+  // Transactions that made it into a block before the last run stopped are already confirmed
+  int *chain_ids = malloc(chn->columns.size * sizeof *chain_ids);
+  if (!chain_ids && chn->columns.size > 0) {
+    fprintf(stderr, "Error allocating memory for pending log.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (chn->columns.size > 0) {
+    memcpy(chain_ids, chn->columns.transaction_ids, chn->columns.size * sizeof *chain_ids);
+    qsort(chain_ids, chn->columns.size, sizeof *chain_ids, _compare_ints);
+  }
+
+  for (int i = 0; i < num_seqs; i++) _pending_log_replay_segment(&log, seqs[i], chain_ids, chn->columns.size);
+  _pending_log_start_segment(&log);
+  _pending_log_remove_confirmed(&log, 1);
+
+  free(seqs);
+  free(chain_ids);
+
+  return log;
+}
+
+// Get the path of segment `seq` of `log` in `path`, which should hold `PENDING_SEGMENT_PATH_MAX` characters
+void _pending_segment_path(pending_log *log, int seq, char *path) {
+  snprintf(path, PENDING_SEGMENT_PATH_MAX, "%s.%d", log->prefix, seq);
+}
+
+// Read the intact transactions in segment `seq` into the queue of `log`, skipping those whose IDs are in the
+// sorted array `chain_ids`
+void _pending_log_replay_segment(pending_log *log, int seq, int *chain_ids, int num_chain_ids) {
+  char path[PENDING_SEGMENT_PATH_MAX];
+  _pending_segment_path(log, seq, path);
+
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "Failed to open pending log segment \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  pending_segment segment = {seq, 0, 0};
+  byte record[PENDING_RECORD_SIZE];
+  int has_header = (fread(record, 1, PENDING_LOG_HEADER_SIZE, file) == PENDING_LOG_HEADER_SIZE &&
+                    _load_u32(record) == PENDING_LOG_MAGIC && _load_u32(record + 4) == PENDING_LOG_VERSION);
+
+  // Reading stops at a torn or corrupt record, which was never acknowledged
+  while (has_header && fread(record, 1, PENDING_RECORD_SIZE, file) == PENDING_RECORD_SIZE &&
+         _load_u32(record) == PENDING_RECORD_PAYLOAD_SIZE &&
+         _load_u32(record + 4) == crc32(record + RECORD_HEADER_SIZE, PENDING_RECORD_PAYLOAD_SIZE)) {
+    const byte *payload = record + RECORD_HEADER_SIZE;
+    u64 amount_bits = _load_u64(payload);
+    transaction trans;
+    memcpy(&(trans.amount), &amount_bits, sizeof amount_bits);
+    trans.payer_id = _load_u32(payload + 8);
+    trans.payee_id = _load_u32(payload + 12);
+    trans.transaction_id = _load_u32(payload + 16);
+
+    segment.num_records++;
+    transaction_reserve_id(trans.transaction_id);
+    if (bsearch(&(trans.transaction_id), chain_ids, num_chain_ids, sizeof *chain_ids, _compare_ints)) continue;
+
+    _pending_log_enqueue(log, trans, seq);
+    segment.num_unconfirmed++;
+  }
+  fclose(file);
+
+  log->segments = realloc(log->segments, (log->num_segments + 1) * sizeof *log->segments);
+  if (!log->segments) {
+    fprintf(stderr, "Error allocating memory for pending log.\n");
+    exit(EXIT_FAILURE);
+  }
+  log->segments[log->num_segments++] = segment;
+}
+
+// Add `trans`, which is stored in segment `seq`, to the end of the queue of `log`
+void _pending_log_enqueue(pending_log *log, transaction trans, int seq) {
+  if (log->queue_head + log->queue_size == log->queue_capacity) {
+    log->queue_capacity = (log->queue_capacity == 0) ? PENDING_LOG_SEGMENT_RECORDS : 2 * log->queue_capacity;
+    log->queue = realloc(log->queue, log->queue_capacity * sizeof *log->queue);
+    log->queue_seqs = realloc(log->queue_seqs, log->queue_capacity * sizeof *log->queue_seqs);
+    if (!log->queue || !log->queue_seqs) {
+      fprintf(stderr, "Error allocating memory for pending log.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  log->queue[log->queue_head + log->queue_size] = trans;
+  log->queue_seqs[log->queue_head + log->queue_size] = seq;
+  log->queue_size++;
+}
+
+// Move the unconfirmed transactions of `log` to the front of its queue, dropping the confirmed ones before them
+void _pending_log_compact_queue(pending_log *log) {
+  memmove(log->queue, log->queue + log->queue_head, log->queue_size * sizeof *log->queue);
+  memmove(log->queue_seqs, log->queue_seqs + log->queue_head, log->queue_size * sizeof *log->queue_seqs);
+  log->queue_head = 0;
+}
+
+// Sync the current segment of `log`, if it has one, and start a new one after it. The directory is synced too, so
+// the new segment can't be lost in a crash after its transactions are acknowledged
+void _pending_log_start_segment(pending_log *log) {
+  if (log->fd >= 0) {
+    pending_log_sync(log);
+    close(log->fd);
+  }
+
+  int seq = (log->num_segments == 0) ? 0 : log->segments[log->num_segments - 1].seq + 1;
+  char path[PENDING_SEGMENT_PATH_MAX];
+  _pending_segment_path(log, seq, path);
+
+  log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  log->segments = realloc(log->segments, (log->num_segments + 1) * sizeof *log->segments);
+  if (log->fd < 0 || !log->segments) {
+    fprintf(stderr, "Failed to start pending log segment \"%s\".\n", path);
+    exit(EXIT_FAILURE);
+  }
+  log->segments[log->num_segments++] = (pending_segment){seq, 0, 0};
+  _sync_parent_dir(path);
+
+  byte header[PENDING_LOG_HEADER_SIZE];
+  _store_u32(header, PENDING_LOG_MAGIC);
+  _store_u32(header + 4, PENDING_LOG_VERSION);
+  _write_fully(log->fd, header, PENDING_LOG_HEADER_SIZE);
+  log->unsynced_records++;  // So the header is synced with the first batch
+}
+
+// Append `trans` to the queue of `log`. It is durable once the log is next synced, which happens by itself every
+// `sync_every` transactions; call `pending_log_sync` before acknowledging a smaller batch
+void pending_log_append(pending_log *log, transaction trans) {
+  if (log->segments[log->num_segments - 1].num_records == PENDING_LOG_SEGMENT_RECORDS) {
+    _pending_log_start_segment(log);
+    _pending_log_remove_confirmed(log, 1);
+    _pending_log_compact_queue(log);
+  }
+
+  byte record[PENDING_RECORD_SIZE];
+  byte *payload = record + RECORD_HEADER_SIZE;
+  u64 amount_bits;
+  memcpy(&amount_bits, &(trans.amount), sizeof amount_bits);
+  _store_u64(payload, amount_bits);
+  _store_u32(payload + 8, trans.payer_id);
+  _store_u32(payload + 12, trans.payee_id);
+  _store_u32(payload + 16, trans.transaction_id);
+  _store_u32(record, PENDING_RECORD_PAYLOAD_SIZE);
+  _store_u32(record + 4, crc32(payload, PENDING_RECORD_PAYLOAD_SIZE));
+  _write_fully(log->fd, record, PENDING_RECORD_SIZE);
+
+  _pending_log_enqueue(log, trans, log->segments[log->num_segments - 1].seq);
+  log->segments[log->num_segments - 1].num_records++;
+  log->segments[log->num_segments - 1].num_unconfirmed++;
+  log->unsynced_records++;
+  if (log->unsynced_records >= log->sync_every) pending_log_sync(log);
+}
+
+// Force the transactions appended to `log` to disk
+void pending_log_sync(pending_log *log) {
+  if (log->unsynced_records > 0 && fsync(log->fd) != 0) {
+    fprintf(stderr, "Failed to sync pending log.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  log->unsynced_records = 0;
+}
+
+// Remove the `count` oldest transactions from the queue of `log`, which have been confirmed in blocks that are
+// durable (e.g. synced to a block log). Segments with nothing left to confirm are deleted. The queue is in segment
+// order, so this only visits the confirmed transactions and the segments holding them
+void pending_log_confirm(pending_log *log, int count) {
+  if (count < 0 || count > log->queue_size) {
+    fprintf(stderr, "Cannot confirm %d of %d pending transactions.\n", count, log->queue_size);
+    exit(EXIT_FAILURE);
+  }
+
+  int segment = 0;
+  for (int i = log->queue_head; i < log->queue_head + count; i++) {
+    while (log->segments[segment].seq != log->queue_seqs[i]) segment++;
+    log->segments[segment].num_unconfirmed--;
+  }
+
+  log->queue_head += count;
+  log->queue_size -= count;
+
+  // Only the oldest segments can have been finished off, and the current one is kept
+  if (log->num_segments > 1 && log->segments[0].num_unconfirmed == 0) _pending_log_remove_confirmed(log, 1);
+}
+
+// Delete the segments of `log` whose transactions have all been confirmed, other than the current segment if
+// `keep_current` is set, and sync the directory so that confirmed segments aren't replayed after a crash
+void _pending_log_remove_confirmed(pending_log *log, int keep_current) {
+  int kept = 0;
+  int removed = 0;
+  for (int i = 0; i < log->num_segments; i++) {
+    int is_current = (i == log->num_segments - 1);
+    if (log->segments[i].num_unconfirmed > 0 || (is_current && keep_current)) {
+      log->segments[kept++] = log->segments[i];
+      continue;
+    }
+
+    char path[PENDING_SEGMENT_PATH_MAX];
+    _pending_segment_path(log, log->segments[i].seq, path);
+    unlink(path);
+    removed++;
+  }
+
+  log->num_segments = kept;
+  if (removed > 0) _sync_parent_dir(log->prefix);
+}
+
+// Sync and close `log`, freeing its memory. If nothing is pending, the log's files are deleted
+void pending_log_close(pending_log *log) {
+  pending_log_sync(log);
+  close(log->fd);
+  _pending_log_remove_confirmed(log, 0);
+
+  free(log->segments);
+  free(log->queue);
+  free(log->queue_seqs);
+  *log = (pending_log){"", -1, 0, 0, NULL, 0, NULL, NULL, 0, 0, 0};
+}
+
+// Compare the ints at `a` and `b`, for `qsort` and `bsearch`
+int _compare_ints(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
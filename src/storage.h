@@ -0,0 +1,187 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <pthread.h>
+#include "bitmap.h"
+#include "blockchain.h"
+
+#define BLOCK_LOG_MAGIC 0x474c4b42  // "BKLG"
+#define BLOCK_LOG_VERSION 1
+#define BLOCK_LOG_HEADER_SIZE 8
+#define RECORD_HEADER_SIZE 8  // Payload length and checksum
+#define BLOCK_RECORD_PAYLOAD_SIZE 61
+#define BLOCK_RECORD_SIZE (RECORD_HEADER_SIZE + BLOCK_RECORD_PAYLOAD_SIZE)
+#define BLOCK_LOG_READ_CHUNK_RECORDS 4096
+
+#define CHAIN_IMAGE_MAGIC 0x4d494b42  // "BKIM"
+#define CHAIN_IMAGE_VERSION 1
+#define CHAIN_IMAGE_HEADER_SIZE 16
+#define CHAIN_IMAGE_RECORD_SIZE 96
+
+#define BALANCE_SNAPSHOT_MAGIC 0x4e534b42  // "BKSN"
+#define BALANCE_SNAPSHOT_VERSION 1
+#define BALANCE_SNAPSHOT_HEADER_SIZE 48
+#define BALANCE_SNAPSHOT_INTERVAL 1000  // Suggested number of blocks between snapshots
+
+#define COMPACT_CHAIN_MAGIC 0x43434b42  // "BKCC"
+#define COMPACT_CHAIN_VERSION 1
+#define COMPACT_CHAIN_HEADER_SIZE 16
+#define COMPACT_SEGMENT_HEADER_SIZE 16
+#define COMPACT_SEGMENT_BLOCKS 4096
+#define COMPACT_BLOCK_MAX_SIZE 48  // Amount plus the varints, with room to spare
+#define MAX_VARINT_SIZE 10
+
+#define PENDING_LOG_MAGIC 0x4c504b42  // "BKPL"
+#define PENDING_LOG_VERSION 1
+#define PENDING_LOG_HEADER_SIZE 8
+#define PENDING_RECORD_PAYLOAD_SIZE 20
+#define PENDING_RECORD_SIZE (RECORD_HEADER_SIZE + PENDING_RECORD_PAYLOAD_SIZE)
+#define PENDING_LOG_SEGMENT_RECORDS 1024
+#define PENDING_SEGMENT_PATH_MAX (FILENAME_MAX + 16)  // Room for the prefix and ".<seq>"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+// When a block log forces its records to disk
+typedef enum SyncPolicy { SYNC_EVERY_BLOCK, SYNC_EVERY_N_BLOCKS, SYNC_INTERVAL } SyncPolicy;
+
+// Thread that syncs a block log every `interval_ms` milliseconds under SYNC_INTERVAL. It lives on the heap, as the
+// log holding it is passed around by value
+typedef struct block_log_syncer {
+  int fd;
+  int interval_ms;
+  int unsynced_records;  // Written since the last sync
+  int stopping;
+  pthread_mutex_t lock;  // Guards `unsynced_records` and `stopping`
+  pthread_cond_t wake;
+  pthread_t thread;
+} block_log_syncer;
+
+// Append-only file of blocks, each stored as a length-prefixed, checksummed record. Each record is written as it
+// is appended, and records are forced to disk together (group commit) according to the policy
+typedef struct block_log {
+  int fd;
+  SyncPolicy policy;
+  int sync_every;            // Number of blocks for SYNC_EVERY_N_BLOCKS, or milliseconds for SYNC_INTERVAL
+  int unsynced_records;      // Written since the last sync, unless `syncer` is counting them
+  int num_records;           // Including unsynced records
+  block_log_syncer *syncer;  // Only for SYNC_INTERVAL
+} block_log;
+
+// Read-only view of a chain image file mapped into memory. The file is a header followed by one fixed-size record
+// per block, so the offset of block i is computed rather than stored, and pages are only read in when touched
+typedef struct mapped_chain {
+  const byte *data;
+  long long data_size;
+  int size;
+} mapped_chain;
+
+// One file of a pending transaction log, holding up to `PENDING_LOG_SEGMENT_RECORDS` transactions
+typedef struct pending_segment {
+  int seq;  // The segment's file is `<prefix>.<seq>`
+  int num_records;
+  int num_unconfirmed;
+} pending_segment;
+
+// Write-ahead log of transactions waiting to be mined. Each transaction is appended to the current segment before
+// it is acknowledged, and segments are synced in batches. Once every transaction in a segment has been confirmed
+// in a block, the segment is deleted
+typedef struct pending_log {
+  char prefix[FILENAME_MAX];
+  int fd;  // Current segment, which is the last in `segments`
+  int sync_every;
+  int unsynced_records;
+  pending_segment *segments;  // Oldest first
+  int num_segments;
+  transaction *queue;  // Unconfirmed transactions from `queue_head` on, oldest first
+  int *queue_seqs;     // Segment holding each transaction in `queue`
+  int queue_head;      // Confirmed transactions before it are dropped when the next segment starts
+  int queue_size;      // Unconfirmed transactions
+  int queue_capacity;
+} pending_log;
+
+// Work for one thread of a reindex: a contiguous run of block log records, starting on a segment boundary, to
+// decode, hash and check, and the balances, transaction columns and segment filters of the blocks that passed
+typedef struct reindex_worker {
+  const byte *records;
+  int num_records;
+  int is_first;  // Whether the run starts with the genesis block
+  block *blocks;
+  bitmap *hashes;
+  int num_valid;  // Length of the prefix of the run that passed
+  balance_table balances;
+  transaction_columns columns;
+  bloom_filter *filters;  // Filter i covers blocks [i * CHAIN_SEGMENT_SIZE, ...) of the run
+  int num_filters;
+} reindex_worker;
+
+u32 crc32(const byte *data, int size);
+
+block_log block_log_open(const char *path, SyncPolicy policy, int sync_every);
+void block_log_append(block_log *log, block blk);
+void block_log_sync(block_log *log);
+int block_log_load(block_log *log, chain *chn);
+block block_log_read(block_log *log, int index);
+void chain_use_block_log(chain *chn, block_log *log, int hot_blocks);
+int block_log_reindex(block_log *log, chain *chn, int num_threads, balance_table *balances);
+void block_log_close(block_log *log);
+
+pending_log pending_log_open(const char *prefix, int sync_every, chain *chn);
+void pending_log_append(pending_log *log, transaction trans);
+void pending_log_sync(pending_log *log);
+void pending_log_confirm(pending_log *log, int count);
+void pending_log_close(pending_log *log);
+
+
+void mapped_chain_write(chain *chn, const char *path);
+mapped_chain mapped_chain_open(const char *path);
+block mapped_chain_get_block(mapped_chain mchn, int index);
+bitmap mapped_chain_get_hash(mapped_chain mchn, int index);
+void mapped_chain_close(mapped_chain *mchn);
+
+void balance_snapshot_save(balance_table table, chain_node *node, const char *path);
+int balance_snapshot_load(const char *path, balance_table *table, int *index, bitmap *hash);
+balance_table chain_restore_balances(chain *chn, const char *path, int *replayed_blocks);
+
+int lz_compress_bound(int input_size);
+int lz_compress(const byte *input, int input_size, byte *output);
+int lz_decompress(const byte *input, int input_size, byte *output, int output_size);
+void chain_write_compact(chain *chn, const char *path, int compress);
+int chain_read_compact(const char *path, chain *chn);
+
+void _store_u32(byte *buffer, u32 value);
+void _store_u64(byte *buffer, u64 value);
+u32 _load_u32(const byte *buffer);
+u64 _load_u64(const byte *buffer);
+void _encode_block_record(block blk, byte *buffer);
+block _decode_block_record(const byte *buffer);
+int _block_record_is_valid(const byte *buffer);
+void _write_fully(int fd, const byte *data, long long size);
+void _parent_dir(const char *path, char *dir_path);
+void _sync_parent_dir(const char *path);
+void _block_log_fsync(int fd);
+block_log_syncer *_block_log_syncer_start(int fd, int interval_ms);
+void *_block_log_syncer_run(void *arg);
+void _block_log_syncer_stop(block_log_syncer *syncer);
+block _block_log_store_read(void *source, int index);
+int _block_log_store_size(void *source);
+void *_reindex_worker_run(void *arg);
+chain_node **_active_branch_nodes(chain *chn);
+const byte *_mapped_chain_record(mapped_chain mchn, int index);
+void _pending_segment_path(pending_log *log, int seq, char *path);
+void _pending_log_enqueue(pending_log *log, transaction trans, int seq);
+void _pending_log_start_segment(pending_log *log);
+void _pending_log_replay_segment(pending_log *log, int seq, int *chain_ids, int num_chain_ids);
+void _pending_log_remove_confirmed(pending_log *log, int keep_current);
+void _pending_log_compact_queue(pending_log *log);
+int _compare_ints(const void *a, const void *b);
+u64 _zigzag_encode(long long value);
+long long _zigzag_decode(u64 value);
+int _store_varint(byte *buffer, u64 value);
+int _load_varint(const byte *buffer, int size, int *position, u64 *value);
+int _encode_compact_block(transaction trans, u64 proof_of_work, int prev_transaction_id, byte *buffer);
+int _lz_write_length(byte *output, int length);
+int _lz_read_length(const byte *input, int input_size, int *position, int *length);
+
+#endif
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "bitmap.h"
+#include "sha256.h"
+#include "blockchain.h"
+#include "storage.h"
+#include "stream.h"
+
+// Write the active branch of `chn` to `out` in `format`, oldest block first
+void chain_export(chain *chn, FILE *out, StreamFormat format) {
+  if (format == STREAM_BINARY) {
+    byte header[CHAIN_STREAM_HEADER_SIZE];
+    _store_u32(header, CHAIN_STREAM_MAGIC);
+    _store_u32(header + 4, CHAIN_STREAM_VERSION);
+    fwrite(header, 1, CHAIN_STREAM_HEADER_SIZE, out);
+  }
+
+  chain_node **nodes = _active_branch_nodes(chn);
+  for (int i = 0; i < chn->size; i++) {
+    if (format == STREAM_TEXT) {
+      char buffer[BLOCK_SERIALISATION_MAX_CHARS];
+      block_serialise(*chain_node_block(chn, nodes[i]), buffer, BLOCK_SERIALISATION_MAX_CHARS);
+      fprintf(out, "%s\n", buffer);
+    } else {
+      byte record[BLOCK_RECORD_SIZE];
+      _encode_block_record(*chain_node_block(chn, nodes[i]), record);
+      fwrite(record, 1, BLOCK_RECORD_SIZE, out);
+    }
+  }
+  free(nodes);
+
+  if (fflush(out) != 0 || ferror(out)) {
+    fprintf(stderr, "Failed to export chain.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Import the chain in `format` from `in` onto the end of `chn`, which is usually empty. Parsing, hashing and
+// linking run in a pipeline, with `num_validators` threads checking the proof of work of each block from its
+// stored nonce (nothing is mined again). Returns the number of blocks imported, or -1 if the stream is malformed
+// or a block is invalid, in which case the blocks before it are still in `chn`
+int chain_import(FILE *in, StreamFormat format, chain *chn, int num_validators) {
+  if (num_validators <= 0) {
+    fprintf(stderr, "Chain import cannot use %d validators.\n", num_validators);
+    exit(EXIT_FAILURE);
+  }
+
+  if (format == STREAM_BINARY) {
+    byte header[CHAIN_STREAM_HEADER_SIZE];
+    if (fread(header, 1, CHAIN_STREAM_HEADER_SIZE, in) != CHAIN_STREAM_HEADER_SIZE ||
+        _load_u32(header) != CHAIN_STREAM_MAGIC || _load_u32(header + 4) != CHAIN_STREAM_VERSION) {
+      return -1;
+    }
+  }
+
+  // Enough slots for the parser and every validator to be working on a batch while the oldest is being linked
+  stream_import imp = {in, format, NULL, num_validators + 2, 0, 0, 0, 0, 0};
+  pthread_mutex_init(&(imp.lock), NULL);
+  pthread_cond_init(&(imp.changed), NULL);
+
+  imp.batches = malloc(imp.depth * sizeof *imp.batches);
+  pthread_t *threads = malloc((num_validators + 1) * sizeof *threads);
+  if (!imp.batches || !threads) {
+    fprintf(stderr, "Error allocating memory for chain import.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < imp.depth; i++) {
+    imp.batches[i].blocks = malloc(STREAM_BATCH_BLOCKS * sizeof *imp.batches[i].blocks);
+    imp.batches[i].hashes = malloc(STREAM_BATCH_BLOCKS * sizeof *imp.batches[i].hashes);
+    if (!imp.batches[i].blocks || !imp.batches[i].hashes) {
+      fprintf(stderr, "Error allocating memory for chain import.\n");
+      exit(EXIT_FAILURE);
+    }
+    imp.batches[i].size = 0;
+    imp.batches[i].state = BATCH_EMPTY;
+  }
+
+  pthread_create(threads, NULL, _stream_import_parse, &imp);
+  for (int i = 1; i <= num_validators; i++) pthread_create(threads + i, NULL, _stream_import_validate, &imp);
+
+  // Link the batches in order. After the first invalid block the rest are only freed
+  int imported = 0;
+  int link_failed = 0;
+  for (int n = 0;; n++) {
+    stream_batch *batch = imp.batches + n % imp.depth;
+
+    pthread_mutex_lock(&(imp.lock));
+    while (!(n < imp.num_batches && batch->state == BATCH_HASHED) && !(imp.parse_done && n >= imp.num_batches)) {
+      pthread_cond_wait(&(imp.changed), &(imp.lock));
+    }
+    int finished = (n >= imp.num_batches);
+    pthread_mutex_unlock(&(imp.lock));
+
+    if (finished) break;
+
+    for (int i = 0; i < batch->size; i++) {
+      if (!link_failed && chain_append_hashed_block(chn, batch->blocks[i], batch->hashes[i]) != NULL) {
+        imported++;
+      } else {
+        link_failed = 1;
+        block_free(batch->blocks + i);
+        bitmap_free(batch->hashes + i);
+      }
+    }
+
+    pthread_mutex_lock(&(imp.lock));
+    batch->state = BATCH_EMPTY;
+    if (link_failed) imp.stopped = 1;
+    pthread_cond_broadcast(&(imp.changed));
+    pthread_mutex_unlock(&(imp.lock));
+  }
+
+  for (int i = 0; i <= num_validators; i++) pthread_join(threads[i], NULL);
+
+  for (int i = 0; i < imp.depth; i++) {
+    free(imp.batches[i].blocks);
+    free(imp.batches[i].hashes);
+  }
+  free(imp.batches);
+  free(threads);
+  pthread_mutex_destroy(&(imp.lock));
+  pthread_cond_destroy(&(imp.changed));
+
+  return (link_failed || imp.parse_failed) ? -1 : imported;
+}
+
+// Read one line from `in` into `line`, without its newline. Returns 0 if the line is missing or too long
+int _stream_read_line(FILE *in, char *line) {
+  if (!fgets(line, STREAM_LINE_MAX_CHARS, in)) return 0;
+
+  int length = strlen(line);
+  if (length == 0 || line[length - 1] != '\n') return 0;
+  line[length - 1] = '\0';
+
+  return 1;
+}
+
+// Read the next block in text form from `in` into `blk`. Returns 1 if a block was read, 0 at the end of the stream
+// and -1 if the stream is malformed
+int _stream_read_text_block(FILE *in, block *blk) {
+  char hash_line[STREAM_LINE_MAX_CHARS], trans_line[STREAM_LINE_MAX_CHARS], pow_line[STREAM_LINE_MAX_CHARS];
+
+  if (!_stream_read_line(in, hash_line)) return feof(in) ? 0 : -1;
+  if (!_stream_read_line(in, trans_line) || !_stream_read_line(in, pow_line)) return -1;
+
+  transaction trans;
+  unsigned long long proof_of_work;
+  int end = 0;
+  if (sscanf(trans_line, "%d pays %d %lf (%d)%n", &(trans.payer_id), &(trans.payee_id), &(trans.amount),
+             &(trans.transaction_id), &end) != 4 || trans_line[end] != '\0') {
+    return -1;
+  }
+  end = 0;
+  if (sscanf(pow_line, "%llu%n", &proof_of_work, &end) != 1 || pow_line[end] != '\0') return -1;
+
+  bitmap prev_hash;
+  if (hash_line[0] == '\0') {
+    prev_hash = bitmap_init_zeros(0);  // Genesis block
+  } else if (strlen(hash_line) != HASH_SIZE_HEX_CHARS || !bitmap_parse_hex(hash_line, &prev_hash)) {
+    return -1;
+  }
+
+  *blk = (block){prev_hash, trans, proof_of_work};
+
+  return 1;
+}
+
+// Read the next block in binary form from `in` into `blk`. Returns 1 if a block was read, 0 at the end of the
+// stream and -1 if the stream is malformed
+int _stream_read_binary_block(FILE *in, block *blk) {
+  byte record[BLOCK_RECORD_SIZE];
+  int read = fread(record, 1, BLOCK_RECORD_SIZE, in);
+
+  if (read == 0 && feof(in)) return 0;
+  if (read != BLOCK_RECORD_SIZE || !_block_record_is_valid(record)) return -1;
+
+  *blk = _decode_block_record(record);
+
+  return 1;
+}
+
+// Parser thread of an import: fill batches in order until the stream ends, is malformed, or the import is stopped
+void *_stream_import_parse(void *arg) {
+  stream_import *imp = arg;
+
+  for (int n = 0;; n++) {
+    stream_batch *batch = imp->batches + n % imp->depth;
+
+    pthread_mutex_lock(&(imp->lock));
+    while (batch->state != BATCH_EMPTY && !imp->stopped) pthread_cond_wait(&(imp->changed), &(imp->lock));
+    int stopped = imp->stopped;
+    pthread_mutex_unlock(&(imp->lock));
+
+    // An empty slot belongs to the parser, so it is filled without holding the lock
+    int status = 1;
+    batch->size = 0;
+    while (!stopped && batch->size < STREAM_BATCH_BLOCKS) {
+      status = (imp->format == STREAM_TEXT) ? _stream_read_text_block(imp->in, batch->blocks + batch->size)
+                                            : _stream_read_binary_block(imp->in, batch->blocks + batch->size);
+      if (status != 1) break;
+      batch->size++;
+    }
+
+    pthread_mutex_lock(&(imp->lock));
+    if (batch->size > 0) {
+      batch->state = BATCH_PARSED;
+      imp->num_batches++;
+    }
+    if (stopped || status != 1) imp->parse_done = 1;
+    if (status < 0) imp->parse_failed = 1;
+    pthread_cond_broadcast(&(imp->changed));
+    pthread_mutex_unlock(&(imp->lock));
+
+    if (stopped || status != 1) return NULL;
+  }
+}
+
+// Validator thread of an import: hash the next parsed batch until every batch has been hashed
+void *_stream_import_validate(void *arg) {
+  stream_import *imp = arg;
+  bitmap_arena arena = bitmap_arena_init(SHA256_ARENA_BLOCK_BYTES);
+
+  while (1) {
+    pthread_mutex_lock(&(imp->lock));
+    while (imp->next_to_hash >= imp->num_batches && !imp->parse_done) {
+      pthread_cond_wait(&(imp->changed), &(imp->lock));
+    }
+    if (imp->next_to_hash >= imp->num_batches) {
+      pthread_mutex_unlock(&(imp->lock));
+      bitmap_arena_free(&arena);
+      return NULL;
+    }
+    stream_batch *batch = imp->batches + imp->next_to_hash % imp->depth;
+    imp->next_to_hash++;
+    batch->state = BATCH_HASHING;
+    pthread_mutex_unlock(&(imp->lock));
+
+    for (int i = 0; i < batch->size; i++) {
+      batch->hashes[i] = block_hash_in(&arena, batch->blocks[i]);
+      bitmap_arena_reset(&arena);
+    }
+
+    pthread_mutex_lock(&(imp->lock));
+    batch->state = BATCH_HASHED;
+    pthread_cond_broadcast(&(imp->changed));
+    pthread_mutex_unlock(&(imp->lock));
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "bitmap.h"
+#include "blockchain.h"
+
+#define CHAIN_STREAM_MAGIC 0x54534b42  // "BKST"
+#define CHAIN_STREAM_VERSION 1
+#define CHAIN_STREAM_HEADER_SIZE 8
+#define STREAM_BATCH_BLOCKS 1024
+#define STREAM_LINE_MAX_CHARS 128
+
+// How a chain is written to a stream. Text is each block's `block_serialise` form, one field per line. Binary is a
+// header followed by block log records
+typedef enum StreamFormat { STREAM_TEXT, STREAM_BINARY } StreamFormat;
+
+// Where a batch of an import is in the pipeline
+typedef enum StreamBatchState { BATCH_EMPTY, BATCH_PARSED, BATCH_HASHING, BATCH_HASHED } StreamBatchState;
+
+// Blocks parsed from a stream, with their hashes once the validators have computed them
+typedef struct stream_batch {
+  block *blocks;
+  bitmap *hashes;
+  int size;
+  StreamBatchState state;
+} stream_batch;
+
+// State shared by the threads of an import. The parser fills batches in order, any validator hashes the next
+// parsed batch, and the importing thread links the hashed batches onto the chain in order. Batch n lives in slot
+// `n % depth` of `batches`, so at most `depth` batches are in memory at once
+typedef struct stream_import {
+  FILE *in;
+  StreamFormat format;
+  stream_batch *batches;
+  int depth;
+  int num_batches;  // Batches parsed so far
+  int next_to_hash;
+  int parse_done;
+  int parse_failed;
+  int stopped;  // Set when a block fails to link, so the parser stops reading
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} stream_import;
+
+void chain_export(chain *chn, FILE *out, StreamFormat format);
+int chain_import(FILE *in, StreamFormat format, chain *chn, int num_validators);
+
+int _stream_read_line(FILE *in, char *line);
+int _stream_read_text_block(FILE *in, block *blk);
+int _stream_read_binary_block(FILE *in, block *blk);
+void *_stream_import_parse(void *arg);
+void *_stream_import_validate(void *arg);
+
+#endif
@@ -1,13 +1,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 #include "bitmap.h"
 #include "sha256.h"
+#include "bloom.h"
 #include "blockchain.h"
+#include "shard.h"
+#include "storage.h"
+#include "stream.h"
+#include "roaring.h"
 
-#define NUM_BITMAP_TESTS 24
+#define NUM_BITMAP_TESTS 33
 #define NUM_SHA256_TESTS 5
-#define NUM_BLOCKCHAIN_TESTS 5
+#define NUM_BLOCKCHAIN_TESTS 13
+#define NUM_SNAPSHOT_READERS 2
+#define NUM_BLOOM_TESTS 2
+#define NUM_SHARD_TESTS 1
+#define NUM_STORAGE_TESTS 11
+#define NUM_STREAM_TESTS 2
+#define NUM_ROARING_TESTS 2
 
 // Function signature for test functions
 typedef int (*test)(void);
@@ -402,6 +416,471 @@ int test_bitmap_24() {
   return (result == 4);
 }
 
+int test_bitmap_25() {
+  // Compare the word-wise shifts, rotations and slices with the bit-by-bit definitions, across word boundaries
+  int sizes[3] = {7, 64, 300};
+  int result = 1;
+
+  for (int s = 0; s < 3; s++) {
+    int size = sizes[s];
+    bitmap bmap = bitmap_init_zeros(size);
+    for (int i = 0; i < size; i++) bitmap_set_bit(&bmap, i, (i * i + 3 * i) % 7 < 3);
+
+    for (int count = -size - 3; count <= size + 3; count += (size > 64) ? 13 : 1) {
+      bitmap lshifted = bitmap_lshift(bmap, count);
+      bitmap rshifted = bitmap_rshift(bmap, count);
+      bitmap lrotated = bitmap_lrotate(bmap, count);
+      bitmap rrotated = bitmap_rrotate(bmap, count);
+
+      for (int i = 0; i < size; i++) {
+        int shifted_index = i + count;
+        int expected = (0 <= shifted_index && shifted_index < size) ? bitmap_get_bit(bmap, shifted_index) : 0;
+        result &= (bitmap_get_bit(lshifted, i) == expected);
+
+        shifted_index = i - count;
+        expected = (0 <= shifted_index && shifted_index < size) ? bitmap_get_bit(bmap, shifted_index) : 0;
+        result &= (bitmap_get_bit(rshifted, i) == expected);
+
+        int rotated_index = (((i + count) % size) + size) % size;
+        result &= (bitmap_get_bit(lrotated, i) == bitmap_get_bit(bmap, rotated_index));
+        rotated_index = (((i - count) % size) + size) % size;
+        result &= (bitmap_get_bit(rrotated, i) == bitmap_get_bit(bmap, rotated_index));
+      }
+
+      bitmap_free(&lshifted);
+      bitmap_free(&rshifted);
+      bitmap_free(&lrotated);
+      bitmap_free(&rrotated);
+    }
+
+    for (int start = 0; start < size; start += 5) {
+      for (int end = start; end <= size; end += 11) {
+        bitmap slice = bitmap_slice(bmap, start, end);
+        result &= (slice.size == end - start);
+        for (int i = 0; i < slice.size; i++) {
+          result &= (bitmap_get_bit(slice, i) == bitmap_get_bit(bmap, start + i));
+        }
+        bitmap_free(&slice);
+      }
+    }
+
+    bitmap_free(&bmap);
+  }
+
+  return (result == 1);
+}
+
+int test_bitmap_26() {
+  bitmap small = bitmap_init_string("10110");
+  bitmap hash = bitmap_init_zeros(BITMAP_INLINE_BITS);
+  bitmap large = bitmap_init_zeros(BITMAP_INLINE_BITS + 1);
+
+  // Only bitmaps too big for the inline buffer are allocated
+  int result = (small.map == NULL) + (hash.map == NULL) + (large.map != NULL);
+
+  // Copying an inline bitmap by value copies its bits, so changing the copy leaves the original alone
+  bitmap small_value = small;
+  bitmap_set_bit(&small_value, 1, 1);
+  bitmap small_copy = bitmap_copy(small);
+  result += (bitmap_get_bit(small, 1) == 0) + bitmap_equal(small, small_copy);
+
+  bitmap_set_bit(&large, BITMAP_INLINE_BITS, 1);
+  bitmap large_copy = bitmap_copy(large);
+  result += (bitmap_get_bit(large_copy, BITMAP_INLINE_BITS) == 1) + (bitmap_bytes(&large) == large.map);
+
+  // Freeing is safe either way, and more than once
+  bitmap_free(&small);
+  bitmap_free(&small);
+  bitmap_free(&hash);
+  bitmap_free(&large);
+  bitmap_free(&large);
+  bitmap_free(&small_copy);
+  bitmap_free(&large_copy);
+  result += (large.map == NULL);
+
+  return (result == 8);
+}
+
+int test_bitmap_27() {
+  // Compare each in-place operation, on both inline and heap bitmaps, with the allocating version
+  int sizes[2] = {29, 300};
+  int result = 1;
+
+  for (int s = 0; s < 2; s++) {
+    bitmap bmap1 = bitmap_init_zeros(sizes[s]);
+    bitmap bmap2 = bitmap_init_zeros(sizes[s]);
+    for (int i = 0; i < sizes[s]; i++) {
+      bitmap_set_bit(&bmap1, i, i % 3 == 0);
+      bitmap_set_bit(&bmap2, i, i % 5 < 2);
+    }
+
+    bitmap expected[8] = {bitmap_xor(bmap1, bmap2),     bitmap_not(bmap1),         bitmap_lshift(bmap1, 37),
+                          bitmap_rshift(bmap1, 37),     bitmap_lrotate(bmap1, 70), bitmap_rrotate(bmap1, 70),
+                          bitmap_add_mod(bmap1, bmap2), bitmap_choose(bmap1, bmap2, bmap1)};
+    bitmap dest = bitmap_init_zeros(sizes[s]);
+    for (int op = 0; op < 8; op++) {
+      bitmap_copy_into(&dest, bmap1);
+      switch (op) {
+        case 0:
+          bitmap_xor_into(&dest, dest, bmap2);
+          break;
+        case 1:
+          bitmap_not_into(&dest, dest);
+          break;
+        case 2:
+          bitmap_lshift_into(&dest, dest, 37);
+          break;
+        case 3:
+          bitmap_rshift_into(&dest, dest, 37);
+          break;
+        case 4:
+          bitmap_lrotate_into(&dest, dest, 70);
+          break;
+        case 5:
+          bitmap_rrotate_into(&dest, dest, 70);
+          break;
+        case 6:
+          bitmap_add_mod_into(&dest, dest, bmap2);
+          break;
+        case 7:
+          bitmap_choose_into(&dest, dest, bmap2, dest);
+          break;
+      }
+      result &= bitmap_equal(dest, expected[op]);
+      bitmap_free(expected + op);
+    }
+
+    bitmap slice = bitmap_slice(bmap1, 5, sizes[s]);
+    bitmap slice_dest = bitmap_init_zeros(sizes[s] - 5);
+    bitmap_slice_into(&slice_dest, bmap1, 5, sizes[s]);
+    result &= bitmap_equal(slice_dest, slice);
+
+    bitmap_free(&slice);
+    bitmap_free(&slice_dest);
+    bitmap_free(&dest);
+    bitmap_free(&bmap1);
+    bitmap_free(&bmap2);
+  }
+
+  return (result == 1);
+}
+
+int test_bitmap_28() {
+  bitmap_arena arena = bitmap_arena_init(64);
+
+  // Large bitmaps come from the arena, small ones stay inline, and bitmaps from different blocks don't overlap
+  bitmap first = bitmap_init_zeros_in(&arena, BITMAP_INLINE_BITS + 1);
+  bitmap second = bitmap_init_zeros_in(&arena, BITMAP_INLINE_BITS + 1);
+  bitmap bigger = bitmap_init_zeros_in(&arena, 1000);
+  bitmap small = bitmap_init_zeros_in(&arena, 8);
+  bitmap_set_bit(&first, BITMAP_INLINE_BITS, 1);
+  bitmap_set_bit(&bigger, 999, 1);
+  int result = (first.map != NULL) + (small.map == NULL) + (bitmap_get_bit(second, BITMAP_INLINE_BITS) == 0);
+  result += (bitmap_get_bit(bigger, 999) == 1) + (bitmap_get_bit(first, BITMAP_INLINE_BITS) == 1);
+
+  // Copies work the same in an arena, and freeing an arena bitmap leaves its memory to the arena
+  bitmap copy = bitmap_copy_in(&arena, bigger);
+  result += bitmap_equal(copy, bigger);
+  bitmap_free(&copy);
+  result += (copy.map == NULL);
+
+  // A reset hands the same memory out again, zeroed
+  byte *first_map = first.map;
+  bitmap_arena_reset(&arena);
+  bitmap reused = bitmap_init_zeros_in(&arena, BITMAP_INLINE_BITS + 1);
+  result += (reused.map == first_map) + (bitmap_get_bit(reused, BITMAP_INLINE_BITS) == 0);
+
+  // Without an arena the bitmap is on the heap as usual
+  bitmap heap = bitmap_init_zeros_in(NULL, BITMAP_INLINE_BITS + 1);
+  result += heap.owns_map;
+  bitmap_free(&heap);
+
+  // Hashing in an arena matches hashing on the heap
+  bitmap hash = sha256("abc");
+  bitmap arena_hash = sha256_in(&arena, "abc");
+  result += bitmap_equal(hash, arena_hash);
+
+  bitmap_arena_free(&arena);
+
+  return (result == 11);
+}
+
+int test_bitmap_29() {
+  // Compare the logical operators with the bit-by-bit definitions, for sizes that leave every kind of tail
+  int sizes[4] = {5, 256, 1000, 8 * 4096 + 77};
+  int result = 0;
+
+  for (int s = 0; s < 4; s++) {
+    int size = sizes[s];
+    bitmap bmap1 = bitmap_init_zeros(size);
+    bitmap bmap2 = bitmap_init_zeros(size);
+    for (int i = 0; i < size; i++) {
+      bitmap_set_bit(&bmap1, i, (i * i + 3 * i) % 7 < 3);
+      bitmap_set_bit(&bmap2, i, (i * 5 + i / 3) % 11 < 6);
+    }
+
+    bitmap or_bmap = bitmap_or(bmap1, bmap2);
+    bitmap and_bmap = bitmap_and(bmap1, bmap2);
+    bitmap xor_bmap = bitmap_xor(bmap1, bmap2);
+    bitmap not_bmap = bitmap_not(bmap1);
+    int mismatches = 0;
+    for (int i = 0; i < size; i++) {
+      int bit1 = bitmap_get_bit(bmap1, i);
+      int bit2 = bitmap_get_bit(bmap2, i);
+      mismatches += (bitmap_get_bit(or_bmap, i) != (bit1 | bit2)) + (bitmap_get_bit(and_bmap, i) != (bit1 & bit2));
+      mismatches += (bitmap_get_bit(xor_bmap, i) != (bit1 ^ bit2)) + (bitmap_get_bit(not_bmap, i) != !bit1);
+    }
+    result += (mismatches == 0);
+
+    // The portable kernel agrees with whichever one the CPU picked
+    bitmap scalar_xor = bitmap_init_zeros(size);
+    _bitmap_bytes_operator_scalar(bitmap_bytes(&scalar_xor), bitmap_bytes(&bmap1), bitmap_bytes(&bmap2),
+                                  _full_bytes_needed(size), XOR);
+    result += bitmap_equal(scalar_xor, xor_bmap);
+    bitmap_free(&scalar_xor);
+
+    // Bits past the end stay clear, so a complement twice over is equal to the original
+    bitmap_not_into(&not_bmap, not_bmap);
+    result += bitmap_equal(not_bmap, bmap1) + !bitmap_equal(bmap1, bmap2);
+
+    // A difference in the last bit is found whichever kernel compares it
+    bitmap copy = bitmap_copy(bmap1);
+    result += bitmap_equal(copy, bmap1);
+    bitmap_set_bit(&copy, size - 1, !bitmap_get_bit(copy, size - 1));
+    result += !bitmap_equal(copy, bmap1);
+
+    bitmap_free(&bmap1);
+    bitmap_free(&bmap2);
+    bitmap_free(&or_bmap);
+    bitmap_free(&and_bmap);
+    bitmap_free(&xor_bmap);
+    bitmap_free(&not_bmap);
+    bitmap_free(&copy);
+  }
+
+  return (result == 24);
+}
+
+int test_bitmap_30() {
+  // Compare the word-wise scans with bit-by-bit ones, on sparse and dense bitmaps that end mid-word
+  int sizes[4] = {0, 7, 64, 1000};
+  int result = 0;
+
+  for (int s = 0; s < 4; s++) {
+    for (int dense = 0; dense <= 1; dense++) {
+      int size = sizes[s];
+      bitmap bmap = bitmap_init_zeros(size);
+      for (int i = 0; i < size; i++) bitmap_set_bit(&bmap, i, ((i * i + 3 * i) % 97 < 3) != dense);
+
+      int leading_zeros = 0;
+      while (leading_zeros < size && bitmap_get_bit(bmap, leading_zeros) == 0) leading_zeros++;
+      result += (bitmap_leading_zeros(bmap) == leading_zeros);
+
+      // Walking the set bits visits each one once, and likewise the clear bits
+      int mismatches = 0;
+      int count = 0;
+      for (int i = bitmap_find_next_set(bmap, 0); i != -1; i = bitmap_find_next_set(bmap, i + 1)) {
+        mismatches += (bitmap_get_bit(bmap, i) != 1);
+        count++;
+      }
+      result += (bitmap_popcount(bmap) == count);
+      for (int i = bitmap_find_next_clear(bmap, 0); i != -1; i = bitmap_find_next_clear(bmap, i + 1)) {
+        mismatches += (bitmap_get_bit(bmap, i) != 0);
+        count++;
+      }
+      result += (count == size);
+
+      for (int start = 0; start < size; start++) {
+        int next_set = start;
+        while (next_set < size && bitmap_get_bit(bmap, next_set) == 0) next_set++;
+        mismatches += (bitmap_find_next_set(bmap, start) != ((next_set < size) ? next_set : -1));
+      }
+      result += (mismatches == 0);
+      result += (bitmap_find_next_set(bmap, size) == -1) + (bitmap_find_next_clear(bmap, size) == -1);
+
+      bitmap_free(&bmap);
+    }
+  }
+
+  return (result == 48);
+}
+
+int test_bitmap_31() {
+  // Decoding accepts either case and encoding gives lower case, so a hash survives a round trip
+  bitmap hash = sha256("abc");
+  char hex[HASH_SIZE_HEX_CHARS + 1];
+  bitmap_string_hex(hash, hex, HASH_SIZE_HEX_CHARS + 1);
+  bitmap decoded = bitmap_init_hex(hex);
+  int result = bitmap_equal(hash, decoded) +
+               (strcmp(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0);
+
+  bitmap mixed_case = bitmap_init_hex("0aF1");
+  bitmap expected = bitmap_init_string("0000101011110001");
+  result += bitmap_equal(mixed_case, expected);
+
+  // An odd number of digits fills the high half of the last byte
+  bitmap odd = bitmap_init_hex("a5c");
+  bitmap odd_expected = bitmap_init_string("101001011100");
+  char odd_hex[5];
+  bitmap_string_hex(odd, odd_hex, 5);
+  result += bitmap_equal(odd, odd_expected) + (strcmp(odd_hex, "a5c0") == 0);
+
+  // Anything other than hex digits is rejected without allocating
+  bitmap invalid = {0, NULL};
+  result += !bitmap_parse_hex("12g4", &invalid) + !bitmap_parse_hex("12 4", &invalid) + (invalid.map == NULL);
+  bitmap empty;
+  result += bitmap_parse_hex("", &empty) + (empty.size == 0);
+
+  bitmap_free(&hash);
+  bitmap_free(&decoded);
+  bitmap_free(&mixed_case);
+  bitmap_free(&expected);
+  bitmap_free(&odd);
+  bitmap_free(&odd_expected);
+  bitmap_free(&empty);
+
+  return (result == 10);
+}
+
+// Get a bitmap of `size` bits holding `value`, most significant bit first
+bitmap _bitmap_from_u64(u64 value, int size) {
+  bitmap result = bitmap_init_zeros(size);
+  for (int i = 0; i < size; i++) {
+    bitmap_set_bit(&result, i, (size - 1 - i < WORD_SIZE) && ((value >> (size - 1 - i)) & 1));
+  }
+
+  return result;
+}
+
+// Get the number held in `bmap`, which must be at most 64 bits, most significant bit first
+u64 _bitmap_to_u64(bitmap bmap) {
+  u64 value = 0;
+  for (int i = 0; i < bmap.size; i++) value = (value << 1) | bitmap_get_bit(bmap, i);
+
+  return value;
+}
+
+int test_bitmap_32() {
+  // Compare with native arithmetic at sizes that fill a word and that leave padding in it
+  int sizes[3] = {13, 40, 64};
+  u64 values[5] = {0, 1, 0x1fff, 0x123456789abcdefULL, ~0ULL};
+  int result = 0;
+  int mismatches = 0;
+
+  for (int s = 0; s < 3; s++) {
+    int size = sizes[s];
+    u64 mask = (size == 64) ? ~0ULL : (1ULL << size) - 1;
+
+    for (int a = 0; a < 5; a++) {
+      for (int b = 0; b < 5; b++) {
+        u64 value1 = values[a] & mask;
+        u64 value2 = values[b] & mask;
+        bitmap bmap1 = _bitmap_from_u64(value1, size);
+        bitmap bmap2 = _bitmap_from_u64(value2, size);
+        bitmap dest = bitmap_init_zeros(size);
+
+        int carry = bitmap_add_into(&dest, bmap1, bmap2);
+        mismatches += (_bitmap_to_u64(dest) != ((value1 + value2) & mask));
+        mismatches += (carry != ((unsigned __int128)value1 + value2 > mask));
+        int borrow = bitmap_sub_into(&dest, bmap1, bmap2);
+        mismatches += (_bitmap_to_u64(dest) != ((value1 - value2) & mask)) + (borrow != (value2 > value1));
+        mismatches += (bitmap_compare(bmap1, bmap2) != ((value1 < value2) ? -1 : (value1 > value2)));
+
+        unsigned __int128 product = (unsigned __int128)value1 * (value2 + 3);
+        u64 overflow = bitmap_mul_word_into(&dest, bmap1, value2 + 3);
+        mismatches += (_bitmap_to_u64(dest) != ((u64)product & mask)) + (overflow != (u64)(product >> size));
+
+        u64 remainder = bitmap_div_word_into(&dest, bmap1, value2 + 3);
+        mismatches += (_bitmap_to_u64(dest) != value1 / (value2 + 3)) + (remainder != value1 % (value2 + 3));
+
+        bitmap_free(&bmap1);
+        bitmap_free(&bmap2);
+        bitmap_free(&dest);
+      }
+    }
+  }
+  result += (mismatches == 0);
+
+  // A carry out of the trailing bits runs on into the full bytes
+  bitmap addend1 = bitmap_init_string("000000001111");
+  bitmap addend2 = bitmap_init_string("000000000001");
+  bitmap sum = bitmap_add_mod(addend1, addend2);
+  bitmap expected = bitmap_init_string("000000010000");
+  result += bitmap_equal(sum, expected);
+
+  // Across 256 bits, all ones plus one wraps to zero with a carry
+  bitmap ones = bitmap_init_zeros(HASH_SIZE_BITS);
+  bitmap_not_into(&ones, ones);
+  bitmap one = _bitmap_from_u64(1, HASH_SIZE_BITS);
+  bitmap wrapped = bitmap_init_zeros(HASH_SIZE_BITS);
+  result += (bitmap_add_into(&wrapped, ones, one) == 1) + (bitmap_leading_zeros(wrapped) == HASH_SIZE_BITS);
+  result += (bitmap_sub_into(&wrapped, wrapped, one) == 1) + bitmap_equal(wrapped, ones);
+
+  // At a size with padding, multiplying back the quotient and adding the remainder gives the original
+  bitmap hash = sha256("abc");
+  bitmap original = bitmap_slice(hash, 0, 130);
+  bitmap quotient = bitmap_init_zeros(130);
+  u64 remainder = bitmap_div_word_into(&quotient, original, 1000003);
+  bitmap rebuilt = bitmap_init_zeros(130);
+  bitmap remainder_bmap = _bitmap_from_u64(remainder, 130);
+  result += (bitmap_mul_word_into(&rebuilt, quotient, 1000003) == 0) + (remainder < 1000003);
+  result += (bitmap_compare(rebuilt, original) <= 0);
+  bitmap_add_into(&rebuilt, rebuilt, remainder_bmap);
+  result += bitmap_equal(rebuilt, original) + (bitmap_compare(quotient, original) == -1);
+
+  bitmap_free(&addend1);
+  bitmap_free(&addend2);
+  bitmap_free(&sum);
+  bitmap_free(&expected);
+  bitmap_free(&ones);
+  bitmap_free(&one);
+  bitmap_free(&wrapped);
+  bitmap_free(&hash);
+  bitmap_free(&original);
+  bitmap_free(&quotient);
+  bitmap_free(&rebuilt);
+  bitmap_free(&remainder_bmap);
+
+  return (result == 11);
+}
+
+int test_bitmap_33() {
+  // Compare rank and select with counting bit by bit, on sparse, dense and full bitmaps spanning superblocks
+  int sizes[4] = {0, 100, 3 * RANK_SUPERBLOCK_BITS + 77, 2 * RANK_SUPERBLOCK_BITS};
+  int result = 0;
+
+  for (int s = 0; s < 4; s++) {
+    for (int density = 0; density < 3; density++) {
+      int size = sizes[s];
+      bitmap bmap = bitmap_init_zeros(size);
+      for (int i = 0; i < size; i++) {
+        int sparse_bit = ((i * 7 + i / 1000) % 4099 == 0);
+        int dense_bit = ((i ^ (i / 3)) % 7 < 3);
+        bitmap_set_bit(&bmap, i, (density == 0) ? sparse_bit : (density == 1) ? dense_bit : 1);
+      }
+
+      bitmap_rank_index index = bitmap_rank_index_init(bmap);
+      int rank = 0;
+      int mismatches = 0;
+      for (int i = 0; i < size; i++) {
+        mismatches += (bitmap_rank(&index, i) != rank);
+        if (bitmap_get_bit(bmap, i)) {
+          mismatches += (bitmap_select(&index, rank) != i);
+          rank++;
+        }
+      }
+      result += (mismatches == 0);
+      result += (bitmap_rank(&index, size) == rank) + (bitmap_select(&index, rank) == -1);
+      result += (bitmap_select(&index, -1) == -1);
+
+      bitmap_rank_index_free(&index);
+      bitmap_free(&bmap);
+    }
+  }
+
+  return (result == 48);
+}
+
 int test_sha256_1() {
   bitmap padded = _pad_message(
       "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
@@ -595,8 +1074,8 @@ int test_blockchain_5() {
   chain_add_node(&chn, t2);
   chain_add_node(&chn, t3);
 
-  int result = block_proof_of_work_is_valid(chn.end->blk) +
-               block_prev_block_hash_matches(chn.start->blk, chn.end->prev->blk) + (chn.size == 3) +
+  int result = block_proof_of_work_is_valid(*chn.end->blk) +
+               block_prev_block_hash_matches(*chn.start->blk, *chn.end->prev->blk) + (chn.size == 3) +
                (chn.end->prev->index == 1);
 
   chain_free(&chn);
@@ -604,6 +1083,771 @@ int test_blockchain_5() {
   return (result == 4);
 }
 
+int test_blockchain_6() {
+  transaction trans = transaction_init(10, 0, 1);
+
+  // Build the nodes directly, since ancestor lookups don't depend on the proof of work
+  chain_node *nodes[100];
+  nodes[0] = chain_node_init(NULL, trans);
+  for (int i = 1; i < 100; i++) nodes[i] = chain_node_init(nodes[i - 1], trans);
+
+  int result =
+      (chain_node_get_ancestor(nodes[99], 100) == NULL) + (chain_node_get_ancestor(nodes[99], -1) == NULL);
+  for (int i = 0; i < 100; i++) {
+    result += (chain_node_get_ancestor(nodes[99], i) == nodes[i]);
+    result += (chain_node_get_ancestor(nodes[i], i) == nodes[i]);
+  }
+
+  for (int i = 0; i < 100; i++) chain_node_free(nodes[i]);
+
+  return (result == 202);
+}
+
+int test_blockchain_7() {
+  transaction trans = transaction_init(10, 0, 1);
+
+  // A trunk of 30 nodes, with one branch of 20 nodes forking off node 12 and another of 5 nodes off node 29
+  chain_node *trunk[30];
+  chain_node *branch1[20];
+  chain_node *branch2[5];
+  trunk[0] = chain_node_init(NULL, trans);
+  for (int i = 1; i < 30; i++) trunk[i] = chain_node_init(trunk[i - 1], trans);
+  branch1[0] = chain_node_init(trunk[12], trans);
+  for (int i = 1; i < 20; i++) branch1[i] = chain_node_init(branch1[i - 1], trans);
+  branch2[0] = chain_node_init(trunk[29], trans);
+  for (int i = 1; i < 5; i++) branch2[i] = chain_node_init(branch2[i - 1], trans);
+
+  chain_node *unrelated = chain_node_init(NULL, trans);
+
+  int result = (chain_node_last_common_ancestor(trunk[29], branch1[19]) == trunk[12]) +
+               (chain_node_last_common_ancestor(branch1[3], trunk[20]) == trunk[12]) +
+               (chain_node_last_common_ancestor(branch1[19], branch2[4]) == trunk[12]) +
+               (chain_node_last_common_ancestor(branch2[4], trunk[7]) == trunk[7]) +
+               (chain_node_last_common_ancestor(trunk[29], trunk[29]) == trunk[29]) +
+               (chain_node_last_common_ancestor(unrelated, branch2[2]) == NULL);
+
+  for (int i = 0; i < 30; i++) chain_node_free(trunk[i]);
+  for (int i = 0; i < 20; i++) chain_node_free(branch1[i]);
+  for (int i = 0; i < 5; i++) chain_node_free(branch2[i]);
+  chain_node_free(unrelated);
+
+  return (result == 6);
+}
+
+int test_blockchain_8() {
+  transaction_columns cols = transaction_columns_init();
+
+  // 11 transactions so that both the vectorised loop and the scalar tail are used
+  for (int i = 1; i <= 11; i++) transaction_columns_append(&cols, transaction_init(i, i % 3, (i + 1) % 3));
+
+  chain chn = chain_init();
+  chain_add_node(&chn, transaction_init(5, 0, 1));
+  chain_add_node(&chn, transaction_init(7, 1, 2));
+
+  // Account 2 pays in 2, 5, 8, 11 and is paid in 1, 4, 7, 10
+  int result = (cols.size == 11) + (transaction_columns_total_amount(cols) == 66) +
+               (transaction_columns_account_volume(cols, 2) == 48) +
+               (transaction_columns_account_volume(cols, 7) == 0) +
+               (transaction_columns_count_in_range(cols, 3, 9) == 6) +
+               (transaction_columns_count_in_range(cols, 20, 30) == 0) + (chn.columns.size == 2) +
+               (chn.columns.amounts[1] == 7) + (chn.columns.payee_ids[1] == 2);
+
+  transaction_columns_free(&cols);
+  chain_free(&chn);
+
+  return (result == 9);
+}
+
+int test_blockchain_9() {
+  chain chn = chain_init();
+  chain_add_node(&chn, transaction_init(5, 0, 1));
+  chain_add_node(&chn, transaction_init(7, 1, 2));
+  chain_add_node(&chn, transaction_init(9, 2, 0));
+
+  int indices[3];
+  int count1 = chain_account_history(&chn, 2, indices, 3);
+  int result = (count1 == 2) + (indices[0] == 1) + (indices[1] == 2) + (chn.num_segments == 1) +
+               (chain_account_history(&chn, 9, indices, 3) == 0);
+
+  // Round trip the filters through a file, and check a chain with a different segment count rejects them
+  chain_save_segment_filters(&chn, "test_segment_filters.bin");
+  chain empty = chain_init();
+  result += chain_load_segment_filters(&chn, "test_segment_filters.bin") +
+            (chain_load_segment_filters(&empty, "test_segment_filters.bin") == 0) +
+            (chain_load_segment_filters(&chn, "test_missing_filters.bin") == 0) +
+            bloom_filter_may_contain(chn.segment_filters[0], 2) +
+            (chain_account_history(&chn, 0, indices, 1) == 2) + (indices[0] == 0);
+  remove("test_segment_filters.bin");
+
+  chain_free(&chn);
+  chain_free(&empty);
+
+  return (result == 11);
+}
+
+int test_blockchain_10() {
+  chain chn = chain_init();
+  chain_add_node(&chn, transaction_init(5, 0, 1));
+  chain_add_node(&chn, transaction_init(7, 1, 2));
+  chain_add_node(&chn, transaction_init(9, 2, 3));
+  chain_node *old_end = chn.end;
+
+  // Mine a competing branch of three blocks off the genesis block
+  block fork_blocks[3];
+  block prev_blk = *chn.start->blk;
+  for (int i = 0; i < 3; i++) {
+    fork_blocks[i] = block_init(prev_blk, transaction_init(100 + i, 4, 5));
+    block_find_proof_of_work(fork_blocks + i);
+    prev_blk = fork_blocks[i];
+  }
+
+  // The branch only takes over once it has strictly more work than the active one
+  int result = (chain_accept_block(&chn, fork_blocks[0]) != NULL) + (chn.end == old_end);
+  result += (chain_accept_block(&chn, fork_blocks[1]) != NULL) + (chn.end == old_end);
+  chain_node *new_end = chain_accept_block(&chn, fork_blocks[2]);
+
+  int indices[4];
+  result += (new_end != NULL) + (chn.end == new_end) + (chn.size == 4) + (chn.num_blocks == 6) +
+            (chn.columns.size == 4) + (chn.columns.amounts[1] == 100) + (chn.columns.amounts[3] == 102) +
+            (chain_account_history(&chn, 2, indices, 4) == 0) + (chain_account_history(&chn, 5, indices, 4) == 3) +
+            (chain_get_node(&chn, 1)->blk->trans.amount == 100) +
+            (chain_find_block(&chn, old_end->hash) == old_end);
+
+  // Extending the old branch past the new one switches back
+  block old_branch_blocks[2];
+  prev_blk = *old_end->blk;
+  for (int i = 0; i < 2; i++) {
+    old_branch_blocks[i] = block_init(prev_blk, transaction_init(11 + i, 3, 0));
+    block_find_proof_of_work(old_branch_blocks + i);
+    prev_blk = old_branch_blocks[i];
+  }
+  chain_accept_block(&chn, old_branch_blocks[0]);
+  result += (chn.end == new_end);
+  chain_accept_block(&chn, old_branch_blocks[1]);
+  result += (chn.end->prev->prev == old_end) + (chn.size == 5) + (chn.columns.amounts[1] == 7) +
+            (chn.columns.amounts[4] == 12);
+
+  chain_free(&chn);
+
+  return (result == 20);
+}
+
+int test_blockchain_11() {
+  chain chn = chain_init();
+  chain_add_node(&chn, transaction_init(5, 0, 1));
+
+  block orphan = block_init(*chn.start->blk, transaction_init(1, 0, 1));
+  bitmap_set_byte(&(orphan.prev_hash), 0, 255);  // Its previous block isn't in the chain
+  block_find_proof_of_work(&orphan);
+
+  block unmined = block_init(*chn.start->blk, transaction_init(1, 0, 1));
+  while (block_proof_of_work_is_valid(unmined)) unmined.proof_of_work++;
+
+  block genesis = block_init_genesis(transaction_init(1, 0, 1));
+  block_find_proof_of_work(&genesis);
+
+  block duplicate = block_init_genesis(chn.start->blk->trans);
+  duplicate.proof_of_work = chn.start->blk->proof_of_work;
+
+  int result = (chain_accept_block(&chn, orphan) == NULL) + (chain_accept_block(&chn, unmined) == NULL) +
+               (chain_accept_block(&chn, genesis) == NULL) + (chain_accept_block(&chn, duplicate) == NULL) +
+               (chn.num_blocks == 1);
+
+  block_free(&orphan);
+  block_free(&unmined);
+  block_free(&genesis);
+  block_free(&duplicate);
+  chain_free(&chn);
+
+  return (result == 5);
+}
+
+typedef struct snapshot_reader_args {
+  chain *chn;
+  int done;
+  int inconsistent_reads;
+} snapshot_reader_args;
+
+// Repeatedly snapshot the chain and check each snapshot is self-consistent, until the appender is done
+void *snapshot_reader(void *arg) {
+  snapshot_reader_args *args = arg;
+  int inconsistent_reads = 0;
+
+  while (!__atomic_load_n(&(args->done), __ATOMIC_ACQUIRE)) {
+    chain_snapshot snap = chain_take_snapshot(args->chn);
+
+    int walked = 0;
+    for (chain_node *p = snap.end; p != NULL; p = p->prev) walked++;
+
+    // Every transaction is between accounts 0 and 1, so their balances cancel out
+    double total = chain_snapshot_account_balance(snap, 0) + chain_snapshot_account_balance(snap, 1);
+    int indices[1];
+    int history_size = chain_snapshot_account_history(snap, 0, indices, 1);
+
+    inconsistent_reads += (walked != snap.size) + (total != 0) + (history_size != snap.size);
+    sched_yield();  // Leave the appender some time on machines with few cores
+  }
+
+  __atomic_fetch_add(&(args->inconsistent_reads), inconsistent_reads, __ATOMIC_RELAXED);
+
+  return NULL;
+}
+
+int test_blockchain_12() {
+  chain chn = chain_init();
+  snapshot_reader_args args = {&chn, 0, 0};
+
+  pthread_t readers[NUM_SNAPSHOT_READERS];
+  for (int i = 0; i < NUM_SNAPSHOT_READERS; i++) pthread_create(readers + i, NULL, snapshot_reader, &args);
+
+  for (int i = 0; i < 8; i++) chain_add_node(&chn, transaction_init(i + 1, i % 2, 1 - i % 2));
+
+  __atomic_store_n(&(args.done), 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < NUM_SNAPSHOT_READERS; i++) pthread_join(readers[i], NULL);
+
+  chain_snapshot snap = chain_take_snapshot(&chn);
+  int result = (args.inconsistent_reads == 0) + (snap.size == 8) + (snap.end == chn.end) +
+               (chain_snapshot_get_node(snap, 0) == chn.start) + (chain_snapshot_account_balance(snap, 0) == 4);
+
+  chain_free(&chn);
+
+  return (result == 5);
+}
+
+int test_blockchain_13() {
+  chain chn = chain_init();
+  for (int i = 0; i < 3; i++) chain_add_node(&chn, transaction_init(i + 1, 0, 1));
+
+  int result = chain_validate(&chn) + (chn.checkpoint.index == 2);
+
+  // Blocks up to the checkpoint are trusted, so changing the genesis block goes unnoticed...
+  chn.start->blk->trans.amount = 1000;
+  chain_add_node(&chn, transaction_init(4, 0, 1));
+  result += chain_validate(&chn) + (chn.checkpoint.index == 3);
+
+  chain_save_checkpoint(&chn, "test_checkpoint.bin");
+  result += chain_load_checkpoint(&chn, "test_checkpoint.bin") + (chn.checkpoint.index == 3) +
+            (chain_load_checkpoint(&chn, "test_missing_checkpoint.bin") == 0);
+  remove("test_checkpoint.bin");
+
+  // ...until the checkpoint block itself no longer matches, which forces validation from genesis
+  chn.end->blk->trans.amount = 1000;
+  result += (chain_validate(&chn) == 0) + (chn.checkpoint.index == 3);
+
+  chn.start->blk->trans.amount = 1;
+  chn.end->blk->trans.amount = 4;
+  result += chain_validate(&chn);
+
+  chain_free(&chn);
+
+  return (result == 10);
+}
+
+int test_bloom_1() {
+  bloom_filter filter = bloom_filter_init(500 * BLOOM_BITS_PER_KEY, BLOOM_FILTER_HASHES);
+  for (int i = 0; i < 500; i++) bloom_filter_add(&filter, 2 * i);
+
+  // Every added key must be found, and few of the keys that weren't added should be
+  int found = 0;
+  int false_positives = 0;
+  for (int i = 0; i < 500; i++) {
+    found += bloom_filter_may_contain(filter, 2 * i);
+    false_positives += bloom_filter_may_contain(filter, 2 * i + 1);
+  }
+
+  bloom_filter_free(&filter);
+
+  return (found == 500 && false_positives < 25);
+}
+
+int test_bloom_2() {
+  // Full segments where every block has two accounts no other block has, the worst case for the filters. Only the
+  // columns and filters are filled, since they are all an account history scan reads
+  int num_segments = 8;
+  chain chn = chain_init();
+  for (int i = 0; i < num_segments * CHAIN_SEGMENT_SIZE; i++) {
+    transaction trans = {1, 2 * i, 2 * i + 1, i};
+    transaction_columns_append(&(chn.columns), trans);
+    _chain_add_to_segment_filters(&chn, i, trans);
+  }
+
+  // Accounts that never appear should have almost every segment skipped
+  int num_missing = 200;
+  int scanned_segments = 0;
+  int result = (chn.num_segments == num_segments);
+  for (int account = 0; account < num_missing; account++) {
+    int account_id = 2 * num_segments * CHAIN_SEGMENT_SIZE + account;
+    for (int segment = 0; segment < num_segments; segment++) {
+      scanned_segments += bloom_filter_may_contain(chn.segment_filters[segment], account_id);
+    }
+    result += (chain_account_history(&chn, account_id, NULL, 0) == 0);
+  }
+
+  // An account that does appear is still found, in the last segment
+  int indices[1];
+  result += (chain_account_history(&chn, 2 * (num_segments * CHAIN_SEGMENT_SIZE - 1), indices, 1) == 1) +
+            (indices[0] == num_segments * CHAIN_SEGMENT_SIZE - 1);
+
+  chain_free(&chn);
+
+  // The filters are sized for a 1% false-positive rate, so allow up to 5% of segments to be scanned
+  return (result == 1 + num_missing + 2) && (scanned_segments * 20 < num_missing * num_segments);
+}
+
+int test_shard_1() {
+  sharded_ledger ledger = sharded_ledger_init(3);
+
+  // Accounts 0 to 5, so each shard owns two accounts, with a mix of transfers within and between shards
+  transaction transactions[9];
+  for (int i = 0; i < 9; i++) transactions[i] = transaction_init(i + 1, i % 6, (i * 4 + 1) % 6);
+
+  sharded_ledger_submit(&ledger, transactions, 9);
+
+  // Compare with the balances from applying the transactions in one place
+  double expected_balances[6] = {0};
+  int cross_shard = 0;
+  for (int i = 0; i < 9; i++) {
+    expected_balances[transactions[i].payer_id] -= transactions[i].amount;
+    expected_balances[transactions[i].payee_id] += transactions[i].amount;
+    cross_shard += (sharded_ledger_shard_of(ledger, transactions[i].payer_id) !=
+                    sharded_ledger_shard_of(ledger, transactions[i].payee_id));
+  }
+
+  int result = (sharded_ledger_size(&ledger) == 9 + cross_shard) + (sharded_ledger_total_amount(&ledger) == 45) +
+               (sharded_ledger_shard_of(ledger, -4) == 2);
+  for (int i = 0; i < 6; i++) result += (sharded_ledger_account_balance(&ledger, i) == expected_balances[i]);
+
+  sharded_ledger_free(&ledger);
+
+  return (result == 9);
+}
+
+// Get whether `chn1` and `chn2` have the same blocks in their active branches
+int _chains_have_same_blocks(chain *chn1, chain *chn2) {
+  if (chn1->size != chn2->size) return 0;
+
+  for (int i = 0; i < chn1->size; i++) {
+    if (!bitmap_equal(chain_get_node(chn1, i)->hash, chain_get_node(chn2, i)->hash)) return 0;
+  }
+
+  return 1;
+}
+
+int test_storage_1() {
+  chain chn = chain_init();
+  for (int i = 0; i < 5; i++) chain_add_node(&chn, transaction_init(i + 1, i, i + 1));
+
+  remove("test_block.log");
+  block_log log = block_log_open("test_block.log", SYNC_EVERY_N_BLOCKS, 2);
+  for (int i = 0; i < 5; i++) block_log_append(&log, *chain_get_node(&chn, i)->blk);
+  block_log_close(&log);
+
+  // Reopen with a different policy and rebuild the chain without mining
+  chain loaded = chain_init();
+  log = block_log_open("test_block.log", SYNC_INTERVAL, 10);
+  int result = (log.num_records == 5) + (block_log_load(&log, &loaded) == 5) + (loaded.size == 5) +
+               bitmap_equal(loaded.end->hash, chn.end->hash) + (loaded.end->blk->trans.amount == 5) +
+               (loaded.start->blk->prev_hash.size == 0);
+  block_log_close(&log);
+  remove("test_block.log");
+
+  // The standard check value for CRC-32
+  result += (crc32((const byte *)"123456789", 9) == 0xcbf43926);
+
+  chain_free(&chn);
+  chain_free(&loaded);
+
+  return (result == 7);
+}
+
+int test_storage_2() {
+  chain chn = chain_init();
+  for (int i = 0; i < 3; i++) chain_add_node(&chn, transaction_init(i + 1, i, i + 1));
+
+  remove("test_block.log");
+  block_log log = block_log_open("test_block.log", SYNC_EVERY_BLOCK, 0);
+  for (int i = 0; i < 3; i++) block_log_append(&log, *chain_get_node(&chn, i)->blk);
+  block_log_close(&log);
+
+  // A torn write leaves part of a record at the end
+  FILE *file = fopen("test_block.log", "ab");
+  fwrite("torn", 1, 4, file);
+  fclose(file);
+
+  log = block_log_open("test_block.log", SYNC_EVERY_BLOCK, 0);
+  int result = (log.num_records == 3);
+  block_log_close(&log);
+
+  // A corrupt final record fails its checksum
+  file = fopen("test_block.log", "r+b");
+  fseek(file, BLOCK_LOG_HEADER_SIZE + 2 * BLOCK_RECORD_SIZE + RECORD_HEADER_SIZE + 40, SEEK_SET);
+  fputc(0xff, file);
+  fclose(file);
+
+  chain loaded = chain_init();
+  log = block_log_open("test_block.log", SYNC_EVERY_BLOCK, 0);
+  result += (log.num_records == 2) + (block_log_load(&log, &loaded) == 2);
+
+  // Appending carries on from the last intact record
+  block_log_append(&log, *chn.end->blk);
+  block_log_close(&log);
+  log = block_log_open("test_block.log", SYNC_EVERY_BLOCK, 0);
+  result += (log.num_records == 3) + (block_log_load(&log, &loaded) == 1) + (loaded.size == 3);
+  block_log_close(&log);
+  remove("test_block.log");
+
+  chain_free(&chn);
+  chain_free(&loaded);
+
+  return (result == 6);
+}
+
+int test_storage_3() {
+  chain chn = chain_init();
+  for (int i = 0; i < 4; i++) chain_add_node(&chn, transaction_init(i + 0.5, i, i + 1));
+
+  mapped_chain_write(&chn, "test_chain.img");
+  mapped_chain mchn = mapped_chain_open("test_chain.img");
+
+  int result = (mchn.size == 4);
+  for (int i = 0; i < 4; i++) {
+    chain_node *node = chain_get_node(&chn, i);
+    block blk = mapped_chain_get_block(mchn, i);
+    result += bitmap_equal(blk.prev_hash, node->blk->prev_hash) +
+              bitmap_equal(mapped_chain_get_hash(mchn, i), node->hash) +
+              (blk.proof_of_work == node->blk->proof_of_work) + (blk.trans.amount == i + 0.5) +
+              (blk.trans.payee_id == i + 1) + (blk.trans.transaction_id == node->blk->trans.transaction_id);
+  }
+
+  mapped_chain_close(&mchn);
+  remove("test_chain.img");
+  chain_free(&chn);
+
+  return (result == 25);
+}
+
+int test_storage_4() {
+  chain chn = chain_init();
+  for (int i = 0; i < 4; i++) chain_add_node(&chn, transaction_init(i + 1, i % 3, (i + 1) % 3));
+
+  // Snapshot the balances after the second block
+  balance_table table = balance_table_init();
+  balance_table_apply(&table, chn.start->blk->trans);
+  balance_table_apply(&table, chain_get_node(&chn, 1)->blk->trans);
+  balance_snapshot_save(table, chain_get_node(&chn, 1), "test_balances.snapshot");
+  balance_table_free(&table);
+
+  int replayed;
+  balance_table restored = chain_restore_balances(&chn, "test_balances.snapshot", &replayed);
+  balance_table expected = chain_compute_balances(&chn, 0, balance_table_init());
+
+  int result = (replayed == 2) + (restored.size == expected.size) + (balance_table_get(restored, 7) == 0);
+  for (int i = 0; i < 3; i++) result += (balance_table_get(restored, i) == balance_table_get(expected, i));
+  balance_table_free(&restored);
+
+  // A corrupt snapshot is ignored
+  FILE *file = fopen("test_balances.snapshot", "r+b");
+  fseek(file, 20, SEEK_SET);
+  fputc(0xff, file);
+  fclose(file);
+  restored = chain_restore_balances(&chn, "test_balances.snapshot", &replayed);
+  result += (replayed == 4) + (balance_table_get(restored, 0) == balance_table_get(expected, 0));
+  remove("test_balances.snapshot");
+
+  balance_table_free(&restored);
+  balance_table_free(&expected);
+  chain_free(&chn);
+
+  return (result == 8);
+}
+
+int test_storage_5() {
+  byte input[3000];
+  byte compressed[3100];
+  byte output[3000];
+
+  // Repetitive data with some noise, then data with nothing to match
+  for (int i = 0; i < 3000; i++) input[i] = (i < 2000) ? "blockchain"[i % 10] ^ (i % 97 == 0) : (i * 7919) >> 3;
+
+  int compressed_size = lz_compress(input, 3000, compressed);
+  int result = (compressed_size < 1500) + (compressed_size <= lz_compress_bound(3000)) +
+               (lz_decompress(compressed, compressed_size, output, 3000) == 3000) +
+               (memcmp(input, output, 3000) == 0);
+
+  // Truncated input, and a match pointing before the start, are rejected
+  byte bad_offset[] = {0x10, 'a', 0x05, 0x00};
+  result += (lz_decompress(compressed, compressed_size / 2, output, 3000) == -1) +
+            (lz_decompress(bad_offset, 4, output, 3000) == -1) + (lz_decompress(compressed, 0, output, 0) == 0);
+
+  return (result == 7);
+}
+
+int test_storage_6() {
+  chain chn = chain_init();
+  for (int i = 0; i < 6; i++) chain_add_node(&chn, transaction_init(i + 0.25, i % 2, 1000 + i));
+
+  int result = 0;
+  for (int compress = 0; compress <= 1; compress++) {
+    chain_write_compact(&chn, "test_chain.compact", compress);
+
+    FILE *file = fopen("test_chain.compact", "rb");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+
+    // Far smaller than the text serialisation, even before compression
+    chain loaded = chain_init();
+    result += (size < 6 * 24) + (chain_read_compact("test_chain.compact", &loaded) == 6) + (loaded.size == 6) +
+              bitmap_equal(loaded.end->hash, chn.end->hash) + (loaded.end->blk->trans.payee_id == 1005) +
+              (loaded.end->blk->trans.transaction_id == chn.end->blk->trans.transaction_id);
+
+    chain_free(&loaded);
+  }
+  remove("test_chain.compact");
+  chain_free(&chn);
+
+  return (result == 12);
+}
+
+int test_storage_7() {
+  remove("test_block.log");
+  block_log log = block_log_open("test_block.log", SYNC_EVERY_N_BLOCKS, 16);
+  chain chn = chain_init();
+  chain_use_block_log(&chn, &log, 2);
+
+  // Each block is logged once mined, as in the program, and all but the newest two leave memory
+  int num_blocks = CHAIN_FAULTED_BLOCKS + 16;
+  for (int i = 0; i < num_blocks; i++) {
+    chain_add_node(&chn, transaction_init(i + 1, 0, 1));
+    block_log_append(&log, *chn.end->blk);
+  }
+  int resident = 0;
+  for (chain_node *p = chn.end; p != NULL; p = p->prev) resident += (p->blk != NULL);
+  int result = (resident == 2) + (chn.evicted_size == num_blocks - 2);
+
+  // Evicted blocks are read back through `chain_get_node`, and only a bounded number stay in memory
+  block *prev_blk = chain_get_node(&chn, 0)->blk;
+  int links = (prev_blk->prev_hash.size == 0);
+  for (int i = 1; i < num_blocks; i++) {
+    block *blk = chain_get_node(&chn, i)->blk;
+    links += block_prev_block_hash_matches(*prev_blk, *blk) && (blk->trans.amount == i + 1);
+    prev_blk = blk;
+  }
+  resident = 0;
+  for (chain_node *p = chn.end; p != NULL; p = p->prev) resident += (p->blk != NULL);
+  result += (links == num_blocks) + (resident == 2 + CHAIN_FAULTED_BLOCKS) + chain_validate(&chn);
+
+  chain_free(&chn);
+  block_log_close(&log);
+
+  // After a restart the chain is loaded from the log, evicting blocks as it goes
+  log = block_log_open("test_block.log", SYNC_EVERY_BLOCK, 0);
+  chain loaded = chain_init();
+  chain_use_block_log(&loaded, &log, 2);
+  result += (block_log_load(&log, &loaded) == num_blocks) + (loaded.evicted_size == num_blocks - 2) +
+            (chain_get_node(&loaded, 3)->blk->trans.amount == 4);
+
+  chain_free(&loaded);
+  block_log_close(&log);
+  remove("test_block.log");
+
+  return (result == 8);
+}
+
+int test_storage_8() {
+  chain chn = chain_init();
+  for (int i = 0; i < 9; i++) chain_add_node(&chn, transaction_init(i + 1, i % 3, (i + 1) % 4));
+
+  remove("test_block.log");
+  block_log log = block_log_open("test_block.log", SYNC_EVERY_N_BLOCKS, 4);
+  for (int i = 0; i < 9; i++) block_log_append(&log, *chain_get_node(&chn, i)->blk);
+
+  // More threads than blocks leaves some runs empty
+  int result = 0;
+  int thread_counts[3] = {1, 4, 16};
+  balance_table expected = chain_compute_balances(&chn, 0, balance_table_init());
+  for (int i = 0; i < 3; i++) {
+    chain reindexed = chain_init();
+    balance_table balances = balance_table_init();
+    result += (block_log_reindex(&log, &reindexed, thread_counts[i], &balances) == 9) +
+              _chains_have_same_blocks(&chn, &reindexed);
+    for (int account_id = 0; account_id < 4; account_id++) {
+      result += (balance_table_get(balances, account_id) == balance_table_get(expected, account_id));
+    }
+
+    // The columns and filters built by the threads match those built one block at a time
+    int mismatches = (reindexed.columns.size != 9) + (reindexed.num_segments != chn.num_segments);
+    for (int j = 0; j < 9 && mismatches == 0; j++) {
+      transaction trans = transaction_columns_get(reindexed.columns, j);
+      transaction expected_trans = transaction_columns_get(chn.columns, j);
+      mismatches += (trans.amount != expected_trans.amount) + (trans.payer_id != expected_trans.payer_id) +
+                    (trans.payee_id != expected_trans.payee_id) +
+                    (trans.transaction_id != expected_trans.transaction_id);
+    }
+    for (int j = 0; j < chn.num_segments && mismatches == 0; j++) {
+      mismatches += !bitmap_equal(reindexed.segment_filters[j].bits, chn.segment_filters[j].bits);
+    }
+    result += (mismatches == 0);
+
+    balance_table_free(&balances);
+    chain_free(&reindexed);
+  }
+
+  // A block that doesn't follow the one before it ends the reindex, along with the blocks after it
+  block_log_append(&log, *chain_get_node(&chn, 3)->blk);
+  block_log_append(&log, *chain_get_node(&chn, 4)->blk);
+  chain reindexed = chain_init();
+  balance_table balances = balance_table_init();
+  result += (block_log_reindex(&log, &reindexed, 3, &balances) == 9) + (reindexed.size == 9) +
+            (balance_table_get(balances, 1) == balance_table_get(expected, 1));
+
+  balance_table_free(&balances);
+  balance_table_free(&expected);
+  chain_free(&reindexed);
+  block_log_close(&log);
+  remove("test_block.log");
+  chain_free(&chn);
+
+  return (result == 24);
+}
+
+int test_storage_9() {
+  char path[PENDING_SEGMENT_PATH_MAX];
+  for (int i = 0; i < 3; i++) {
+    snprintf(path, PENDING_SEGMENT_PATH_MAX, "test_pending.wal.%d", i);
+    remove(path);
+  }
+  chain chn = chain_init();
+
+  // Transactions acknowledged before a crash are replayed on restart
+  pending_log log = pending_log_open("test_pending.wal", 2, &chn);
+  for (int i = 0; i < 3; i++) pending_log_append(&log, transaction_init(i + 1, i, i + 1));
+  pending_log_sync(&log);
+  transaction first = log.queue[log.queue_head];
+  close(log.fd);  // Crash without confirming anything
+  free(log.segments);
+  free(log.queue);
+  free(log.queue_seqs);
+
+  log = pending_log_open("test_pending.wal", 2, &chn);
+  transaction *queue = log.queue + log.queue_head;
+  int result = (log.queue_size == 3) + (queue[0].transaction_id == first.transaction_id) + (queue[2].amount == 3);
+  result += (transaction_init(1, 0, 1).transaction_id > queue[2].transaction_id);
+
+  // Two are mined, but the run stops before they are confirmed, so they are dropped on the next replay
+  chain_add_node(&chn, queue[0]);
+  chain_add_node(&chn, queue[1]);
+  pending_log_close(&log);
+  log = pending_log_open("test_pending.wal", 2, &chn);
+  result += (log.queue_size == 1) + (log.queue[log.queue_head].amount == 3);
+
+  // A full segment is deleted once all of its transactions are confirmed
+  for (int i = 0; i < PENDING_LOG_SEGMENT_RECORDS + 1; i++) pending_log_append(&log, transaction_init(1, 0, 1));
+  int first_seq = log.segments[0].seq;
+  result += (log.num_segments == 3);
+  pending_log_confirm(&log, 2 + PENDING_LOG_SEGMENT_RECORDS);
+
+  snprintf(path, PENDING_SEGMENT_PATH_MAX, "test_pending.wal.%d", first_seq + 1);
+  result += (log.num_segments == 1) + (access(path, F_OK) != 0) + (log.queue_size == 0);
+
+  // Confirming as they are mined, the confirmed transactions are dropped from the queue as segments roll over
+  for (int i = 0; i < 2 * PENDING_LOG_SEGMENT_RECORDS; i++) {
+    pending_log_append(&log, transaction_init(1, 0, 1));
+    pending_log_confirm(&log, 1);
+  }
+  result += (log.num_segments == 1) + (log.queue_size == 0) + (log.queue_head <= PENDING_LOG_SEGMENT_RECORDS);
+
+  // Nothing is left once everything is confirmed
+  pending_log_close(&log);
+  snprintf(path, PENDING_SEGMENT_PATH_MAX, "test_pending.wal.%d", first_seq + 2);
+  result += (access(path, F_OK) != 0);
+
+  chain_free(&chn);
+
+  return (result == 14);
+}
+
+int test_storage_10() {
+  chain chn = chain_init();
+  for (int i = 0; i < 3; i++) chain_add_node(&chn, transaction_init(i + 1, i, i + 1));
+
+  // Appended records are in the file straight away, even if the log is never synced or closed
+  remove("test_block.log");
+  block_log log = block_log_open("test_block.log", SYNC_EVERY_N_BLOCKS, 100);
+  for (int i = 0; i < 3; i++) block_log_append(&log, *chain_get_node(&chn, i)->blk);
+
+  chain loaded = chain_init();
+  block_log reopened = block_log_open("test_block.log", SYNC_EVERY_BLOCK, 0);
+  int result = (reopened.num_records == 3) + (block_log_load(&reopened, &loaded) == 3) +
+               bitmap_equal(loaded.end->hash, chn.end->hash) + (log.unsynced_records == 3);
+  block_log_close(&reopened);
+  block_log_close(&log);
+
+  // Under SYNC_INTERVAL the syncer thread catches up without any more appends
+  log = block_log_open("test_block.log", SYNC_INTERVAL, 5);
+  block_log_append(&log, *chn.end->blk);
+  int unsynced = 1;
+  for (int i = 0; i < 1000 && unsynced > 0; i++) {
+    usleep(1000);
+    pthread_mutex_lock(&(log.syncer->lock));
+    unsynced = log.syncer->unsynced_records;
+    pthread_mutex_unlock(&(log.syncer->lock));
+  }
+  result += (unsynced == 0) + (log.num_records == 4);
+  block_log_close(&log);
+  remove("test_block.log");
+
+  chain_free(&chn);
+  chain_free(&loaded);
+
+  return (result == 6);
+}
+
+// Overwrite the four bytes at `offset` of the file at `path` with `value`, stored as the storage module does
+void _storage_test_patch_u32(const char *path, long offset, u32 value) {
+  byte bytes[4];
+  _store_u32(bytes, value);
+  FILE *file = fopen(path, "r+b");
+  fseek(file, offset, SEEK_SET);
+  fwrite(bytes, 1, 4, file);
+  fclose(file);
+}
+
+int test_storage_11() {
+  chain chn = chain_init();
+  for (int i = 0; i < 6; i++) chain_add_node(&chn, transaction_init(i + 0.25, i, i + 1));
+  long segment_offset = COMPACT_CHAIN_HEADER_SIZE;
+  int result = 0;
+
+  // More blocks promised in the header than the segment holds
+  chain loaded = chain_init();
+  chain_write_compact(&chn, "test_chain.compact", 0);
+  _storage_test_patch_u32("test_chain.compact", 12, 7);
+  result += (chain_read_compact("test_chain.compact", &loaded) == 0) + (loaded.size == 0);
+
+  // A segment whose blocks stop before the end of its data
+  chain_write_compact(&chn, "test_chain.compact", 0);
+  _storage_test_patch_u32("test_chain.compact", 12, 5);
+  _storage_test_patch_u32("test_chain.compact", segment_offset, 5);
+  result += (chain_read_compact("test_chain.compact", &loaded) == 0) + (loaded.size == 0);
+
+  // A damaged block fails the checksum
+  chain_write_compact(&chn, "test_chain.compact", 1);
+  _storage_test_patch_u32("test_chain.compact", segment_offset + COMPACT_SEGMENT_HEADER_SIZE, 0);
+  result += (chain_read_compact("test_chain.compact", &loaded) == 0) + (loaded.size == 0);
+
+  // A size that would read past the buffers
+  chain_write_compact(&chn, "test_chain.compact", 0);
+  _storage_test_patch_u32("test_chain.compact", segment_offset + 8, -1);
+  result += (chain_read_compact("test_chain.compact", &loaded) == 0) + (loaded.size == 0);
+
+  remove("test_chain.compact");
+  chain_free(&chn);
+  chain_free(&loaded);
+
+  return (result == 8);
+}
+
 // Run full bitmap tests
 int test_bitmap_full() {
   printf("Commencing %d bitmap tests.\n", NUM_BITMAP_TESTS);
@@ -611,7 +1855,9 @@ int test_bitmap_full() {
       &test_bitmap_1,  &test_bitmap_2,  &test_bitmap_3,  &test_bitmap_4,  &test_bitmap_5,  &test_bitmap_6,
       &test_bitmap_7,  &test_bitmap_8,  &test_bitmap_9,  &test_bitmap_10, &test_bitmap_11, &test_bitmap_12,
       &test_bitmap_13, &test_bitmap_14, &test_bitmap_15, &test_bitmap_16, &test_bitmap_17, &test_bitmap_18,
-      &test_bitmap_19, &test_bitmap_20, &test_bitmap_21, &test_bitmap_22, &test_bitmap_23, &test_bitmap_24};
+      &test_bitmap_19, &test_bitmap_20, &test_bitmap_21, &test_bitmap_22, &test_bitmap_23, &test_bitmap_24,
+      &test_bitmap_25, &test_bitmap_26, &test_bitmap_27, &test_bitmap_28, &test_bitmap_29, &test_bitmap_30,
+      &test_bitmap_31, &test_bitmap_32, &test_bitmap_33};
   int passed_tests = 0;
 
   for (int i = 0; i < NUM_BITMAP_TESTS; i++) {
@@ -648,7 +1894,10 @@ int test_sha256_full() {
 int test_blockchain_full() {
   printf("Commencing %d blockchain tests.\n", NUM_BLOCKCHAIN_TESTS);
   test tests[NUM_BLOCKCHAIN_TESTS] = {&test_blockchain_1, &test_blockchain_2, &test_blockchain_3,
-                                      &test_blockchain_4, &test_blockchain_5};
+                                      &test_blockchain_4, &test_blockchain_5, &test_blockchain_6,
+                                      &test_blockchain_7, &test_blockchain_8, &test_blockchain_9,
+                                      &test_blockchain_10, &test_blockchain_11, &test_blockchain_12,
+                                      &test_blockchain_13};
   int passed_tests = 0;
 
   for (int i = 0; i < NUM_BLOCKCHAIN_TESTS; i++) {
@@ -663,6 +1912,282 @@ int test_blockchain_full() {
   return passed_tests;
 }
 
+// Run bloom filter tests
+int test_bloom_full() {
+  printf("Commencing %d bloom filter tests.\n", NUM_BLOOM_TESTS);
+  test tests[NUM_BLOOM_TESTS] = {&test_bloom_1, &test_bloom_2};
+  int passed_tests = 0;
+
+  for (int i = 0; i < NUM_BLOOM_TESTS; i++) {
+    if (tests[i]())
+      passed_tests++;
+    else
+      printf("> Test %d failed.\n", i + 1);
+  }
+
+  printf("Passed %d/%d bloom filter tests.\n", passed_tests, NUM_BLOOM_TESTS);
+
+  return passed_tests;
+}
+
+// Run sharded ledger tests
+int test_shard_full() {
+  printf("Commencing %d sharded ledger tests.\n", NUM_SHARD_TESTS);
+  test tests[NUM_SHARD_TESTS] = {&test_shard_1};
+  int passed_tests = 0;
+
+  for (int i = 0; i < NUM_SHARD_TESTS; i++) {
+    if (tests[i]())
+      passed_tests++;
+    else
+      printf("> Test %d failed.\n", i + 1);
+  }
+
+  printf("Passed %d/%d sharded ledger tests.\n", passed_tests, NUM_SHARD_TESTS);
+
+  return passed_tests;
+}
+
+// Run storage tests
+int test_storage_full() {
+  printf("Commencing %d storage tests.\n", NUM_STORAGE_TESTS);
+  test tests[NUM_STORAGE_TESTS] = {&test_storage_1, &test_storage_2, &test_storage_3,
+                                   &test_storage_4, &test_storage_5, &test_storage_6, &test_storage_7,
+                                   &test_storage_8, &test_storage_9, &test_storage_10, &test_storage_11};
+  int passed_tests = 0;
+
+  for (int i = 0; i < NUM_STORAGE_TESTS; i++) {
+    if (tests[i]())
+      passed_tests++;
+    else
+      printf("> Test %d failed.\n", i + 1);
+  }
+
+  printf("Passed %d/%d storage tests.\n", passed_tests, NUM_STORAGE_TESTS);
+
+  return passed_tests;
+}
+
+int test_stream_1() {
+  chain chn = chain_init();
+  for (int i = 0; i < 6; i++) chain_add_node(&chn, transaction_init(i + 0.5, i, i + 1));
+
+  int result = 0;
+  StreamFormat formats[2] = {STREAM_TEXT, STREAM_BINARY};
+  for (int i = 0; i < 2; i++) {
+    FILE *file = tmpfile();
+    chain_export(&chn, file, formats[i]);
+    rewind(file);
+
+    chain imported = chain_init();
+    result += (chain_import(file, formats[i], &imported, 3) == 6) + _chains_have_same_blocks(&chn, &imported);
+    result += (chain_validate(&imported) == 1);
+
+    chain_free(&imported);
+    fclose(file);
+  }
+
+  chain_free(&chn);
+
+  return (result == 6);
+}
+
+int test_stream_2() {
+  chain chn = chain_init();
+  for (int i = 0; i < 4; i++) chain_add_node(&chn, transaction_init(1, 0, 1));
+
+  FILE *file = tmpfile();
+  chain_export(&chn, file, STREAM_TEXT);
+  rewind(file);
+  char text[4 * BLOCK_SERIALISATION_MAX_CHARS];
+  int length = fread(text, 1, sizeof text - 1, file);
+  text[length] = '\0';
+
+  // A truncated stream is malformed
+  FILE *truncated = tmpfile();
+  fwrite(text, 1, length - 4, truncated);
+  rewind(truncated);
+
+  chain imported = chain_init();
+  int result = (chain_import(truncated, STREAM_TEXT, &imported, 1) == -1) + (imported.size == 3);
+  chain_free(&imported);
+
+  char *third_amount = strstr(strstr(strstr(text, "1.000000") + 1, "1.000000") + 1, "1.000000");
+  third_amount[0] = '2';  // Invalidates the third block's proof of work, so only the first two are imported
+
+  FILE *tampered = tmpfile();
+  fputs(text, tampered);
+  rewind(tampered);
+
+  imported = chain_init();
+  result += (chain_import(tampered, STREAM_TEXT, &imported, 2) == -1) + (imported.size == 2);
+  chain_free(&imported);
+
+  // A binary stream without its header is malformed
+  rewind(tampered);
+  imported = chain_init();
+  result += (chain_import(tampered, STREAM_BINARY, &imported, 1) == -1) + (imported.size == 0);
+  chain_free(&imported);
+
+  fclose(file);
+  fclose(tampered);
+  fclose(truncated);
+  chain_free(&chn);
+
+  return (result == 6);
+}
+
+// Run full stream tests
+int test_stream_full() {
+  printf("Commencing %d stream tests.\n", NUM_STREAM_TESTS);
+  test tests[NUM_STREAM_TESTS] = {&test_stream_1, &test_stream_2};
+  int passed_tests = 0;
+
+  for (int i = 0; i < NUM_STREAM_TESTS; i++) {
+    if (tests[i]())
+      passed_tests++;
+    else
+      printf("> Test %d failed.\n", i + 1);
+  }
+
+  printf("Passed %d/%d stream tests.\n", passed_tests, NUM_STREAM_TESTS);
+
+  return passed_tests;
+}
+
+// Get a bitmap spanning several roaring chunks, with one sparse, one dense and one full of runs, and a gap
+bitmap _roaring_test_bitmap(int seed) {
+  bitmap bmap = bitmap_init_zeros(4 * ROARING_CHUNK_BITS + 100);
+
+  for (int i = seed; i < ROARING_CHUNK_BITS; i += 997 + seed) bitmap_set_bit(&bmap, i, 1);
+  for (int i = ROARING_CHUNK_BITS; i < 2 * ROARING_CHUNK_BITS; i++) bitmap_set_bit(&bmap, i, (i ^ seed) % 3 == 0);
+  for (int i = 3 * ROARING_CHUNK_BITS; i < bmap.size; i++) bitmap_set_bit(&bmap, i, (i + seed) % 5000 < 3000);
+
+  return bmap;
+}
+
+int test_roaring_1() {
+  bitmap bmap = _roaring_test_bitmap(1);
+  roaring_bitmap rbmap = roaring_from_bitmap(bmap);
+
+  // Each chunk gets the smallest container for its contents, and the empty chunk gets none
+  int result = (rbmap.num_containers == 4) + (rbmap.keys[2] == 3);
+  result += (rbmap.containers[0].type == CONTAINER_ARRAY) + (rbmap.containers[1].type == CONTAINER_BITSET) +
+            (rbmap.containers[2].type == CONTAINER_RUN);
+  result += (roaring_cardinality(rbmap) == bitmap_popcount(bmap));
+
+  // Iterating visits the set bits in order
+  roaring_iterator it = roaring_iterator_init(&rbmap);
+  u32 value;
+  int expected = bitmap_find_next_set(bmap, 0);
+  int mismatches = 0;
+  while (roaring_iterator_next(&it, &value)) {
+    mismatches += (value != expected) || !roaring_contains(rbmap, value);
+    expected = bitmap_find_next_set(bmap, expected + 1);
+  }
+  result += (mismatches == 0) + (expected == -1) + !roaring_contains(rbmap, 2 * ROARING_CHUNK_BITS + 5);
+
+  bitmap round_trip = roaring_to_bitmap(rbmap, bmap.size);
+  result += bitmap_equal(round_trip, bmap);
+
+  // Adding to a run container extends a run on either side, starts a new one, or joins two across a gap
+  int gap_start = bitmap_find_next_clear(bmap, 3 * ROARING_CHUNK_BITS);
+  int gap_end = bitmap_find_next_set(bmap, gap_start);
+  int num_runs = rbmap.containers[2].num_runs;
+  roaring_add(&rbmap, gap_start);
+  roaring_add(&rbmap, gap_end - 1);
+  roaring_add(&rbmap, gap_start + 5);
+  result += (rbmap.containers[2].num_runs == num_runs + 1);
+  for (int i = gap_start; i < gap_end; i++) {
+    roaring_add(&rbmap, i);
+    bitmap_set_bit(&round_trip, i, 1);
+  }
+  bitmap filled = roaring_to_bitmap(rbmap, bmap.size);
+  result += (rbmap.containers[2].type == CONTAINER_RUN) + (rbmap.containers[2].num_runs == num_runs - 1);
+  result += bitmap_equal(filled, round_trip) + (roaring_cardinality(rbmap) == bitmap_popcount(round_trip));
+
+  // Adding values one at a time gives the same set, and optimising brings back the runs
+  roaring_bitmap added = roaring_init();
+  for (int i = bitmap_find_next_set(bmap, 0); i != -1; i = bitmap_find_next_set(bmap, i + 1)) {
+    roaring_add(&added, i);
+  }
+  roaring_add(&added, 5);
+  roaring_add(&added, 5);
+  bitmap_set_bit(&bmap, 5, 1);
+  result += (roaring_cardinality(added) == bitmap_popcount(bmap)) + (added.containers[2].type != CONTAINER_RUN);
+  roaring_optimise(&added);
+  bitmap added_bmap = roaring_to_bitmap(added, bmap.size);
+  result += bitmap_equal(added_bmap, bmap) + (added.containers[2].type == CONTAINER_RUN);
+
+  bitmap_free(&bmap);
+  bitmap_free(&round_trip);
+  bitmap_free(&filled);
+  bitmap_free(&added_bmap);
+  roaring_free(&rbmap);
+  roaring_free(&added);
+
+  return (result == 19);
+}
+
+int test_roaring_2() {
+  // Every pairing of container types, compared with the same operations on plain bitmaps
+  bitmap bmap1 = _roaring_test_bitmap(1);
+  bitmap bmap2 = _roaring_test_bitmap(2);
+  bitmap shifted = bitmap_rshift(bmap2, ROARING_CHUNK_BITS);
+  roaring_bitmap rbmap1 = roaring_from_bitmap(bmap1);
+  roaring_bitmap rbmap2 = roaring_from_bitmap(shifted);
+  int result = 0;
+
+  roaring_bitmap (*operations[3])(roaring_bitmap, roaring_bitmap) = {&roaring_and, &roaring_or, &roaring_xor};
+  bitmap (*bitmap_operations[3])(bitmap, bitmap) = {&bitmap_and, &bitmap_or, &bitmap_xor};
+  for (int op = 0; op < 3; op++) {
+    for (int pair = 0; pair < 2; pair++) {
+      roaring_bitmap other = (pair == 0) ? rbmap2 : rbmap1;
+      bitmap other_bmap = (pair == 0) ? shifted : bmap1;
+
+      roaring_bitmap combined = operations[op](rbmap1, other);
+      bitmap combined_bmap = roaring_to_bitmap(combined, bmap1.size);
+      bitmap expected = bitmap_operations[op](bmap1, other_bmap);
+      result += bitmap_equal(combined_bmap, expected) +
+                (roaring_cardinality(combined) == bitmap_popcount(expected));
+
+      roaring_free(&combined);
+      bitmap_free(&combined_bmap);
+      bitmap_free(&expected);
+    }
+  }
+
+  // Chunks that cancel out are dropped
+  roaring_bitmap nothing = roaring_xor(rbmap1, rbmap1);
+  result += (nothing.num_containers == 0) + (roaring_cardinality(nothing) == 0);
+
+  bitmap_free(&bmap1);
+  bitmap_free(&bmap2);
+  bitmap_free(&shifted);
+  roaring_free(&rbmap1);
+  roaring_free(&rbmap2);
+  roaring_free(&nothing);
+
+  return (result == 14);
+}
+
+int test_roaring_full() {
+  printf("Commencing %d roaring tests.\n", NUM_ROARING_TESTS);
+  test tests[NUM_ROARING_TESTS] = {&test_roaring_1, &test_roaring_2};
+  int passed_tests = 0;
+
+  for (int i = 0; i < NUM_ROARING_TESTS; i++) {
+    if (tests[i]())
+      passed_tests++;
+    else
+      printf("> Test %d failed.\n", i + 1);
+  }
+
+  printf("Passed %d/%d roaring tests.\n", passed_tests, NUM_ROARING_TESTS);
+
+  return passed_tests;
+}
+
 int main() {
   int passed_tests = 0;
   passed_tests += test_bitmap_full();
@@ -670,7 +2195,19 @@ int main() {
   passed_tests += test_sha256_full();
   printf("\n");
   passed_tests += test_blockchain_full();
-  printf("\nPassed %d/%d tests.\n", passed_tests, NUM_BITMAP_TESTS + NUM_SHA256_TESTS + NUM_BLOCKCHAIN_TESTS);
+  printf("\n");
+  passed_tests += test_bloom_full();
+  printf("\n");
+  passed_tests += test_shard_full();
+  printf("\n");
+  passed_tests += test_storage_full();
+  printf("\n");
+  passed_tests += test_stream_full();
+  printf("\n");
+  passed_tests += test_roaring_full();
+  printf("\nPassed %d/%d tests.\n", passed_tests,
+         NUM_BITMAP_TESTS + NUM_SHA256_TESTS + NUM_BLOCKCHAIN_TESTS + NUM_BLOOM_TESTS + NUM_SHARD_TESTS +
+             NUM_STORAGE_TESTS + NUM_STREAM_TESTS + NUM_ROARING_TESTS);
 
   return EXIT_SUCCESS;
 }